@@ -11,10 +11,13 @@
 #include "BTreeNode.h"
 #include <string.h>
 #include <queue>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
 
+bool BTreeIndex::packedLeaves = true;
+
 /*
  * BTreeIndex constructor
  */
@@ -23,6 +26,7 @@ BTreeIndex::BTreeIndex()
     rootPid = -1;
 	treeHeight = 0;
 	keyCount = 0;
+	bulkLoading = false;
 	memset(metadata, 0, PageFile::PAGE_SIZE);
 }
 
@@ -211,7 +215,7 @@ int BTreeIndex::printAll(bool print)
 			if (print)
 				nonleaf.printAll();
 
-			PageId children[128];
+			PageId children[BTNonLeafNode::MAX_NON_KEYS + 1];
 			int num_children = nonleaf.getChildren(children);
 
 			for (int i = 0; i < num_children; i++) {
@@ -238,8 +242,9 @@ int BTreeIndex::printAll(bool print)
 /*
  * Open the index file in read or write mode.
  * Under 'w' mode, the index file should be created if it does not exist.
+ * Under 'm' mode, the index file is read-only and memory-mapped.
  * @param indexname[IN] the name of the index file
- * @param mode[IN] 'r' for read, 'w' for write
+ * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
  * @return error code. 0 if no error
  */
 RC BTreeIndex::open(const string& indexname, char mode)
@@ -250,13 +255,45 @@ RC BTreeIndex::open(const string& indexname, char mode)
 	if ( error = pf.open(indexname, mode) )
 		return error;
 	
+	// a new index has no metadata yet. close() writes it.
+	if (pf.endPid() == 0 && (mode == 'w' || mode == 'W'))
+	{
+		rootPid = -1;
+		treeHeight = 0;
+		keyCount = 0;
+		return 0;
+	}
+	
 	// read in the metadata into our rootPid and treeHeight variables		
 	if ( error = pf.read(0, metadata) )
 		return error;
 	
-	memcpy(&rootPid, metadata, sizeof(PageId));
-	memcpy(&treeHeight, metadata + sizeof(PageId), sizeof(int));
-	memcpy(&keyCount, metadata + sizeof(PageId) + sizeof(int), sizeof(int));
+	FileHeader header;
+	int offset = sizeof(FileHeader);
+	memcpy(&header, metadata, sizeof(FileHeader));
+	
+	if (header.magic != FILE_MAGIC)
+	{
+		// an index from before the header was introduced. the
+		// metadata starts at offset 0, and pages are always 1KB.
+		// its nodes have the layout of version 1.
+		if (PageFile::PAGE_SIZE != 1024)
+		{
+			pf.close();
+			return RC_INVALID_FILE_FORMAT;
+		}
+		offset = 0;
+		header.version = 1;
+	}
+	else if (header.pageSize != PageFile::PAGE_SIZE || header.version > FILE_VERSION)
+	{
+		pf.close();
+		return RC_INVALID_FILE_FORMAT;
+	}
+	
+	memcpy(&rootPid, metadata + offset, sizeof(PageId));
+	memcpy(&treeHeight, metadata + offset + sizeof(PageId), sizeof(int));
+	memcpy(&keyCount, metadata + offset + sizeof(PageId) + sizeof(int), sizeof(int));
 	
 	// if the variables have odd data, reinitialize to default values 	
 	if (rootPid <= 0 || treeHeight < 0 || pf.endPid() == 0 || keyCount < 0)
@@ -266,6 +303,94 @@ RC BTreeIndex::open(const string& indexname, char mode)
 		keyCount = 0;
 	}
 	
+	// rewrite the nodes of a version 1 index in the current layout.
+	// version 2 nodes are version 3 nodes that are not packed.
+	if (header.version < 2 && treeHeight > 0)
+	{
+		if ( error = upgrade(indexname, mode) )
+		{
+			pf.close();
+			return error;
+		}
+	}
+	
+	// index lookups hop between nodes all over the file
+	if (mode == 'm' || mode == 'M')
+		pf.setAccessPattern(PageFile::RANDOM);
+	
+	return 0;
+}
+
+/*
+ * Rewrite every node of a version 1 index in the current layout.
+ * @param indexname[IN] the name of the index file
+ * @param mode[IN] the mode the index was opened in
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::upgrade(const string& indexname, char mode)
+{
+	RC error;
+	bool writable = (mode == 'w' || mode == 'W');
+	queue<BTNode> nodes;
+
+	// the nodes are converted in place, so the file must be writable
+	if (!writable)
+	{
+		pf.close();
+		if ( error = pf.open(indexname, 'w') )
+			return error;
+	}
+
+	// visit every node from the root down, as printAll() does
+	BTNode root;
+	root.height = 1;
+	root.pid = rootPid;
+	root.leaf_type = (treeHeight == 1);
+	nodes.push(root);
+
+	while (!nodes.empty()) {
+		BTNode next = nodes.front();
+		nodes.pop();
+
+		if (next.leaf_type) {
+			BTLeafNode leaf;
+			if ( (error = leaf.read(next.pid, pf)) || 
+			     (error = leaf.convertPairLayout()) ||
+			     (error = leaf.write(next.pid, pf)) )
+				return error;
+		}
+		else {
+			BTNonLeafNode nonleaf;
+			if ( (error = nonleaf.read(next.pid, pf)) || 
+			     (error = nonleaf.convertPairLayout()) ||
+			     (error = nonleaf.write(next.pid, pf)) )
+				return error;
+
+			// the children are read from the converted node
+			PageId children[BTNonLeafNode::MAX_NON_KEYS + 1];
+			int num_children = nonleaf.getChildren(children);
+
+			for (int i = 0; i < num_children; i++) {
+				BTNode child_node;
+				child_node.height = next.height + 1;
+				child_node.leaf_type = (child_node.height == treeHeight);
+				child_node.pid = children[i];
+				nodes.push(child_node);
+			}
+		}
+	}
+
+	// record the new version right away, so that the nodes are
+	// never converted twice
+	if ( error = writeMetadata() )
+		return error;
+
+	if (!writable)
+	{
+		if ( error = pf.close() )
+			return error;
+		return pf.open(indexname, mode);
+	}
 	return 0;
 }
 
@@ -277,17 +402,42 @@ RC BTreeIndex::close()
 {
     RC error;
 	
-	// copy the temp data into the metadata buffer
-	memcpy(metadata, &rootPid, sizeof(PageId));
-	memcpy(metadata + sizeof(PageId), &treeHeight, sizeof(int));
-	memcpy(metadata + sizeof(PageId) + sizeof(int), &keyCount, sizeof(int));
+	// drop an unfinished bulk load
+	bulkLoading = false;
+	bulkKeys.clear();
+	bulkRids.clear();
+	bulkLevel.clear();
 	
-	// write metadata to the pagefile
-	if ( error = pf.write(0, metadata) )
-		return error;
+	// write metadata to the pagefile. This fails for an index opened
+	// in 'r' mode, but the pagefile must be closed either way so that
+	// its pages leave the cache.
+	error = writeMetadata();
 	
 	// close the pagefile
-    return pf.close();
+	RC close_error = pf.close();
+    return error ? error : close_error;
+}
+
+/*
+ * Write the FileHeader and the tree metadata to page 0.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::writeMetadata()
+{
+	// copy the file header and the temp data into the metadata buffer
+	FileHeader header;
+	int offset = sizeof(FileHeader);
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.pageSize = PageFile::PAGE_SIZE;
+	
+	memset(metadata, 0, PageFile::PAGE_SIZE);
+	memcpy(metadata, &header, sizeof(FileHeader));
+	memcpy(metadata + offset, &rootPid, sizeof(PageId));
+	memcpy(metadata + offset + sizeof(PageId), &treeHeight, sizeof(int));
+	memcpy(metadata + offset + sizeof(PageId) + sizeof(int), &keyCount, sizeof(int));
+	
+	return pf.write(0, metadata);
 }
 
 /*
@@ -322,8 +472,15 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 		return leaf.write(rootPid, pf);
 	}
 
-	// More than one level. Recurse to find position to insert
-    return recursiveInsert(key, rid, 1, rootPid, overflow_key, overflow_pid);
+	// More than one level. Recurse to find position to insert.
+	// A packed leaf without room is split without taking the key,
+	// so try again until the key is in
+	int count = keyCount;
+	RC error;
+	do {
+		error = recursiveInsert(key, rid, 1, rootPid, overflow_key, overflow_pid);
+	} while (error >= 0 && keyCount == count);
+	return error;
 }
 
 RC BTreeIndex::recursiveInsert(int key, const RecordId& rid, int height, 
@@ -350,11 +507,20 @@ RC BTreeIndex::recursiveInsert(int key, const RecordId& rid, int height,
 			// int siblingKey;
 			RC error;
 
+			// A packed leaf is split in half, and insert() then
+			// inserts the key into one of the halves
+			if (leaf.isPacked()) {
+				if (error = leaf.split(sibling, overflow_key))
+					return error;
+			}
+
 			// Insert and split. Return immediately if error
-			if (error = leaf.insertAndSplit(key, rid, sibling, overflow_key))
-				return error;
+			else {
+				if (error = leaf.insertAndSplit(key, rid, sibling, overflow_key))
+					return error;
+				keyCount++;
+			}
 
-			keyCount++;
 			overflow_pid = pf.endPid();
 			leaf.setNextNodePtr(overflow_pid);
 		
@@ -432,6 +598,234 @@ RC BTreeIndex::recursiveInsert(int key, const RecordId& rid, int height,
 	}
 }
 
+/*
+ * Start building the index bottom-up.
+ * @param fillPercent[IN] how full to fill each node, from 1 to 100
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::beginBulkLoad(int fillPercent)
+{
+	if (treeHeight != 0 || bulkLoading)
+		return RC_INVALID_ATTRIBUTE;
+	if (fillPercent < 1 || fillPercent > 100)
+		return RC_INVALID_ATTRIBUTE;
+
+	// At least one key per leaf. At least three children per nonleaf
+	// node, so that the last two nodes of a level can always share
+	// their children with two or more each
+	bulkLeafKeys = max(1, BTLeafNode::MAX_LEAF_KEYS * fillPercent / 100);
+	bulkLeafBytes = BTLeafNode::PACKED_HEADER +
+		(BTLeafNode::PACKED_BYTES - BTLeafNode::PACKED_HEADER) * fillPercent / 100;
+	bulkChildren = max(3, (BTNonLeafNode::MAX_NON_KEYS + 1) * fillPercent / 100);
+	bulkLevel.clear();
+
+	// The leaves take the pages from the end of the file on.
+	// Page 0 is reserved for metadata.
+	bulkPid = pf.endPid() ? pf.endPid() : 1;
+	bulkKeys.clear();
+	bulkRids.clear();
+	bulkLoading = true;
+	return 0;
+}
+
+/*
+ * Add a (key, RecordId) pair to the index being bulk loaded.
+ * @param key[IN] the key. It must not be smaller than the previous key
+ * @param rid[IN] the RecordId for the record with the key
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkInsert(int key, const RecordId& rid)
+{
+	RC error;
+	int n = bulkKeys.size();
+	bool full;
+
+	if (!bulkLoading)
+		return RC_INVALID_ATTRIBUTE;
+	if (!bulkLevel.empty() && key < bulkLastKey)
+		return RC_INVALID_ATTRIBUTE;
+
+	// A packed leaf is full when the entry would take it past
+	// bulkLeafBytes, and any other after bulkLeafKeys entries
+	if (packedLeaves)
+		full = n > 0 && BTLeafNode::packedSize(n + 1, bulkKeys[0], key,
+			min(bulkMinPid, rid.pid), max(bulkMaxPid, rid.pid),
+			max(bulkMaxSid, rid.sid)) > bulkLeafBytes;
+	else
+		full = n == bulkLeafKeys;
+
+	// The leaf is full. Link it to the next page, where the next leaf goes
+	if (full) {
+		if (error = writeBulkLeaf(bulkPid + 1))
+			return error;
+		bulkPid++;
+	}
+
+	// The first key of a leaf is the lowest key under it
+	if (bulkKeys.empty()) {
+		BulkEntry entry = { key, bulkPid };
+		bulkLevel.push_back(entry);
+		bulkMinPid = bulkMaxPid = rid.pid;
+		bulkMaxSid = rid.sid;
+	}
+
+	bulkKeys.push_back(key);
+	bulkRids.push_back(rid);
+	bulkMinPid = min(bulkMinPid, rid.pid);
+	bulkMaxPid = max(bulkMaxPid, rid.pid);
+	bulkMaxSid = max(bulkMaxSid, rid.sid);
+	bulkLastKey = key;
+	keyCount++;
+	return 0;
+}
+
+/*
+ * Write the last leaf and build the nonleaf levels of a bulk load.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::endBulkLoad()
+{
+	RC error = 0;
+
+	if (!bulkLoading)
+		return RC_INVALID_ATTRIBUTE;
+
+	// The last leaf keeps the next node pointer 0, which ends the chain
+	if (!bulkKeys.empty())
+		error = writeBulkLeaf(0);
+	bulkLoading = false;
+	bulkKeys.clear();
+	bulkRids.clear();
+	if (error || bulkLevel.empty())
+		return error;
+
+	// Build one level above the other until a single node is left
+	treeHeight = 1;
+	while (bulkLevel.size() > 1) {
+		if (error = buildBulkLevel())
+			return error;
+		treeHeight++;
+	}
+	rootPid = bulkLevel[0].pid;
+	bulkLevel.clear();
+	return 0;
+}
+
+/*
+ * Write the entries a bulk load collected for a leaf to page bulkPid.
+ * @param next[IN] the PageId of the next leaf. 0 for the last one
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::writeBulkLeaf(PageId next)
+{
+	BTLeafNode leaf;
+	int n = bulkKeys.size();
+	RC error;
+
+	if (error = leaf.setNextNodePtr(next))
+		return error;
+
+	// bulkInsert() made sure that the entries fit either way
+	if (packedLeaves)
+		error = leaf.pack(&bulkKeys[0], &bulkRids[0], n);
+	else
+		for (int i = 0; i < n && error == 0; i++)
+			error = leaf.append(bulkKeys[i], bulkRids[i]);
+	if (error || (error = leaf.write(bulkPid, pf)))
+		return error;
+
+	bulkKeys.clear();
+	bulkRids.clear();
+	return 0;
+}
+
+/*
+ * Build the nonleaf level above the nodes in bulkLevel.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::buildBulkLevel()
+{
+	vector<BulkEntry> parents;
+	int n = bulkLevel.size();
+	int i = 0;
+	RC error;
+
+	while (i < n) {
+		BTNonLeafNode node;
+		BulkEntry parent;
+		int count = min(bulkChildren, n - i);
+
+		// Never leave a single child for the last node
+		if (n - i - count == 1)
+			count--;
+
+		// The key in front of each child is the lowest key under it
+		if (error = node.initializeRoot(bulkLevel[i].pid, bulkLevel[i + 1].key, bulkLevel[i + 1].pid))
+			return error;
+		for (int j = i + 2; j < i + count; j++) {
+			if (error = node.append(bulkLevel[j].key, bulkLevel[j].pid))
+				return error;
+		}
+
+		// The nodes of a level go on consecutive pages at the end of the file
+		parent.key = bulkLevel[i].key;
+		parent.pid = pf.endPid();
+		if (error = node.write(parent.pid, pf))
+			return error;
+		parents.push_back(parent);
+		i += count;
+	}
+
+	bulkLevel.swap(parents);
+	return 0;
+}
+
+/*
+ * Build the index from a stream of IndexEntry records sorted by entryLess().
+ * @param entries[IN] the finished sort of the entries
+ * @param fillPercent[IN] how full to fill each node, from 1 to 100
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoad(ExternalSort& entries, int fillPercent)
+{
+	IndexEntry entry;
+	RC error;
+
+	// An index that already has keys cannot be built bottom-up
+	if (treeHeight != 0) {
+		while ((error = entries.next(&entry)) == 0) {
+			if ((error = insert(entry.key, entry.rid)) < 0)
+				return error;
+		}
+		return (error == RC_END_OF_STREAM) ? 0 : error;
+	}
+
+	if (error = beginBulkLoad(fillPercent))
+		return error;
+	while ((error = entries.next(&entry)) == 0) {
+		if (error = bulkInsert(entry.key, entry.rid))
+			return error;
+	}
+	if (error != RC_END_OF_STREAM)
+		return error;
+	return endBulkLoad();
+}
+
+/*
+ * Order two IndexEntry records by key, then by RecordId.
+ */
+bool BTreeIndex::entryLess(const void* e1, const void* e2)
+{
+	const IndexEntry* a = (const IndexEntry*) e1;
+	const IndexEntry* b = (const IndexEntry*) e2;
+
+	if (a->key != b->key)
+		return a->key < b->key;
+	if (a->rid.pid != b->rid.pid)
+		return a->rid.pid < b->rid.pid;
+	return a->rid.sid < b->rid.sid;
+}
+
 /**
  * Run the standard B+Tree key search algorithm and identify the
  * leaf node where searchKey may exist. If an index entry with
@@ -471,6 +865,25 @@ RC BTreeIndex::recursiveLocate(int searchKey, IndexCursor& cursor, PageId pid, i
 		int eid;
 		error = ln.locate(searchKey, eid);
 		cursor.eid = eid; // should be fine either way
+		
+		// every key of the leaf is smaller than searchKey, so the
+		// entry behind them is the first one of the next leaf.
+		// a key equal to the separator in front of that leaf leads
+		// here, and is found there
+		if (eid == ln.getKeyCount())
+		{
+			cursor.pid = ln.getNextNodePtr();
+			cursor.eid = 0;
+
+			if (cursor.pid != 0) {
+				BTLeafNode next;
+				int key;
+				RecordId rid;
+
+				if (next.read(cursor.pid, pf) == 0 && next.readEntry(0, key, rid) == 0 && key == searchKey)
+					error = 0;
+			}
+		}
 		return error;	
 	}
 	
@@ -508,6 +921,13 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 	if ( error = ln.read(cursor.pid, pf) )
 		return error;
 	
+	// we just entered this leaf, so start reading its sibling
+	// in the background. leaves are rarely next to each other
+	// on disk, so the file cannot guess this by itself.
+	PageId next_pid = ln.getNextNodePtr();
+	if (cursor.eid == 0 && next_pid != 0)
+		pf.willNeed(&next_pid, 1);
+	
 	error = ln.readEntry(cursor.eid, key, rid);
 	
 	// move the cursor forward by 1
@@ -528,3 +948,127 @@ int BTreeIndex::getKeyCount()
 {
 	return keyCount;
 }
+
+/*
+ * IndexScan constructor
+ */
+IndexScan::IndexScan()
+{
+	pf = NULL;
+	leaf = NULL;
+	eid = endEid = 0;
+	nextPid = 0;
+	endKey = 0;
+}
+
+IndexScan::~IndexScan()
+{
+	close();
+}
+
+/*
+ * Start scanning the entries with startKey <= key <= endKey.
+ * @param index[IN] the open index. It must stay open during the scan
+ * @param startKey[IN] the lowest key of the range
+ * @param endKey[IN] the highest key of the range
+ * @return error code. 0 if no error
+ */
+RC IndexScan::open(BTreeIndex& index, int startKey, int endKey)
+{
+	IndexCursor cursor;
+	RC error;
+
+	close();
+	pf = &index.pf;
+	this->endKey = endKey;
+
+	// An empty index or range has nothing to scan
+	if (index.getKeyCount() == 0 || startKey > endKey)
+		return 0;
+
+	error = index.locate(startKey, cursor);
+	if (error != 0 && error != RC_NO_SUCH_RECORD)
+		return error;
+
+	// Every key is smaller than startKey
+	if (cursor.pid == 0)
+		return 0;
+
+	leaf = new BTLeafNode;
+	if (error = enterLeaf(cursor.pid))
+		return error;
+	eid = cursor.eid;
+	return 0;
+}
+
+/*
+ * Pin the leaf pid and find where the range ends in it.
+ * @param pid[IN] the PageId of the leaf
+ * @return error code. 0 if no error
+ */
+RC IndexScan::enterLeaf(PageId pid)
+{
+	RC error;
+
+	// Reading the new leaf unpins the previous one
+	if (error = leaf->read(pid, *pf)) {
+		eid = endEid = 0;
+		nextPid = 0;
+		return error;
+	}
+
+	eid = 0;
+	endEid = leaf->locateUpperBound(endKey);
+	nextPid = 0;
+
+	// Only a leaf whose keys are all in range can be followed by more
+	// keys in range. Start reading its sibling in the background, since
+	// leaves are rarely next to each other on disk.
+	if (endEid == leaf->getKeyCount()) {
+		nextPid = leaf->getNextNodePtr();
+		if (nextPid != 0)
+			pf->willNeed(&nextPid, 1);
+	}
+	return 0;
+}
+
+/*
+ * Read the next entries of the range, all from the current leaf.
+ * @param keys[OUT] the keys of the entries, room for max keys
+ * @param rids[OUT] the RecordIds of the entries, room for max RecordIds
+ * @param max[IN] the most entries to read
+ * @return the number of entries read, 0 at the end of the range, or
+ *         an error code
+ */
+int IndexScan::next(int keys[], RecordId rids[], int max)
+{
+	RC error;
+
+	if (leaf == NULL)
+		return 0;
+
+	// Move on to the next leaf once this one is used up
+	while (eid >= endEid) {
+		if (nextPid == 0)
+			return 0;
+		if (error = enterLeaf(nextPid))
+			return error;
+	}
+
+	int n = min(max, endEid - eid);
+	if (error = leaf->readEntries(eid, n, keys, rids))
+		return error;
+	eid += n;
+	return n;
+}
+
+/*
+ * End the scan and unpin its leaf.
+ */
+void IndexScan::close()
+{
+	delete leaf;
+	leaf = NULL;
+	eid = endEid = 0;
+	nextPid = 0;
+}
@@ -10,9 +10,13 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <vector>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "ExternalSort.h"
+
+class BTLeafNode;
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -27,12 +31,34 @@ typedef struct {
   int     eid;  
 } IndexCursor;
 
+/**
+ * A (key, RecordId) pair stored in the index.
+ */
+typedef struct {
+  int      key;
+  RecordId rid;
+} IndexEntry;
+
 /**
  * Implements a B-Tree index for bruinbase.
  * 
  */
 class BTreeIndex {
  public:
+  /**
+   * Identifies an index file in its FileHeader on page 0.
+   */
+  static const int FILE_MAGIC = 0x58444e49;   // "INDX"
+
+  /**
+   * The current format version of index files.
+   * Version 1 stores the entries of a node as (key, pointer) pairs.
+   * Version 2 stores the keys of a node in one array and the pointers
+   * in another.
+   * Version 3 may also have packed leaves (see BTLeafNode::pack()).
+   */
+  static const int FILE_VERSION = 3;
+
   BTreeIndex();
 
   void test();
@@ -42,8 +68,16 @@ class BTreeIndex {
   /**
    * Open the index file in read or write mode.
    * Under 'w' mode, the index file should be created if it does not exist.
+   * Under 'm' mode, the index file is read-only and memory-mapped, and
+   * marked for random access since lookups jump between nodes.
+   * Page 0 holds a FileHeader followed by the tree metadata. An index
+   * written with a different page size is refused with
+   * RC_INVALID_FILE_FORMAT. An index of an older format version, or
+   * from before the header was introduced, is upgraded in place: every
+   * node is rewritten in the current layout, and the header is updated.
+   * This needs write access to the file even under 'r' and 'm' mode.
    * @param indexname[IN] the name of the index file
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& indexname, char mode);
@@ -104,25 +138,133 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Start building the index bottom-up. The (key, RecordId) pairs are
+   * then passed to bulkInsert() in key order, and endBulkLoad() finishes
+   * the tree. Leaves are written one after another as they fill up, and
+   * each nonleaf level is written after the level below it, so the pages
+   * of every level are contiguous in the file and the leaves are in key
+   * order. The index must be empty.
+   * Unless setPackedLeaves(false) was called, the leaves are packed, and
+   * fillPercent limits the bytes they fill instead of their entries.
+   * @param fillPercent[IN] how full to fill each node, from 1 to 100
+   * @return error code. 0 if no error
+   */
+  RC beginBulkLoad(int fillPercent);
+
+  /**
+   * Add a (key, RecordId) pair to the index being bulk loaded.
+   * @param key[IN] the key. It must not be smaller than the previous key
+   * @param rid[IN] the RecordId for the record with the key
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(int key, const RecordId& rid);
+
+  /**
+   * Write the last leaf and build the nonleaf levels of a bulk load.
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
+
+  /**
+   * Build the index from a stream of IndexEntry records sorted by
+   * entryLess(). An empty index is bulk loaded with beginBulkLoad();
+   * the entries are inserted one by one into an index that already has
+   * keys, which at least visits its leaves in order.
+   * @param entries[IN] the finished sort of the entries
+   * @param fillPercent[IN] how full to fill each node, from 1 to 100
+   * @return error code. 0 if no error
+   */
+  RC bulkLoad(ExternalSort& entries, int fillPercent);
+
+  /**
+   * The order of the entries of a bulk load: by key, and entries with
+   * the same key by RecordId. Compares two IndexEntry records.
+   */
+  static bool entryLess(const void* e1, const void* e2);
+
+  /**
+   * Choose whether bulk loads pack the entries of the leaves they write.
+   * They do by default. Leaves that are packed stay packed.
+   * @param on[IN] true to pack new leaves
+   */
+  static void setPackedLeaves(bool on) { packedLeaves = on; }
   
  /**
   * Returns number of keys in the index.
   */
   int getKeyCount();
 
+ /**
+  * Returns the I/O statistics of the index file since it was last opened.
+  */
+  const IoStats& getStats() const { return pf.getStats(); }
+
  private:
+  /**
+   * Write the FileHeader and the tree metadata to page 0.
+   * @return error code. 0 if no error
+   */
+  RC writeMetadata();
+
+  /**
+   * Rewrite every node of an index of format version 1 in the current
+   * layout and record the current version in the header. The index is
+   * reopened for writing while it is converted.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] the mode the index was opened in
+   * @return error code. 0 if no error
+   */
+  RC upgrade(const std::string& indexname, char mode);
+
+  /**
+   * The lowest key under a node built by a bulk load, and the node.
+   */
+  typedef struct {
+    int    key;
+    PageId pid;
+  } BulkEntry;
+
+  /**
+   * Build the nonleaf level above the nodes in bulkLevel, and replace
+   * them with the nodes of the new level.
+   * @return error code. 0 if no error
+   */
+  RC buildBulkLevel();
+
+  /**
+   * Write the entries a bulk load collected for a leaf to page bulkPid.
+   * @param next[IN] the PageId of the next leaf. 0 for the last one
+   * @return error code. 0 if no error
+   */
+  RC writeBulkLeaf(PageId next);
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
 
   PageId   rootPid;    /// the PageId of the root node
   int      treeHeight; /// the height of the tree
   int      keyCount;   /// the number of keys in the index
+
+  bool     bulkLoading;   /// whether a bulk load is in progress
+  PageId   bulkPid;       /// the PageId of the leaf it is filling
+  std::vector<int> bulkKeys;       /// the keys collected for the leaf
+  std::vector<RecordId> bulkRids;  /// and their RecordIds
+  PageId   bulkMinPid;    /// the smallest rid.pid in bulkRids
+  PageId   bulkMaxPid;    /// the largest rid.pid in bulkRids
+  int      bulkMaxSid;    /// the largest rid.sid in bulkRids
+  int      bulkLastKey;   /// the last key passed to bulkInsert()
+  int      bulkLeafKeys;  /// the number of keys a bulk load puts in a leaf
+  int      bulkLeafBytes; /// the bytes it fills in a packed leaf
+  int      bulkChildren;  /// the number of children it gives a nonleaf node
+  std::vector<BulkEntry> bulkLevel;  /// the nodes of the level being built
   /// Note that the content of the above two variables will be gone when
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
 
-  // Buffer of size 1024 to write metadata to disk.
+  // Buffer of size PAGE_SIZE to write metadata to disk.
   char metadata[PageFile::PAGE_SIZE];
 
   typedef struct 
@@ -131,6 +273,67 @@ class BTreeIndex {
     bool leaf_type;
     PageId pid;
   } BTNode;
+
+  static bool packedLeaves;  /// whether bulk loads pack leaves
+
+  friend class IndexScan;
+};
+
+/**
+ * Scans the (key, RecordId) pairs of a key range in key order, one leaf
+ * at a time. The current leaf stays pinned in the page cache between
+ * calls to next(), which copies out the entries of the leaf in batches.
+ * The position of the upper bound in a leaf is found once, when the scan
+ * enters it. When the range ends inside the leaf, its next sibling is
+ * never read.
+ */
+class IndexScan {
+ public:
+  IndexScan();
+  ~IndexScan();
+
+  /**
+   * Start scanning the entries with startKey <= key <= endKey.
+   * @param index[IN] the open index. It must stay open during the scan
+   * @param startKey[IN] the lowest key of the range
+   * @param endKey[IN] the highest key of the range
+   * @return error code. 0 if no error
+   */
+  RC open(BTreeIndex& index, int startKey, int endKey);
+
+  /**
+   * Read the next entries of the range. They all come from one leaf,
+   * so fewer than max entries may be returned before the end.
+   * @param keys[OUT] the keys of the entries, room for max keys
+   * @param rids[OUT] the RecordIds of the entries, room for max RecordIds
+   * @param max[IN] the most entries to read
+   * @return the number of entries read, 0 at the end of the range, or
+   *         an error code
+   */
+  int next(int keys[], RecordId rids[], int max);
+
+  /**
+   * End the scan and unpin its leaf.
+   */
+  void close();
+
+ private:
+  /**
+   * Pin the leaf pid and find where the range ends in it.
+   * @param pid[IN] the PageId of the leaf
+   * @return error code. 0 if no error
+   */
+  RC enterLeaf(PageId pid);
+
+  IndexScan(const IndexScan&);
+  IndexScan& operator=(const IndexScan&);
+
+  const PageFile* pf;   /// the file of the index being scanned
+  BTLeafNode* leaf;     /// the current leaf
+  int      eid;         /// the next entry of the leaf to read
+  int      endEid;      /// the entry behind the last one in range
+  PageId   nextPid;     /// the leaf to enter after this one. 0 if none
+  int      endKey;      /// the highest key of the range
 };
 
 #endif /* BTREEINDEX_H */
@@ -1,40 +1,319 @@
 #include "BTreeNode.h"
+#include "KeySearch.h"
 #include <string.h>
-#include <stdlib.h>
+#include <stdint.h>
 #include <cassert>
 #include <iostream>
 
 using namespace std;
 
+/*
+ * The content of a node that has not been read or modified yet.
+ * Nodes only point here until they get a page of their own.
+ */
+static const char zeroPage[PageFile::PAGE_SIZE] = { 0 };
+
 //////////////////////////////////////////////////////////////
 //                      BT LEAF NODE                        //
 //////////////////////////////////////////////////////////////
 
 /*
  * The structure of a BT LEAF NODE:
- *  ----------------------------------------------
- * | num_keys | KR_Pair | KR_Pair | ... | nextPID |
- *  ----------------------------------------------
+ *  ------------------------------------------------------------
+ * | num_keys | key | key | ... | RID | RID | ... | nextPID |
+ *  ------------------------------------------------------------
+ * The keys and the RecordIds each take an array with room for
+ * MAX_LEAF_KEYS entries.
+ *
+ * The structure of a packed BT LEAF NODE:
+ *  ------------------------------------------------------------------
+ * | num_keys | first_key | min_pid | bits | keys | pids | sids | nextPID |
+ *  ------------------------------------------------------------------
+ * num_keys has PACKED_LEAF set. keys, pids and sids are bit-packed arrays
+ * of key - first_key, rid.pid - min_pid and rid.sid, each rounded up to
+ * whole bytes. The number of entries is limited by the size of the page.
+ */
+
+/*
+ * The header of a packed leaf.
+ */
+typedef struct {
+	int count;               // the key count, with PACKED_LEAF set
+	int firstKey;            // the smallest key
+	PageId minPid;           // the smallest rid.pid
+	unsigned char keyBits;   // the bits of each key
+	unsigned char pidBits;   // the bits of each rid.pid
+	unsigned char sidBits;   // the bits of each rid.sid
+	unsigned char unused;
+} PackedHeader;
+
+/*
+ * Return the number of bits needed to store v.
+ */
+static int bitWidth(unsigned int v)
+{
+	int bits = 0;
+	while (v) {
+		bits++;
+		v >>= 1;
+	}
+	return bits;
+}
+
+/*
+ * Read the i'th value of a bit-packed array. Reads 8 bytes, which may
+ * go up to 7 bytes past the end of the array.
+ */
+static inline unsigned int getBits(const char* array, int bits, int i)
+{
+	uint64_t word;
+	long bit = (long) i * bits;
+	memcpy(&word, array + (bit >> 3), sizeof(word));
+	return (unsigned int) ((word >> (bit & 7)) & ((1ULL << bits) - 1));
+}
+
+/*
+ * Set the i'th value of a bit-packed array that was all zeros.
+ */
+static inline void putBits(char* array, int bits, int i, unsigned int v)
+{
+	uint64_t word;
+	long bit = (long) i * bits;
+	memcpy(&word, array + (bit >> 3), sizeof(word));
+	word |= (uint64_t) v << (bit & 7);
+	memcpy(array + (bit >> 3), &word, sizeof(word));
+}
+
+/*
+ * The bit-packed arrays of a packed leaf.
+ */
+static const char* packedKeys(const char* buffer)
+{
+	return buffer + BTLeafNode::PACKED_HEADER;
+}
+
+static const char* packedPids(const char* buffer)
+{
+	const PackedHeader* h = (const PackedHeader*) buffer;
+	int n = h->count & ~BTLeafNode::PACKED_LEAF;
+	return packedKeys(buffer) + ((long) n * h->keyBits + 7) / 8;
+}
+
+static const char* packedSids(const char* buffer)
+{
+	const PackedHeader* h = (const PackedHeader*) buffer;
+	int n = h->count & ~BTLeafNode::PACKED_LEAF;
+	return packedPids(buffer) + ((long) n * h->pidBits + 7) / 8;
+}
+
+/*
+ * Return the i'th key of a packed leaf.
+ */
+static inline int packedKey(const char* buffer, int i)
+{
+	const PackedHeader* h = (const PackedHeader*) buffer;
+	return (int) ((unsigned int) h->firstKey + getBits(packedKeys(buffer), h->keyBits, i));
+}
+
+/*
+ * Unpack n entries of a packed leaf, starting from eid.
+ * Either keys or rids may be NULL.
+ */
+static void unpackEntries(const char* buffer, int eid, int n, int keys[], RecordId rids[])
+{
+	const PackedHeader* h = (const PackedHeader*) buffer;
+
+	if (keys != NULL) {
+		const char* array = packedKeys(buffer);
+		for (int i = 0; i < n; i++)
+			keys[i] = (int) ((unsigned int) h->firstKey + getBits(array, h->keyBits, eid + i));
+	}
+	if (rids != NULL) {
+		const char* pids = packedPids(buffer);
+		const char* sids = packedSids(buffer);
+		for (int i = 0; i < n; i++) {
+			rids[i].pid = (PageId) ((unsigned int) h->minPid + getBits(pids, h->pidBits, eid + i));
+			rids[i].sid = (int) getBits(sids, h->sidBits, eid + i);
+		}
+	}
+}
+
+/*
+ * Read the len bits at bit of a bit-packed array. len is at most 56.
+ */
+static inline uint64_t getBitRange(const char* array, long bit, int len)
+{
+	uint64_t word;
+	memcpy(&word, array + (bit >> 3), sizeof(word));
+	return (word >> (bit & 7)) & ((1ULL << len) - 1);
+}
+
+/*
+ * Overwrite the len bits at bit of a bit-packed array with v.
+ * len is at most 56.
+ */
+static inline void setBitRange(char* array, long bit, int len, uint64_t v)
+{
+	uint64_t word;
+	uint64_t mask = ((1ULL << len) - 1) << (bit & 7);
+	memcpy(&word, array + (bit >> 3), sizeof(word));
+	word = (word & ~mask) | (v << (bit & 7));
+	memcpy(array + (bit >> 3), &word, sizeof(word));
+}
+
+/*
+ * Insert v in front of the i'th of the n values of a bit-packed array
+ * that has room for n + 1 values. The values behind it move up 56 bits
+ * at a time, last ones first, and the bits behind the last value are
+ * cleared.
+ */
+static void insertBits(char* array, int bits, int n, int i, unsigned int v)
+{
+	long from = (long) i * bits;
+	long end = (long) (n + 1) * bits;
+
+	if (bits == 0)
+		return;
+	for (long bit = (long) n * bits; bit > from; ) {
+		int len = (bit - from < 56) ? (int) (bit - from) : 56;
+		bit -= len;
+		setBitRange(array, bit + bits, len, getBitRange(array, bit, len));
+	}
+	setBitRange(array, from, bits, v);
+	if (end & 7)
+		array[end >> 3] &= (1 << (end & 7)) - 1;
+}
+
+/*
+ * Insert the (key, rid) pair in front of entry eid of a packed leaf in
+ * place, if it fits the bit widths the leaf already has. The pids and
+ * sids arrays are moved up to make room, last one first.
+ * Return false if the pair needs wider values or the leaf is full.
+ */
+static bool insertPacked(char* buffer, int eid, int key, const RecordId& rid)
+{
+	PackedHeader* h = (PackedHeader*) buffer;
+	int n = h->count & ~BTLeafNode::PACKED_LEAF;
+	unsigned int k = (unsigned int) key - (unsigned int) h->firstKey;
+	unsigned int p = (unsigned int) rid.pid - (unsigned int) h->minPid;
+	unsigned int s = (unsigned int) rid.sid;
+
+	// A key or pid below the smallest one needs a new base
+	if (key < h->firstKey || rid.pid < h->minPid ||
+	    bitWidth(k) > h->keyBits || bitWidth(p) > h->pidBits || bitWidth(s) > h->sidBits)
+		return false;
+
+	long oldKeyBytes = ((long) n * h->keyBits + 7) / 8;
+	long oldPidBytes = ((long) n * h->pidBits + 7) / 8;
+	long oldSidBytes = ((long) n * h->sidBits + 7) / 8;
+	long keyBytes = ((long) (n + 1) * h->keyBits + 7) / 8;
+	long pidBytes = ((long) (n + 1) * h->pidBits + 7) / 8;
+	long sidBytes = ((long) (n + 1) * h->sidBits + 7) / 8;
+	if (BTLeafNode::PACKED_HEADER + keyBytes + pidBytes + sidBytes > BTLeafNode::PACKED_BYTES)
+		return false;
+
+	char* keys = buffer + BTLeafNode::PACKED_HEADER;
+	char* pids = keys + keyBytes;
+	char* sids = pids + pidBytes;
+	memmove(sids, keys + oldKeyBytes + oldPidBytes, oldSidBytes);
+	memmove(pids, keys + oldKeyBytes, oldPidBytes);
+
+	insertBits(sids, h->sidBits, n, eid, s);
+	insertBits(pids, h->pidBits, n, eid, p);
+	insertBits(keys, h->keyBits, n, eid, k);
+	h->count = (n + 1) | BTLeafNode::PACKED_LEAF;
+	return true;
+}
+
+/*
+ * Read entry i of a packed leaf as if the (key, rid) pair were inserted
+ * in front of entry eid. eid is -1 if nothing is inserted.
+ */
+static inline void entryWith(const char* buffer, int eid, int key, const RecordId& rid,
+                             int i, int& entryKey, RecordId& entryRid)
+{
+	if (i == eid) {
+		entryKey = key;
+		entryRid = rid;
+		return;
+	}
+	if (eid >= 0 && i > eid)
+		i--;
+	unpackEntries(buffer, i, 1, &entryKey, &entryRid);
+}
+
+/*
+ * Pack the entries from through to - 1 of a packed leaf, with the
+ * (key, rid) pair inserted in front of entry eid, into dst. dst must be
+ * all zeros. eid is -1 if nothing is inserted.
+ * @return 0 if successful. RC_NODE_FULL if the entries do not fit.
  */
+static RC packRange(char* dst, const char* src, int eid, int key, const RecordId& rid,
+                    int from, int to)
+{
+	int n = to - from;
+	int firstKey, lastKey, entryKey;
+	PageId minPid, maxPid;
+	int maxSid;
+	RecordId entryRid;
+
+	if (n < 1)
+		return RC_INVALID_ATTRIBUTE;
+
+	// The keys are sorted, but the RecordIds are not
+	entryWith(src, eid, key, rid, from, firstKey, entryRid);
+	lastKey = firstKey;
+	minPid = maxPid = entryRid.pid;
+	maxSid = entryRid.sid;
+	for (int i = from + 1; i < to; i++) {
+		entryWith(src, eid, key, rid, i, lastKey, entryRid);
+		if (entryRid.pid < minPid) minPid = entryRid.pid;
+		if (entryRid.pid > maxPid) maxPid = entryRid.pid;
+		if (entryRid.sid > maxSid) maxSid = entryRid.sid;
+	}
+	if (BTLeafNode::packedSize(n, firstKey, lastKey, minPid, maxPid, maxSid) > BTLeafNode::PACKED_BYTES)
+		return RC_NODE_FULL;
+
+	PackedHeader* h = (PackedHeader*) dst;
+	h->count = n | BTLeafNode::PACKED_LEAF;
+	h->firstKey = firstKey;
+	h->minPid = minPid;
+	h->keyBits = bitWidth((unsigned int) lastKey - (unsigned int) firstKey);
+	h->pidBits = bitWidth((unsigned int) maxPid - (unsigned int) minPid);
+	h->sidBits = bitWidth((unsigned int) maxSid);
+
+	char* k = const_cast<char *>(packedKeys(dst));
+	char* p = const_cast<char *>(packedPids(dst));
+	char* s = const_cast<char *>(packedSids(dst));
+	for (int i = 0; i < n; i++) {
+		entryWith(src, eid, key, rid, from + i, entryKey, entryRid);
+		putBits(k, h->keyBits, i, (unsigned int) entryKey - (unsigned int) firstKey);
+		putBits(p, h->pidBits, i, (unsigned int) entryRid.pid - (unsigned int) minPid);
+		putBits(s, h->sidBits, i, (unsigned int) entryRid.sid);
+	}
+	return 0;
+}
 
 /*
- * Constructor. Initialize buffer to all 0's.
+ * Constructor. The node reads as empty until it is read or modified.
  */
 BTLeafNode::BTLeafNode()
 {
-	memset(buffer, 0, PageFile::PAGE_SIZE); 
+	buffer = const_cast<char *>(zeroPage);
 }
 
 void BTLeafNode::printAll(bool keys_only) {
-	int *keycount = (int *) buffer;
-	cout << "[" << *keycount << "] | ";
+	int keycount = getKeyCount();
+	int key;
+	RecordId rid;
+	cout << "[" << keycount << "] | ";
 
-	KRPair *kr = (KRPair *) (buffer + BTLeafNode::BEGINNING_OFFSET);
-	for (int i = 0; i < *keycount; i++) {
+	for (int i = 0; i < keycount; i++) {
+		readEntry(i, key, rid);
 		if (keys_only)
-			cout << (kr + i)->key << " | ";
+			cout << key << " | ";
 		else
-			cout << (kr + i)->key << ", (" << (kr + i)->rid.pid << ", " << (kr + i)->rid.sid << ") | ";
+			cout << key << ", (" << rid.pid << ", " << rid.sid << ") | ";
 	}
 	cout << getNextNodePtr() << " | ";
 	cout << endl << "---" << endl;
@@ -52,7 +331,7 @@ void BTLeafNode::test()
 	assert ( locate(0, eid) == RC_NO_SUCH_RECORD );
 	
 	// we can't read entries in the empty node
-	for (int i = 0; i < 84; i++)
+	for (int i = 0; i < BTLeafNode::MAX_LEAF_KEYS; i++)
 		assert( readEntry(i, key, rid) == RC_INVALID_CURSOR );
 	
 	setNextNodePtr(25);
@@ -88,32 +367,41 @@ void BTLeafNode::test()
 	assert ( readEntry(0, key, rid) == 0 );
 	assert ( key == -4 && rid.pid == 0 && rid.sid == 12);
 	
-	for (int i = 20; i < 100; i++)
+	// The expected keys and counts follow from the node capacity,
+	// so that the test holds for every page size. With 1 KB pages
+	// MAX_LEAF_KEYS is 84, the largest key is 100 and the split
+	// leaves 43 keys in this node and 42 in the sibling.
+	const int max_keys = BTLeafNode::MAX_LEAF_KEYS;
+	const int last_key = max_keys + 16;
+	const int left_keys = max_keys/2 + 1;
+	const int right_keys = max_keys + 1 - left_keys;
+
+	for (int i = 20; i < max_keys + 16; i++)
 	{
 		insert_rid.pid = i;
 		insert_rid.sid = 1;
-		insert( 120 - i, insert_rid );			
+		insert( max_keys + 36 - i, insert_rid );			
 	}
 
 	/* This should be the key layout right now:
-	 * 0 4 7 12 21 22 23 24 25 ... 100
+	 * 0 4 7 12 21 22 23 24 25 ... last_key
 	*/
-	// we now have 84 keys
-	assert ( getKeyCount() == 84 );
+	// we now have MAX_LEAF_KEYS keys
+	assert ( getKeyCount() == max_keys );
 	
 	// can't insert any more keys
 	insert_rid.pid = 2; insert_rid.sid = 2;
-	assert ( insert(200, insert_rid ) == RC_NODE_FULL );
-	assert ( locate(200, eid) == RC_NO_SUCH_RECORD );
+	assert ( insert(200 + max_keys, insert_rid ) == RC_NODE_FULL );
+	assert ( locate(200 + max_keys, eid) == RC_NO_SUCH_RECORD );
 	
-	locate(100, eid);
+	locate(last_key, eid);
 	
-	// eid of last key is 83
-	assert ( eid == 83 );
+	// the last key is the last entry
+	assert ( eid == max_keys - 1 );
 
-	// the sixth entry has a key of 22 and a RecordID of (98, 1)
+	// the sixth entry has a key of 22 and a RecordID of (MAX_LEAF_KEYS + 14, 1)
 	assert ( readEntry(5, key, rid) == 0 );
-	assert ( key == 22 && rid.pid == 98 && rid.sid == 1 );
+	assert ( key == 22 && rid.pid == max_keys + 14 && rid.sid == 1 );
 	
 	BTLeafNode new_sibling;
 	int first_key_in_sibling;
@@ -124,31 +412,32 @@ void BTLeafNode::test()
 	insert_rid.pid = 4; insert_rid.sid = 10;
 	assert  ( insertAndSplit(20, insert_rid, new_sibling, first_key_in_sibling) == 0 );
 	
-	// left node has 43 keys, right node has 42 keys
-	assert  ( getKeyCount() == 43 && new_sibling.getKeyCount() == 42);
+	// the left node keeps one key more than the right node, or as many
+	assert  ( getKeyCount() == left_keys && new_sibling.getKeyCount() == right_keys);
 	
 	// left node points to right node
 	//assert  ( getNextNodePtr() == new_sibling.getPID() );
 	
 	// right node points to what left node pointed to before the insert
 	//assert  ( new_sibling.getNextNodePtr() == saved_next );
-	// the last entry in the left node has a key of 58 after the split
-	assert  ( locate(58, eid) == 0 );
-	assert  ( eid == 42 );
-	
-	// the entry with key=59 is not in the left node. it is the first key in the right node
-	assert  ( locate(59, eid) == RC_NO_SUCH_RECORD );
-	assert  ( first_key_in_sibling == 59 );
-	assert  ( new_sibling.locate(59, eid) == 0 );
+	// from the sixth entry on, the entry i has the key i + 16, so the
+	// last entry in the left node has a key of left_keys + 15 after the split
+	assert  ( locate(left_keys + 15, eid) == 0 );
+	assert  ( eid == left_keys - 1 );
+	
+	// the next key is not in the left node. it is the first key in the right node
+	assert  ( locate(left_keys + 16, eid) == RC_NO_SUCH_RECORD );
+	assert  ( first_key_in_sibling == left_keys + 16 );
+	assert  ( new_sibling.locate(left_keys + 16, eid) == 0 );
 	assert  ( eid == 0 );
 	
-	// the second key in the right node is 60
-	assert  ( new_sibling.locate(60, eid) == 0 );
+	// the second key in the right node follows it
+	assert  ( new_sibling.locate(left_keys + 17, eid) == 0 );
 	assert  ( eid == 1 );
 	
-	// the last key in the new sibling is 100 with a RecordID (20, 1)
-	assert  ( new_sibling.readEntry(41, key, rid) == 0 );
-	assert  ( key == 100 && rid.pid == 20 && rid.sid == 1 );
+	// the last key in the new sibling is the largest key, with a RecordID (20, 1)
+	assert  ( new_sibling.readEntry(right_keys - 1, key, rid) == 0 );
+	assert  ( key == last_key && rid.pid == 20 && rid.sid == 1 );
 	
 	
 	cerr << "All tests successful.\n";	
@@ -162,8 +451,15 @@ void BTLeafNode::test()
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
 { 
-	//setPID(pid);
-	return pf.read(pid, buffer);
+	RC error;
+
+	// Pin the page in the cache and use it in place
+	if (error = pf.pin(pid, page)) {
+		buffer = const_cast<char *>(zeroPage);
+		return error;
+	}
+	buffer = page.data();
+	return 0;
 }
     
 /*
@@ -174,9 +470,29 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
 { 
+	if (page.isPinned())
+		return pf.write(pid, page);
 	return pf.write(pid, buffer); 
 }
 
+/*
+ * Make sure the node has a page of its own that it can modify.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::makeWritable()
+{
+	RC error;
+
+	if (page.isPinned())
+		return 0;
+
+	// Get a zero-filled page from the cache
+	if (error = PageFile::newPage(page))
+		return error;
+	buffer = page.data();
+	return 0;
+}
+
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
@@ -196,7 +512,17 @@ int BTLeafNode::getKeyCount()
 
 	// Key count stored as first element in buffer.
 	int *count = (int *) buffer;
-	return *count;
+	return *count & ~BTLeafNode::PACKED_LEAF;
+}
+
+/*
+ * Return whether the entries of the node are packed.
+ * @return true if the node is packed
+ */
+bool BTLeafNode::isPacked()
+{
+	int *count = (int *) buffer;
+	return (*count & BTLeafNode::PACKED_LEAF) != 0;
 }
 
 /*
@@ -209,42 +535,36 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
 { 
 	int num_keys = getKeyCount();
 	int eid;
-	int offset;
-	KRPair insert_pair;
-	PageId next_node = getNextNodePtr();
+	RC error;
+
+	// A packed node has space if the entries still fit packed
+	if (isPacked()) {
+		locate(key, eid);
+		return repack(eid, key, rid);
+	}
 
 	// If no space, return error code
 	if (num_keys >= BTLeafNode::MAX_LEAF_KEYS) {
 		return RC_NODE_FULL;
 	}
 
+	if (error = makeWritable())
+		return error;
+
 	// There is space. Insert new key, RecordID pair.
-	insert_pair.key = key;
-	insert_pair.rid = rid;
 	locate(key, eid);
 
-	// eid now contains index entry number to insert into)
-	char *temp_buffer = (char *) malloc(PageFile::PAGE_SIZE * sizeof(char));
-
-	// Copy the first eid KRPairs into the temp buffer.
-	// The element to insert will come after these.
-	// Then copy the rest of the buffer after the element
-	offset = BTLeafNode::BEGINNING_OFFSET + (sizeof(KRPair) * eid);
-	memcpy(temp_buffer, buffer, offset);
-	memcpy(temp_buffer + offset, &insert_pair, sizeof(KRPair));
-	memcpy(temp_buffer + offset + sizeof(KRPair), buffer + offset, 
-		num_keys * sizeof(KRPair) - (sizeof(KRPair) * eid));
-
-	// Move the newly constructed buffer back into the buffer variable
-	memcpy(buffer, temp_buffer, PageFile::PAGE_SIZE);
-
-	// Free temp_buffer to prevent memory leak
-	free(temp_buffer);
+	// eid now contains index entry number to insert into.
+	// Shift the entries from eid on up by one in both arrays
+	// and put the new entry in the gap
+	memmove(keys() + eid + 1, keys() + eid, (num_keys - eid) * sizeof(int));
+	memmove(rids() + eid + 1, rids() + eid, (num_keys - eid) * sizeof(RecordId));
+	keys()[eid] = key;
+	rids()[eid] = rid;
 
 	// Increase num_keys.
 	num_keys++;
 	setKeyCount(num_keys);
-	setNextNodePtr(next_node);
 	return 0;
 }
 
@@ -261,63 +581,229 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
 RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
                               BTLeafNode& sibling, int& siblingKey)
 { 
-	KRPair insert_pair;
 	int eid;
 	int num_keys = getKeyCount();
-	int pivot; // Contains the eid of the pair at which we are splitting
-	int offset;
-	int side = 0; // 0 = left, 1 = right
 	int left_keys;
 	int right_keys;
+	int moved; // The number of old entries in front of the new one in sibling
+	RC error;
 
 	// Check that sibling is EMPTY
 	if (sibling.getKeyCount() != 0)
 		return RC_INVALID_ATTRIBUTE;
 
-	// Only split if the current node is FULL
-	if (num_keys < BTLeafNode::MAX_LEAF_KEYS)
+	// Only split if the current node is FULL. Packed nodes use split()
+	if (num_keys < BTLeafNode::MAX_LEAF_KEYS || isPacked())
 		return RC_INVALID_ATTRIBUTE;
 
+	if ((error = makeWritable()) || (error = sibling.makeWritable()))
+		return error;
+
 	locate(key, eid);
 	// Split consistently, such that left node has more keys.
-	if (eid <= (num_keys/2)) {
-		pivot = num_keys/2;
-	} 
+	// Counting the new entry, the first left_keys entries stay here
+	left_keys = num_keys/2 + 1;
+	right_keys = num_keys + 1 - left_keys;
+
+	if (eid < left_keys) {
+		// The new entry stays in this node. Move the last right_keys
+		// entries to sibling, then shift the ones behind eid up by one
+		memcpy(sibling.keys(), keys() + left_keys - 1, right_keys * sizeof(int));
+		memcpy(sibling.rids(), rids() + left_keys - 1, right_keys * sizeof(RecordId));
+		memmove(keys() + eid + 1, keys() + eid, (left_keys - 1 - eid) * sizeof(int));
+		memmove(rids() + eid + 1, rids() + eid, (left_keys - 1 - eid) * sizeof(RecordId));
+		keys()[eid] = key;
+		rids()[eid] = rid;
+	}
 	else {
-		pivot = num_keys/2 + 1;
-		side = 1;
+		// The new entry goes to sibling, between the entries in front
+		// of eid and the ones behind it
+		moved = eid - left_keys;
+		memcpy(sibling.keys(), keys() + left_keys, moved * sizeof(int));
+		memcpy(sibling.rids(), rids() + left_keys, moved * sizeof(RecordId));
+		sibling.keys()[moved] = key;
+		sibling.rids()[moved] = rid;
+		memcpy(sibling.keys() + moved + 1, keys() + eid, (num_keys - eid) * sizeof(int));
+		memcpy(sibling.rids() + moved + 1, rids() + eid, (num_keys - eid) * sizeof(RecordId));
 	}
-	left_keys = pivot;
-	right_keys = num_keys - pivot;
 
-	offset = BTLeafNode::BEGINNING_OFFSET + (sizeof(KRPair) * pivot);
-
-	// Clear sibling anyways. 
-	memset(sibling.buffer, 0, PageFile::PAGE_SIZE);
-	// Move second half of buffer to sibling.
-	memcpy(sibling.buffer + BTLeafNode::BEGINNING_OFFSET, buffer + offset, 
-		PageFile::PAGE_SIZE - sizeof(PageId) - offset);
 	// Sibling points to the next node that the original node was pointing to
 	sibling.setNextNodePtr(getNextNodePtr());
 	sibling.setKeyCount(right_keys);
 
-	// Clear second half of buffer.
-	memset(buffer + offset, 0, PageFile::PAGE_SIZE - sizeof(PageId) - offset);
+	// Clear the entries that moved out of both arrays.
+	memset(keys() + left_keys, 0, (num_keys - left_keys) * sizeof(int));
+	memset(rids() + left_keys, 0, (num_keys - left_keys) * sizeof(RecordId));
 	setKeyCount(left_keys);
-	// Set this node to point to the new sibling
-	//setNextNodePtr(sibling.getPID());
 
-	// Insert new key, rid pair into correct leaf node.
-	if (side) {
-		sibling.insert(key, rid);
+	// siblingKey = first key in sibling node.
+	siblingKey = sibling.keys()[0];
+	return 0; 
+}
+
+/*
+ * Append the (key, rid) pair behind the last entry of the node.
+ * @param key[IN] the key to append
+ * @param rid[IN] the RecordId to append
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RC BTLeafNode::append(int key, const RecordId& rid)
+{
+	int num_keys = getKeyCount();
+	RC error;
+
+	if (isPacked())
+		return repack(num_keys, key, rid);
+
+	// If no space, return error code
+	if (num_keys >= BTLeafNode::MAX_LEAF_KEYS) {
+		return RC_NODE_FULL;
 	}
-	else {
-		insert(key, rid);
+
+	if (error = makeWritable())
+		return error;
+
+	keys()[num_keys] = key;
+	rids()[num_keys] = rid;
+	return setKeyCount(num_keys + 1);
+}
+
+/*
+ * Return the bytes that n entries take in a packed node.
+ * @param n[IN] the number of entries
+ * @param firstKey[IN] the smallest key of the entries
+ * @param lastKey[IN] the largest key of the entries
+ * @param minPid[IN] the smallest rid.pid of the entries
+ * @param maxPid[IN] the largest rid.pid of the entries
+ * @param maxSid[IN] the largest rid.sid of the entries
+ * @return the size of the packed node without the next node pointer
+ */
+int BTLeafNode::packedSize(int n, int firstKey, int lastKey, PageId minPid, PageId maxPid, int maxSid)
+{
+	long keyBytes = ((long) n * bitWidth((unsigned int) lastKey - (unsigned int) firstKey) + 7) / 8;
+	long pidBytes = ((long) n * bitWidth((unsigned int) maxPid - (unsigned int) minPid) + 7) / 8;
+	long sidBytes = ((long) n * bitWidth((unsigned int) maxSid) + 7) / 8;
+	long size = BTLeafNode::PACKED_HEADER + keyBytes + pidBytes + sidBytes;
+
+	return (size > PageFile::PAGE_SIZE) ? PageFile::PAGE_SIZE : (int) size;
+}
+
+/*
+ * Replace the entries of the node with n entries sorted by key, packed.
+ * @param keys[IN] the keys of the entries
+ * @param rids[IN] the RecordIds of the entries
+ * @param n[IN] the number of entries. At least 1
+ * @return 0 if successful. RC_NODE_FULL if the entries do not fit.
+ */
+RC BTLeafNode::pack(const int keys[], const RecordId rids[], int n)
+{
+	PageId minPid, maxPid;
+	int maxSid;
+	PageId next;
+	RC error;
+
+	if (n < 1)
+		return RC_INVALID_ATTRIBUTE;
+	if (n > BTLeafNode::MAX_PACKED_KEYS)
+		return RC_NODE_FULL;
+
+	// The keys are sorted, but the RecordIds are not
+	minPid = maxPid = rids[0].pid;
+	maxSid = rids[0].sid;
+	for (int i = 1; i < n; i++) {
+		if (rids[i].pid < minPid) minPid = rids[i].pid;
+		if (rids[i].pid > maxPid) maxPid = rids[i].pid;
+		if (rids[i].sid > maxSid) maxSid = rids[i].sid;
 	}
+	if (packedSize(n, keys[0], keys[n - 1], minPid, maxPid, maxSid) > BTLeafNode::PACKED_BYTES)
+		return RC_NODE_FULL;
 
-	// siblingKey = first key in sibling node.
-	siblingKey = ((KRPair *) (sibling.buffer + BTLeafNode::BEGINNING_OFFSET))->key;
-	return 0; 
+	if (error = makeWritable())
+		return error;
+
+	// Clear the node, but keep its next node pointer
+	next = getNextNodePtr();
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+
+	PackedHeader* h = (PackedHeader*) buffer;
+	h->count = n | BTLeafNode::PACKED_LEAF;
+	h->firstKey = keys[0];
+	h->minPid = minPid;
+	h->keyBits = bitWidth((unsigned int) keys[n - 1] - (unsigned int) keys[0]);
+	h->pidBits = bitWidth((unsigned int) maxPid - (unsigned int) minPid);
+	h->sidBits = bitWidth((unsigned int) maxSid);
+
+	// The array sizes depend on the count and the widths set above
+	char* k = const_cast<char *>(packedKeys(buffer));
+	char* p = const_cast<char *>(packedPids(buffer));
+	char* s = const_cast<char *>(packedSids(buffer));
+	for (int i = 0; i < n; i++) {
+		putBits(k, h->keyBits, i, (unsigned int) keys[i] - (unsigned int) keys[0]);
+		putBits(p, h->pidBits, i, (unsigned int) rids[i].pid - (unsigned int) minPid);
+		putBits(s, h->sidBits, i, (unsigned int) rids[i].sid);
+	}
+	return setNextNodePtr(next);
+}
+
+/*
+ * Insert the (key, rid) pair in front of entry eid of a packed node.
+ * The pair goes in place when it fits the bit widths of the node, and
+ * the entries are packed again with wider values when it does not.
+ * @return 0 if successful. RC_NODE_FULL if the entries do not fit.
+ */
+RC BTLeafNode::repack(int eid, int key, const RecordId& rid)
+{
+	char image[PageFile::PAGE_SIZE];
+	RC error;
+
+	if (error = makeWritable())
+		return error;
+
+	if (insertPacked(buffer, eid, key, rid))
+		return 0;
+
+	// Pack the entries aside, so that the node is left alone
+	// if they do not fit. The next node pointer stays
+	memset(image, 0, PageFile::PAGE_SIZE);
+	if (error = packRange(image, buffer, eid, key, rid, 0, getKeyCount() + 1))
+		return error;
+	memcpy(buffer, image, PageFile::PAGE_SIZE - sizeof(PageId));
+	return 0;
+}
+
+/*
+ * Move the upper half of the entries of a packed node to sibling.
+ * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+ * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::split(BTLeafNode& sibling, int& siblingKey)
+{
+	int num_keys = getKeyCount();
+	int left_keys = (num_keys + 1) / 2;
+	char image[PageFile::PAGE_SIZE];
+	RecordId none = { 0, 0 };
+	RC error;
+
+	if (sibling.getKeyCount() != 0 || !isPacked() || num_keys < 2)
+		return RC_INVALID_ATTRIBUTE;
+
+	if ((error = makeWritable()) || (error = sibling.makeWritable()))
+		return error;
+
+	// Both halves fit, since they take no more bits per entry than the
+	// whole. The upper half is packed straight into sibling, and the
+	// lower half aside, since it is read from this node
+	memset(sibling.buffer, 0, PageFile::PAGE_SIZE - sizeof(PageId));
+	memset(image, 0, PageFile::PAGE_SIZE);
+	if ((error = sibling.setNextNodePtr(getNextNodePtr())) ||
+	    (error = packRange(sibling.buffer, buffer, -1, 0, none, left_keys, num_keys)) ||
+	    (error = packRange(image, buffer, -1, 0, none, 0, left_keys)))
+		return error;
+	memcpy(buffer, image, PageFile::PAGE_SIZE - sizeof(PageId));
+
+	siblingKey = packedKey(sibling.buffer, 0);
+	return 0;
 }
 
 /**
@@ -328,9 +814,13 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
  */
 RC BTLeafNode::setKeyCount(int new_count)
 {
+	RC error;
+
 	if (new_count < 0) {
 		return RC_INVALID_ATTRIBUTE;
 	}
+	if (error = makeWritable())
+		return error;
 	int *cur_count = (int*) buffer;
 	*cur_count = new_count;
 	return 0;
@@ -349,26 +839,49 @@ RC BTLeafNode::setKeyCount(int new_count)
  */
 RC BTLeafNode::locate(int searchKey, int& eid)
 { 
-	// cur = beginning of buffer. keycount = number of keys in node
-	KRPair *cur = (KRPair *) (buffer + BTLeafNode::BEGINNING_OFFSET);
+	// keycount = number of keys in node
 	int keycount = getKeyCount();
 
-	// Search through the buffer. 
-	// If the current key is the searchKey, then stop and return that eid.
-	// Else if the current key is greater than the searchKey, then the 
-	// searchKey does not exist. Stop and return the eid of the first larger element.
-	for (eid = 0; eid < keycount; eid++) {
-		if ((cur + eid)->key == searchKey) {
+	if (isPacked()) {
+		eid = packedCountLess(searchKey);
+		if (eid < keycount && packedKey(buffer, eid) == searchKey) {
 			return 0;
 		}
-		else if ((cur + eid)->key > searchKey) {
-			return RC_NO_SUCH_RECORD;
-		}
-		// cur++;
+		return RC_NO_SUCH_RECORD;
+	}
+
+	// eid = the first entry whose key is not smaller than searchKey.
+	// That is the searchKey itself if it exists.
+	eid = KeySearch::countLess(keys(), 1, keycount, searchKey);
+	if (eid < keycount && keys()[eid] == searchKey) {
+		return 0;
 	}
 	return RC_NO_SUCH_RECORD; 
 }
 
+/*
+ * Return the number of keys of a packed node smaller than searchKey.
+ * A binary search on the packed keys narrows them down to a block,
+ * which is unpacked and counted with KeySearch like an unpacked node.
+ */
+int BTLeafNode::packedCountLess(int searchKey)
+{
+	int low = 0;
+	int high = getKeyCount();
+	int block[KeySearch::BLOCK_KEYS];
+
+	while (high - low > KeySearch::BLOCK_KEYS) {
+		int mid = (low + high) / 2;
+		if (packedKey(buffer, mid) < searchKey)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	unpackEntries(buffer, low, high - low, block, NULL);
+	return low + KeySearch::countLess(block, 1, high - low, searchKey);
+}
+
 /*
  * Read the (key, rid) pair from the eid entry.
  * @param eid[IN] the entry number to read the (key, rid) pair from
@@ -378,21 +891,62 @@ RC BTLeafNode::locate(int searchKey, int& eid)
  */
 RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 { 
-	KRPair *target;
-
 	// eid is 0-indexed. Check between 0 and current number of entries
 	if (eid < 0 || eid >= getKeyCount()) {
 		return RC_INVALID_CURSOR;
 	}
 
-	// Get target pair. Put key and rid into respective variables
-	target = ((KRPair *) (buffer + BTLeafNode::BEGINNING_OFFSET))  + eid;
-	key = target->key;
-	rid = target->rid;
+	if (isPacked()) {
+		unpackEntries(buffer, eid, 1, &key, &rid);
+		return 0;
+	}
+
+	// Put key and rid of the entry into respective variables
+	key = keys()[eid];
+	rid = rids()[eid];
 
 	return 0; 
 }
 
+/*
+ * Read the (key, rid) pairs of n entries in a row, starting from eid.
+ * @param eid[IN] the first entry number to read
+ * @param n[IN] the number of entries to read
+ * @param keys[OUT] the keys of the entries
+ * @param rids[OUT] the RecordIds of the entries
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::readEntries(int eid, int n, int keys[], RecordId rids[])
+{
+	if (eid < 0 || n < 0 || eid + n > getKeyCount()) {
+		return RC_INVALID_CURSOR;
+	}
+
+	if (isPacked()) {
+		unpackEntries(buffer, eid, n, keys, rids);
+		return 0;
+	}
+
+	// Both arrays are contiguous, so each takes a single copy
+	memcpy(keys, this->keys() + eid, n * sizeof(int));
+	memcpy(rids, this->rids() + eid, n * sizeof(RecordId));
+
+	return 0;
+}
+
+/*
+ * Return the index entry immediately after the last key that is not
+ * larger than searchKey.
+ * @param searchKey[IN] the key to search for.
+ * @return the number of keys not larger than searchKey
+ */
+int BTLeafNode::locateUpperBound(int searchKey)
+{
+	if (isPacked())
+		return (searchKey == INT_MAX) ? getKeyCount() : packedCountLess(searchKey + 1);
+	return KeySearch::countLessEqual(keys(), 1, getKeyCount(), searchKey);
+}
+
 /*
  * Return the pid of the next sibling node.
  * @return the PageId of the next sibling node 
@@ -412,47 +966,81 @@ PageId BTLeafNode::getNextNodePtr()
  */
 RC BTLeafNode::setNextNodePtr(PageId pid)
 { 
+	RC error;
+
 	// Check for valid PID
 	if (pid < 0) {
 		return RC_INVALID_PID;
 	}
+	if (error = makeWritable())
+		return error;
 
 	// Copy PID into last 4 bytes of buffer.
 	memcpy (buffer + PageFile::PAGE_SIZE - sizeof(PageId), &pid, sizeof(PageId));
 	return 0; 
 }
 
+/*
+ * Convert the node from the layout of index format version 1:
+ *  ----------------------------------------------
+ * | num_keys | KR_Pair | KR_Pair | ... | nextPID |
+ *  ----------------------------------------------
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::convertPairLayout()
+{
+	KRPair pairs[BTLeafNode::MAX_LEAF_KEYS];
+	int num_keys = getKeyCount();
+	RC error;
+
+	if (num_keys < 0 || num_keys > BTLeafNode::MAX_LEAF_KEYS)
+		return RC_INVALID_FILE_FORMAT;
+	if (error = makeWritable())
+		return error;
+
+	// Set the pairs aside, clear everything between the key count
+	// and the next node pointer, and spread the pairs over the arrays
+	memcpy(pairs, buffer + sizeof(int), num_keys * sizeof(KRPair));
+	memset(buffer + sizeof(int), 0, PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId));
+	for (int i = 0; i < num_keys; i++) {
+		keys()[i] = pairs[i].key;
+		rids()[i] = pairs[i].rid;
+	}
+	return 0;
+}
+
 //////////////////////////////////////////////////////////////
 //                      BT NONLEAF NODE                     //
 //////////////////////////////////////////////////////////////
 
 /*
  * The structure of a BT NON LEAF NODE:
- *  ------------------------------------------------
- * | num_keys | first_PID | KP_Pair | KP_Pair | ... |
- *  ------------------------------------------------
+ *  ------------------------------------------------------
+ * | num_keys | key | key | ... | first_PID | PID | PID | ... |
+ *  ------------------------------------------------------
+ * The keys take an array with room for MAX_NON_KEYS entries, and the
+ * PageIds one with room for MAX_NON_KEYS + 1.
  */
 
 /*
- * Constructor. Initialize buffer to all 0's.
+ * Constructor. The node reads as empty until it is read or modified.
  */
 BTNonLeafNode::BTNonLeafNode()
 {
-	memset(buffer, 0, PageFile::PAGE_SIZE); 
+	buffer = const_cast<char *>(zeroPage);
 }
 
 void BTNonLeafNode::printAll(bool keys_only) {
 	int *beginning = (int *) buffer;
 	cout << "[" << *beginning << "] | ";
 
-	cout << *(beginning + 1) << " | ";
+	cout << pids()[0] << " | ";
 
-	KPPair *kp = (KPPair *) (buffer + BTNonLeafNode::BEGINNING_OFFSET);
 	for (int i = 0; i < *beginning; i++) {
 		if (keys_only)
-			cout << (kp + i)->key << " | ";
+			cout << keys()[i] << " | ";
 		else
-			cout << (kp + i)->key << ", " << (kp + i)->pid << " | ";
+			cout << keys()[i] << ", " << pids()[i + 1] << " | ";
 	}
 	cout << endl << "---" << endl;
 }
@@ -487,9 +1075,19 @@ void BTNonLeafNode::test()
 	assert ( locate(0, eid) == 0 );
 	assert ( eid == 0 );
 	
-	for (int i = 10; i < BTNonLeafNode::MAX_NON_KEYS + 6; i++)
+	// The expected keys and counts follow from the node capacity,
+	// so that the test holds for every page size. With 1 KB pages
+	// MAX_NON_KEYS is 127, the largest key is 132, the middle key
+	// of the split is 69, and 64 and 63 keys are left on the sides.
+	const int max_keys = BTNonLeafNode::MAX_NON_KEYS;
+	const int last_key = max_keys + 5;
+	const int mid_key = max_keys/2 + 6;
+	const int left_keys = max_keys/2 + 1;
+	const int right_keys = max_keys - left_keys;
+
+	for (int i = 10; i < max_keys + 6; i++)
 	{
-		if (i == 69) {
+		if (i == mid_key) {
 			insert (5, 95);
 		}
 		else{
@@ -497,19 +1095,19 @@ void BTNonLeafNode::test()
 		}
 	}
 	/* This should be the key layout right now:
-	 * 0 1 2 3 10 11 12 ... 132
+	 * 0 1 2 3 5 10 11 12 ... last_key, without mid_key
 	*/
 	
-	// we now have 127 keys
-	assert ( getKeyCount() == BTNonLeafNode::MAX_NON_KEYS );
+	// we now have MAX_NON_KEYS keys
+	assert ( getKeyCount() == max_keys );
 	
 	// can't insert any more keys
-	assert ( insert(200, 3 ) == RC_NODE_FULL );
-	assert ( locate(200, eid) == RC_NO_SUCH_RECORD );
+	assert ( insert(200 + max_keys, 3 ) == RC_NODE_FULL );
+	assert ( locate(200 + max_keys, eid) == RC_NO_SUCH_RECORD );
 	
-	// eid of last key is 126
-	locate(132, eid);
-	assert ( eid == 126 );
+	// the last key is the last entry
+	locate(last_key, eid);
+	assert ( eid == max_keys - 1 );
 
 	// the sixth entry has a key of 11 
 	// assert ( locate(11, eid)  == 0 );
@@ -518,37 +1116,37 @@ void BTNonLeafNode::test()
 	BTNonLeafNode sibling;
 	int midkey;
 	
-	// try to insert the key 8 and PageId 9
+	// try to insert the middle key and PageId 9
 	printAll();
-	assert  ( insertAndSplit(69, 9, sibling, midkey) == 0 );
+	assert  ( insertAndSplit(mid_key, 9, sibling, midkey) == 0 );
 	printAll();
 	sibling.printAll();
 	cout << midkey << endl;
-	// left node has 64 keys, right node has 63 keys
-	assert  ( getKeyCount() == 64 && sibling.getKeyCount() == 63 );
+	// the left node keeps one key more than the right node
+	assert  ( getKeyCount() == left_keys && sibling.getKeyCount() == right_keys );
 	
-	// the middle key is 69
-	assert  ( midkey == 69 );
+	// the inserted key moves up
+	assert  ( midkey == mid_key );
 	
-	// the last key in the left node is 68
-	assert  ( locate(68, eid) == 0 );
-	assert  ( eid == 63 );
+	// the last key in the left node is the one below it
+	assert  ( locate(mid_key - 1, eid) == 0 );
+	assert  ( eid == left_keys - 1 );
 	
-	// the key 69 is not in the left node or right node
-	assert  ( locate(69, eid) == RC_NO_SUCH_RECORD && sibling.locate(69, eid) == RC_NO_SUCH_RECORD );
+	// the middle key is not in the left node or right node
+	assert  ( locate(mid_key, eid) == RC_NO_SUCH_RECORD && sibling.locate(mid_key, eid) == RC_NO_SUCH_RECORD );
 
-	// the key 70 is not in the left node.  it is the first key in the right node.
-	assert  ( locate(70, eid) == RC_NO_SUCH_RECORD );
-	assert  ( sibling.locate(70, eid) == 0 );
+	// the key above it is not in the left node.  it is the first key in the right node.
+	assert  ( locate(mid_key + 1, eid) == RC_NO_SUCH_RECORD );
+	assert  ( sibling.locate(mid_key + 1, eid) == 0 );
 	assert  ( eid  == 0 );
 	
-	// the second key in the right node is 71
-	assert  ( sibling.locate(71, eid) == 0 );
+	// the second key in the right node follows it
+	assert  ( sibling.locate(mid_key + 2, eid) == 0 );
 	assert  ( eid == 1 );
 	
-	// the last key in the right node is 132
-	assert  ( sibling.locate(132, eid) == 0 );
-	assert  ( eid == 62 );
+	// the last key in the right node is the largest key
+	assert  ( sibling.locate(last_key, eid) == 0 );
+	assert  ( eid == right_keys - 1 );
 	
 	
 	cerr << "All tests successful.\n";	
@@ -563,8 +1161,15 @@ void BTNonLeafNode::test()
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 { 
-	//setPID(pid);
-	return pf.read(pid, buffer); 
+	RC error;
+
+	// Pin the page in the cache and use it in place
+	if (error = pf.pin(pid, page)) {
+		buffer = const_cast<char *>(zeroPage);
+		return error;
+	}
+	buffer = page.data();
+	return 0;
 }
     
 /*
@@ -575,9 +1180,29 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 { 
+	if (page.isPinned())
+		return pf.write(pid, page);
 	return pf.write(pid, buffer); 
 }
 
+/*
+ * Make sure the node has a page of its own that it can modify.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::makeWritable()
+{
+	RC error;
+
+	if (page.isPinned())
+		return 0;
+
+	// Get a zero-filled page from the cache
+	if (error = PageFile::newPage(page))
+		return error;
+	buffer = page.data();
+	return 0;
+}
+
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
@@ -600,36 +1225,26 @@ RC BTNonLeafNode::insert(int key, PageId pid)
 { 
 	int num_keys = getKeyCount();
 	int eid;
-	int offset;
-	KPPair insert_pair;
+	RC error;
 
 	// If no space, return error code
 	if (num_keys >= BTNonLeafNode::MAX_NON_KEYS) {
 		return RC_NODE_FULL;
 	}
 
-	// There is space. Insert new key, RecordID pair.
-	insert_pair.key = key;
-	insert_pair.pid = pid;
-	locate(key, eid);
-
-	// eid now contains index entry number to insert into)
-	char *temp_buffer = (char *) malloc(PageFile::PAGE_SIZE * sizeof(char));
+	if (error = makeWritable())
+		return error;
 
-	// Copy the first eid KRPairs into the temp buffer.
-	// The element to insert will come after these.
-	// Then copy the rest of the buffer after the element
-	offset = BTNonLeafNode::BEGINNING_OFFSET + (sizeof(KPPair) * eid);
-	memcpy(temp_buffer, buffer, offset);
-	memcpy(temp_buffer + offset, &insert_pair, sizeof(KPPair));
-	memcpy(temp_buffer + offset + sizeof(KPPair), buffer + offset, 
-		num_keys * sizeof(KPPair) - (sizeof(KPPair) * eid));
-
-	// Move the newly constructed buffer back into the buffer variable
-	memcpy(buffer, temp_buffer, PageFile::PAGE_SIZE);
+	// There is space. Insert new key, PageId pair.
+	locate(key, eid);
 
-	// Free temp_buffer to prevent memory leak
-	free(temp_buffer);
+	// eid now contains index entry number to insert into.
+	// Shift the keys from eid on and the PageIds behind them up
+	// by one and put the new entry in the gap
+	memmove(keys() + eid + 1, keys() + eid, (num_keys - eid) * sizeof(int));
+	memmove(pids() + eid + 2, pids() + eid + 1, (num_keys - eid) * sizeof(PageId));
+	keys()[eid] = key;
+	pids()[eid + 1] = pid;
 
 	// Increase num_keys.
 	num_keys++;
@@ -649,15 +1264,13 @@ RC BTNonLeafNode::insert(int key, PageId pid)
  */
 RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
 { 
-	KPPair insert_pair;
-	KPPair mid_pair;
+	PageId mid_pid; // The PageId behind midKey
 	int eid;
 	int num_keys = getKeyCount();
-	int pivot; // Contains the eid of the pair at which we are splitting
-	int offset;
-	int side = 0; // 0 = left, 1 = right
 	int left_keys;
 	int right_keys;
+	int moved; // The number of old entries in front of the new one in sibling
+	RC error;
 
 	// Check that sibling is EMPTY
 	if (sibling.getKeyCount() != 0)
@@ -667,60 +1280,83 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
 	if (num_keys < BTNonLeafNode::MAX_NON_KEYS)
 		return RC_INVALID_ATTRIBUTE;
 
+	if ((error = makeWritable()) || (error = sibling.makeWritable()))
+		return error;
+
 	locate(key, eid);
 	// Split consistently, such that left node has more keys.
-	if (eid <= (num_keys/2)) {
-		pivot = num_keys/2;
-	} 
-	else {
-		pivot = num_keys/2 + 1;
-		side = 1;
+	// Counting the new entry, the first left_keys entries stay here,
+	// the next one is the middle key, and the rest go to sibling.
+	// The new key itself is the middle key if it lands at num_keys/2.
+	left_keys = (eid == num_keys/2) ? num_keys/2 : num_keys/2 + 1;
+	right_keys = num_keys - left_keys;
+
+	if (eid < left_keys) {
+		// The new entry stays in this node, and the last old entry
+		// in front of the sibling's entries becomes the middle key
+		midKey = keys()[left_keys - 1];
+		mid_pid = pids()[left_keys];
+		memcpy(sibling.keys(), keys() + left_keys, right_keys * sizeof(int));
+		memcpy(sibling.pids() + 1, pids() + left_keys + 1, right_keys * sizeof(PageId));
+		memmove(keys() + eid + 1, keys() + eid, (left_keys - 1 - eid) * sizeof(int));
+		memmove(pids() + eid + 2, pids() + eid + 1, (left_keys - 1 - eid) * sizeof(PageId));
+		keys()[eid] = key;
+		pids()[eid + 1] = pid;
 	}
-
-	offset = BTNonLeafNode::BEGINNING_OFFSET + (sizeof(KPPair) * pivot);
-
-	// Inserted value is middle key
-	if (eid == pivot) {
-		left_keys = pivot;
-		right_keys = num_keys - pivot;
-		mid_pair.key = key;
-		mid_pair.pid = pid;
+	else if (eid == left_keys) {
+		// The new entry is the middle key
+		midKey = key;
+		mid_pid = pid;
+		memcpy(sibling.keys(), keys() + left_keys, right_keys * sizeof(int));
+		memcpy(sibling.pids() + 1, pids() + left_keys + 1, right_keys * sizeof(PageId));
 	}
 	else {
-		left_keys = pivot;
-		right_keys = num_keys - pivot - 1;
-		mid_pair = *((KPPair *) (buffer + offset));
-		// Skip over middle key. Do not copy to sibling
-		offset += sizeof(KPPair);
+		// The new entry goes to sibling, between the entries in front
+		// of eid and the ones behind it
+		midKey = keys()[left_keys];
+		mid_pid = pids()[left_keys + 1];
+		moved = eid - left_keys - 1;
+		memcpy(sibling.keys(), keys() + left_keys + 1, moved * sizeof(int));
+		memcpy(sibling.pids() + 1, pids() + left_keys + 2, moved * sizeof(PageId));
+		sibling.keys()[moved] = key;
+		sibling.pids()[moved + 1] = pid;
+		memcpy(sibling.keys() + moved + 1, keys() + eid, (num_keys - eid) * sizeof(int));
+		memcpy(sibling.pids() + moved + 2, pids() + eid + 1, (num_keys - eid) * sizeof(PageId));
 	}
 
-	memcpy(&midKey, &mid_pair, sizeof(int));
-
-	// Clear sibling anyways. 
-	memset(sibling.buffer, 0, PageFile::PAGE_SIZE);
-	memcpy(sibling.buffer + sizeof(int), &mid_pair.pid, sizeof(PageId));
-	// Move second half of buffer to sibling.
-	memcpy(sibling.buffer + BTNonLeafNode::BEGINNING_OFFSET, buffer + offset, 
-		PageFile::PAGE_SIZE - offset);
-
+	// The middle PageId becomes the first PageId of sibling
+	sibling.pids()[0] = mid_pid;
 	sibling.setKeyCount(right_keys);
 
-	// Clear second half of buffer.
-	memset(buffer + offset, 0, PageFile::PAGE_SIZE - offset);
+	// Clear the entries that moved out of both arrays.
+	memset(keys() + left_keys, 0, (num_keys - left_keys) * sizeof(int));
+	memset(pids() + left_keys + 1, 0, (num_keys - left_keys) * sizeof(PageId));
 	setKeyCount(left_keys);
-	// Set this node to point to the new sibling
-	//setNextNodePtr(sibling.getPID());
+	return 0; 
+}
 
-	if (eid != pivot) {
-		// Insert new key, rid pair into correct leaf node.
-		if (side) {
-			sibling.insert(key, pid);
-		}
-		else {
-			insert(key, pid);
-		}
+/*
+ * Append the (key, pid) pair behind the last entry of the node.
+ * @param key[IN] the key to append
+ * @param pid[IN] the PageId to append
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RC BTNonLeafNode::append(int key, PageId pid)
+{
+	int num_keys = getKeyCount();
+	RC error;
+
+	// If no space, return error code
+	if (num_keys >= BTNonLeafNode::MAX_NON_KEYS) {
+		return RC_NODE_FULL;
 	}
-	return 0; 
+
+	if (error = makeWritable())
+		return error;
+
+	keys()[num_keys] = key;
+	pids()[num_keys + 1] = pid;
+	return setKeyCount(num_keys + 1);
 }
 
 /**
@@ -731,9 +1367,13 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
  */
 RC BTNonLeafNode::setKeyCount(int new_count)
 {
+	RC error;
+
 	if (new_count < 0) {
 		return RC_INVALID_ATTRIBUTE;
 	}
+	if (error = makeWritable())
+		return error;
 	int *cur_count = (int*) buffer;
 	*cur_count = new_count;
 	return 0;
@@ -752,22 +1392,14 @@ RC BTNonLeafNode::setKeyCount(int new_count)
  */
 RC BTNonLeafNode::locate(int searchKey, int& eid)
 { 
-	// cur = beginning of buffer. keycount = number of keys in node
-	KPPair *cur = (KPPair *) (buffer + BTNonLeafNode::BEGINNING_OFFSET);
+	// keycount = number of keys in node
 	int keycount = getKeyCount();
 
-	// Search through the buffer. 
-	// If the current key is the searchKey, then stop and return that eid.
-	// Else if the current key is greater than the searchKey, then the 
-	// searchKey does not exist. Stop and return the eid of the first larger element.
-	for (eid = 0; eid < keycount; eid++) {
-		if (cur->key == searchKey) {
-			return 0;
-		}
-		else if (cur->key > searchKey) {
-			return RC_NO_SUCH_RECORD;
-		}
-		cur++;
+	// eid = the first entry whose key is not smaller than searchKey.
+	// That is the searchKey itself if it exists.
+	eid = KeySearch::countLess(keys(), 1, keycount, searchKey);
+	if (eid < keycount && keys()[eid] == searchKey) {
+		return 0;
 	}
 	return RC_NO_SUCH_RECORD; 
 }
@@ -781,19 +1413,14 @@ RC BTNonLeafNode::locate(int searchKey, int& eid)
  */
 RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
 { 
-	KPPair *target;
 	int num_keys = getKeyCount();
 	int i;
-	
-	target = (KPPair *) (buffer + BTNonLeafNode::BEGINNING_OFFSET);
-	for (i = 0; i < num_keys; i++) {
-		if (searchKey < (target + i)->key) {
-			pid = (target + i - 1)->pid;
-			return 0;
-		}
 
-	}
-	pid = (target + i - 1)->pid;
+	// Follow the pointer behind the last key < searchKey. Entries with
+	// a key equal to the one behind it may end that child already.
+	// With no such key, pids()[0] is the first PageId.
+	i = KeySearch::countLess(keys(), 1, num_keys, searchKey);
+	pid = pids()[i];
 	return 0; 
 }
 
@@ -806,18 +1433,21 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
  */
 RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
 { 
+	RC error;
+
 	if (pid1 < 0 || pid2 < 0) {
 		return RC_INVALID_PID;
 	}
+	if (error = makeWritable())
+		return error;
 	memset(buffer, 0, PageFile::PAGE_SIZE);
-	memcpy(buffer + sizeof(int), &pid1, sizeof(PageId));
+	pids()[0] = pid1;
 	insert(key, pid2);
 	return 0;
 }
 
 int BTNonLeafNode::getChildren(PageId *children)
 {
-	KPPair *target;
 	int num_keys = getKeyCount();
 	int num_children = 0;
 	int i;
@@ -825,10 +1455,41 @@ int BTNonLeafNode::getChildren(PageId *children)
 	if (num_keys == 0)
 		return 0;
 
-	target = (KPPair *) (buffer + BTNonLeafNode::BEGINNING_OFFSET);
 	for (i = 0; i <= num_keys; i++) {
-		children[i] = (target + i - 1)->pid;
+		children[i] = pids()[i];
 		num_children++;
 	}
 	return num_children;
 }
+
+/*
+ * Convert the node from the layout of index format version 1:
+ *  ------------------------------------------------
+ * | num_keys | first_PID | KP_Pair | KP_Pair | ... |
+ *  ------------------------------------------------
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::convertPairLayout()
+{
+	KPPair pairs[BTNonLeafNode::MAX_NON_KEYS];
+	PageId first_pid;
+	int num_keys = getKeyCount();
+	RC error;
+
+	if (num_keys < 0 || num_keys > BTNonLeafNode::MAX_NON_KEYS)
+		return RC_INVALID_FILE_FORMAT;
+	if (error = makeWritable())
+		return error;
+
+	// Set the first PageId and the pairs aside, clear everything
+	// behind the key count, and spread the pairs over the arrays
+	memcpy(&first_pid, buffer + sizeof(int), sizeof(PageId));
+	memcpy(pairs, buffer + sizeof(int) + sizeof(PageId), num_keys * sizeof(KPPair));
+	memset(buffer + sizeof(int), 0, PageFile::PAGE_SIZE - sizeof(int));
+	pids()[0] = first_pid;
+	for (int i = 0; i < num_keys; i++) {
+		keys()[i] = pairs[i].key;
+		pids()[i + 1] = pairs[i].pid;
+	}
+	return 0;
+}
@@ -20,15 +20,46 @@ class BTLeafNode {
   public:
 
     /**
-    * KRPair = 12 bytes. 1024 bytes total, minus 4 for PageID, minus 4 for keycount. 
-    * floor(1016 bytes/(12 bytes/pair)) = 84 pairs (keys).
+    * Each entry takes 12 bytes: a 4-byte key and an 8-byte RecordId.
+    * PAGE_SIZE bytes total, minus 4 for PageID, minus 4 for keycount.
+    * With 1KB pages, floor(1016 bytes/(12 bytes/entry)) = 84 entries (keys).
     */
-    static const int MAX_LEAF_KEYS = 84;
+    static const int MAX_LEAF_KEYS = (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId)) / (sizeof(int) + sizeof(RecordId));
 
     /**
-    * First 4 bytes is key count.
+    * First 4 bytes is key count. The array of keys follows.
     */
-    static const int BEGINNING_OFFSET = sizeof(int);// + sizeof(PageId);
+    static const int BEGINNING_OFFSET = sizeof(int);
+
+    /**
+    * The array of RecordIds starts right after room for MAX_LEAF_KEYS keys.
+    */
+    static const int RID_OFFSET = BEGINNING_OFFSET + MAX_LEAF_KEYS * sizeof(int);
+
+    /**
+    * Set in the key count of a packed leaf. A packed leaf stores each key
+    * as its offset from the first key, each rid.pid as its offset from the
+    * smallest one, and each rid.sid as it is, in three bit-packed arrays
+    * that use as few bits as the largest value in them needs.
+    */
+    static const int PACKED_LEAF = 0x40000000;
+
+    /**
+    * A packed leaf starts with the key count, the first key, the smallest
+    * rid.pid and the three bit widths.
+    */
+    static const int PACKED_HEADER = 3 * sizeof(int) + 4;
+
+    /**
+    * The bytes a packed leaf may fill. Behind them are 8 bytes that
+    * decoding may read past the last value, and the next node pointer.
+    */
+    static const int PACKED_BYTES = PageFile::PAGE_SIZE - sizeof(PageId) - 8;
+
+    /**
+    * The most entries a packed leaf can hold, at one bit per entry.
+    */
+    static const int MAX_PACKED_KEYS = (PACKED_BYTES - PACKED_HEADER) * 8;
 
     /**
      * Constructor for Leaf Node.
@@ -54,6 +85,7 @@ class BTLeafNode {
    /**
     * Insert the (key, rid) pair to the node
     * and split the node half and half with sibling.
+    * Only for nodes that are not packed; see split().
     * The first key of the sibling node is returned in siblingKey.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert.
@@ -64,6 +96,55 @@ class BTLeafNode {
     */
     RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
 
+   /**
+    * Append the (key, rid) pair behind the last entry of the node.
+    * Used to build a node from entries sorted by key. Unlike insert(),
+    * a key equal to the last key goes behind it.
+    * @param key[IN] the key to append. It must not be smaller than the last key
+    * @param rid[IN] the RecordId to append
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(int key, const RecordId& rid);
+
+   /**
+    * Replace the entries of the node with n entries sorted by key, and
+    * pack them. The next node pointer is kept.
+    * @param keys[IN] the keys of the entries
+    * @param rids[IN] the RecordIds of the entries
+    * @param n[IN] the number of entries. At least 1
+    * @return 0 if successful. RC_NODE_FULL if the entries do not fit,
+    *         in which case the node is left as it was.
+    */
+    RC pack(const int keys[], const RecordId rids[], int n);
+
+   /**
+    * Move the upper half of the entries of a packed node to sibling,
+    * packed as well. Used when a packed node has no room for an insert,
+    * which is tried again afterwards.
+    * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+    * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC split(BTLeafNode& sibling, int& siblingKey);
+
+   /**
+    * Return the bytes that n entries take in a packed node.
+    * @param n[IN] the number of entries
+    * @param firstKey[IN] the smallest key of the entries
+    * @param lastKey[IN] the largest key of the entries
+    * @param minPid[IN] the smallest rid.pid of the entries
+    * @param maxPid[IN] the largest rid.pid of the entries
+    * @param maxSid[IN] the largest rid.sid of the entries
+    * @return the size of the packed node without the next node pointer
+    */
+    static int packedSize(int n, int firstKey, int lastKey, PageId minPid, PageId maxPid, int maxSid);
+
+   /**
+    * Return whether the entries of the node are packed.
+    * @return true if the node is packed
+    */
+    bool isPacked();
+
    /**
     * If searchKey exists in the node, set eid to the index entry
     * with searchKey and return 0. If not, set eid to the index entry
@@ -86,6 +167,24 @@ class BTLeafNode {
     */
     RC readEntry(int eid, int& key, RecordId& rid);
 
+   /**
+    * Read the (key, rid) pairs of n entries in a row, starting from eid.
+    * @param eid[IN] the first entry number to read
+    * @param n[IN] the number of entries to read
+    * @param keys[OUT] the keys of the entries
+    * @param rids[OUT] the RecordIds of the entries
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readEntries(int eid, int n, int keys[], RecordId rids[]);
+
+   /**
+    * Return the index entry immediately after the last key that is not
+    * larger than searchKey, which is the number of such keys.
+    * @param searchKey[IN] the key to search for.
+    * @return the number of keys not larger than searchKey
+    */
+    int locateUpperBound(int searchKey);
+
    /**
     * Return the pid of the next slibling node.
     * @return the PageId of the next sibling node 
@@ -129,15 +228,59 @@ class BTLeafNode {
     */
     RC write(PageId pid, PageFile& pf);
 
+   /**
+    * Convert the node from the layout of index format version 1, with
+    * interleaved (key, rid) pairs, to the current layout. The node must
+    * have been read, and must be written afterwards.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC convertPairLayout();
+
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * Make sure the node has a page of its own that it can modify.
+    * A node that was neither read nor modified yet gets a fresh page.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC makeWritable();
+
+   /**
+    * Insert the (key, rid) pair in front of entry eid of a packed node,
+    * in place unless the entries need wider values.
+    * @return 0 if successful. RC_NODE_FULL if the entries do not fit.
+    */
+    RC repack(int eid, int key, const RecordId& rid);
+
+   /**
+    * Return the number of keys of a packed node smaller than searchKey.
+    */
+    int packedCountLess(int searchKey);
+
+   /**
+    * The content of the node. Points into the page cache when the node
+    * was read from a PageFile, so changes go straight to the cached page
+    * and must be followed by write().
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char* buffer;
 
    /**
-    * A struct representing a key-record id pair in the node.
+    * The page pinned in the page cache that holds the node.
+    */
+    PageHandle page;
+
+   /**
+    * The keys of the node, kept apart from their RecordIds so that a key
+    * search reads only the keys.
+    */
+    int* keys() { return (int *) (buffer + BTLeafNode::BEGINNING_OFFSET); }
+
+   /**
+    * The RecordIds of the node. rids()[i] belongs to keys()[i].
+    */
+    RecordId* rids() { return (RecordId *) (buffer + BTLeafNode::RID_OFFSET); }
+
+   /**
+    * A key-record id pair as stored by index format version 1.
     */
     typedef struct {
         int key;
@@ -153,15 +296,22 @@ class BTNonLeafNode {
   public:
 
     /**
-    * KPPair = 8 bytes. 1024 bytes total, minus 4 for first PageID, minus 4 for keycount. 
-    * 1016 bytes/(8 bytes/pair) = 127 pairs (keys).
+    * Each key takes 8 bytes: the key and the PageId behind it.
+    * PAGE_SIZE bytes total, minus 4 for first PageID, minus 4 for keycount.
+    * With 1KB pages, 1016 bytes/(8 bytes/entry) = 127 entries (keys).
     */
-    static const int MAX_NON_KEYS = 127;
+    static const int MAX_NON_KEYS = (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId)) / (sizeof(int) + sizeof(PageId));
 
     /**
-    * First 4 bytes is key count. Then first PageId
+    * First 4 bytes is key count. The array of keys follows.
     */
-    static const int BEGINNING_OFFSET = sizeof(int) + sizeof(PageId);//2*sizeof(PageId);
+    static const int BEGINNING_OFFSET = sizeof(int);
+
+    /**
+    * The array of PageIds starts right after room for MAX_NON_KEYS keys.
+    * It begins with the first PageId, in front of the first key.
+    */
+    static const int PID_OFFSET = BEGINNING_OFFSET + MAX_NON_KEYS * sizeof(int);
 
     /**
      * Constructor for Leaf Node.
@@ -193,6 +343,16 @@ class BTNonLeafNode {
     */
     RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
 
+   /**
+    * Append the (key, pid) pair behind the last entry of the node.
+    * Used to build a node from entries sorted by key. Unlike insert(),
+    * a key equal to the last key goes behind it.
+    * @param key[IN] the key to append. It must not be smaller than the last key
+    * @param pid[IN] the PageId to append
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(int key, PageId pid);
+
     /**
     * If searchKey exists in the node, set eid to the index entry
     * with searchKey and return 0. If not, set eid to the index entry
@@ -210,6 +370,9 @@ class BTNonLeafNode {
     * Given the searchKey, find the child-node pointer to follow and
     * output it in pid.
     * Remember that the keys inside a B+tree node are sorted.
+    * A key equal to searchKey may end the child in front of it as well
+    * as start its own, so the pointer in front of the first key that is
+    * not smaller than searchKey is followed.
     * @param searchKey[IN] the searchKey that is being looked up.
     * @param pid[OUT] the pointer to the child node to follow.
     * @return 0 if successful. Return an error code if there is an error.
@@ -257,13 +420,50 @@ class BTNonLeafNode {
 
     RC getChildren(PageId *children);
 
+   /**
+    * Convert the node from the layout of index format version 1, with
+    * the first PageId followed by interleaved (key, pid) pairs, to the
+    * current layout. The node must have been read, and must be written
+    * afterwards.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC convertPairLayout();
+
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * Make sure the node has a page of its own that it can modify.
+    * A node that was neither read nor modified yet gets a fresh page.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC makeWritable();
+
+   /**
+    * The content of the node. Points into the page cache when the node
+    * was read from a PageFile, so changes go straight to the cached page
+    * and must be followed by write().
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char* buffer;
 
+   /**
+    * The page pinned in the page cache that holds the node.
+    */
+    PageHandle page;
+
+   /**
+    * The keys of the node, kept apart from their PageIds so that a key
+    * search reads only the keys.
+    */
+    int* keys() { return (int *) (buffer + BTNonLeafNode::BEGINNING_OFFSET); }
+
+   /**
+    * The PageIds of the node. pids()[0] is the first PageId, and
+    * pids()[i + 1] is the PageId behind keys()[i].
+    */
+    PageId* pids() { return (PageId *) (buffer + BTNonLeafNode::PID_OFFSET); }
+
+   /**
+    * A key-page id pair as stored by index format version 1.
+    */
     typedef struct{
         int key;
         PageId pid;
@@ -0,0 +1,552 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "BufferPool.h"
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+BufferPool::BufferPool()
+{
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    pthread_cond_init(&shards[i].loaded, NULL);
+    shards[i].frames = NULL;
+    shards[i].pages = NULL;
+    shards[i].buckets = NULL;
+    shards[i].policy = NULL;
+  }
+  pthread_mutex_init(&idLock, NULL);
+  lastFileId = 0;
+  nextFreeShard = 0;
+  dirtyCount = 0;
+  sizeMB = DEFAULT_SIZE_MB;
+  policyKind = ReplacementPolicy::ARC;
+  resize(sizeMB);
+}
+
+BufferPool::~BufferPool()
+{
+  releaseFrames();
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    pthread_mutex_destroy(&shards[i].lock);
+    pthread_cond_destroy(&shards[i].loaded);
+  }
+  pthread_mutex_destroy(&idLock);
+}
+
+RC BufferPool::setSize(int mb)
+{
+  if (mb <= 0) return RC_INVALID_ATTRIBUTE;
+
+  return resize(mb);
+}
+
+void BufferPool::setPolicy(ReplacementPolicy::Kind kind)
+{
+  policyKind = kind;
+  resize(sizeMB);
+}
+
+RC BufferPool::resize(int mb)
+{
+  RC rc;
+
+  releaseFrames();
+  if ((rc = allocateFrames(mb)) == 0) {
+    sizeMB = mb;
+    return 0;
+  }
+
+  // keep the old size if the memory for the new one is not there,
+  // or the smallest pool if even that fails
+  if (allocateFrames(sizeMB) < 0) allocateFrames(0);
+  return rc;
+}
+
+int BufferPool::newFileId()
+{
+  int fid;
+
+  pthread_mutex_lock(&idLock);
+  fid = ++lastFileId;
+  pthread_mutex_unlock(&idLock);
+
+  return fid;
+}
+
+unsigned BufferPool::hash(int fid, PageId pid)
+{
+  // mix the two ids so that consecutive pages of a file
+  // are spread over all shards
+  unsigned h = (unsigned)pid * 2654435761u + (unsigned)fid * 40503u;
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return h;
+}
+
+RC BufferPool::allocateFrames(int mb)
+{
+  int frameCount = (int)(((long long)mb << 20) / PageFile::PAGE_SIZE / SHARD_COUNT);
+  if (frameCount < MIN_FRAMES_PER_SHARD) frameCount = MIN_FRAMES_PER_SHARD;
+
+  int bucketCount = 1;
+  while (bucketCount < frameCount) bucketCount <<= 1;
+
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    Shard& s = shards[i];
+
+    // the frames are aligned for direct I/O
+    void* pages = NULL;
+    if (posix_memalign(&pages, PageFile::IO_ALIGN, (size_t)frameCount * PageFile::PAGE_SIZE) != 0) {
+      releaseFrames();
+      return RC_OUT_OF_MEMORY;
+    }
+    s.pages = (char*) pages;
+    s.frameCount = frameCount;
+    s.frames = new Frame[frameCount];
+    s.buckets = new Frame*[bucketCount];
+    s.bucketMask = bucketCount - 1;
+    memset(s.buckets, 0, sizeof(Frame*) * bucketCount);
+
+    // every frame starts out on the free list
+    s.freeList = NULL;
+    for (int j = frameCount - 1; j >= 0; j--) {
+      Frame* f = &s.frames[j];
+      f->fid = 0;
+      f->pid = -1;
+      f->shard = i;
+      f->pinCount = 0;
+      f->loading = false;
+      f->dirty = false;
+      f->writing = false;
+      f->owner = NULL;
+      f->listPrev = f->listNext = NULL;
+      f->queue = 0;
+      f->referenced = false;
+      f->stamp = 0;
+      f->data = s.pages + (size_t)j * PageFile::PAGE_SIZE;
+      f->hashNext = s.freeList;
+      s.freeList = f;
+    }
+
+    s.policy = ReplacementPolicy::create(policyKind, s.frames, frameCount);
+  }
+  dirtyCount = 0;
+  return 0;
+}
+
+void BufferPool::releaseFrames()
+{
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    Shard& s = shards[i];
+    delete [] s.frames;
+    delete [] s.buckets;
+    delete s.policy;
+    free(s.pages);
+    s.policy = NULL;
+    s.frames = NULL;
+    s.buckets = NULL;
+    s.pages = NULL;
+    s.frameCount = 0;
+    s.freeList = NULL;
+  }
+}
+
+void BufferPool::hashRemove(Frame*& bucket, Frame* f)
+{
+  for (Frame** p = &bucket; *p != NULL; p = &(*p)->hashNext) {
+    if (*p == f) {
+      *p = f->hashNext;
+      f->hashNext = NULL;
+      return;
+    }
+  }
+}
+
+// the dirty frames are counted for the pool and for their owner
+void BufferPool::setClean(Frame* f)
+{
+  if (f->dirty) {
+    f->dirty = false;
+    __sync_fetch_and_sub(&dirtyCount, 1);
+    PageFile::countDirty(f->owner, -1);
+  }
+}
+
+void BufferPool::setDirty(Frame* f)
+{
+  if (!f->dirty) {
+    f->dirty = true;
+    __sync_fetch_and_add(&dirtyCount, 1);
+    PageFile::countDirty(f->owner, 1);
+  }
+}
+
+void BufferPool::drop(Shard& s, Frame* f)
+{
+  hashRemove(bucketOf(s, hash(f->fid, f->pid)), f);
+  s.policy->removed(f);
+  setClean(f);
+
+  // a pinned frame is detached from its page and goes to
+  // the free list when the last user unpins it
+  f->fid = 0;
+  f->pid = -1;
+  f->owner = NULL;
+  if (f->pinCount == 0) {
+    f->hashNext = s.freeList;
+    s.freeList = f;
+  }
+}
+
+void BufferPool::waitWrites(Shard& s, const PageFile* owner, int fid)
+{
+  // a file must not be closed under an eviction still writing to it.
+  // the writes are matched by owner, or by file id when owner is NULL
+  for (int j = 0; j < s.frameCount; j++) {
+    Frame* f = &s.frames[j];
+    while (f->writing && (owner != NULL ? f->owner == owner : f->fid == fid)) {
+      pthread_cond_wait(&s.loaded, &s.lock);
+    }
+  }
+}
+
+BufferPool::Frame* BufferPool::lookup(Shard& s, unsigned h, int fid, PageId pid, bool wait)
+{
+  Frame* f;
+
+  // look for the page in the hash table.
+  // if another thread is loading it, wait until it is done
+  for (;;) {
+    for (f = bucketOf(s, h); f != NULL; f = f->hashNext) {
+      if (f->fid == fid && f->pid == pid) break;
+    }
+    if (f == NULL || !f->loading || !wait) return f;
+    pthread_cond_wait(&s.loaded, &s.lock);
+  }
+}
+
+BufferPool::Frame* BufferPool::takeFrame(Shard& s)
+{
+  Frame* f;
+
+  // a pool whose memory could not be allocated has no frames
+  if (s.policy == NULL) return NULL;
+
+  // take a free frame if there is one
+  if (s.freeList != NULL) {
+    f = s.freeList;
+    s.freeList = f->hashNext;
+    f->hashNext = NULL;
+    return f;
+  }
+
+  // evict the frame the policy picks.
+  // a dirty victim is given back to the policy and written to its file
+  // first. the write is done without the shard lock, with the frame pinned
+  // and marked clean, so that a change made meanwhile dirties it again.
+  // once written, the frame is the policy's next candidate, unless it was
+  // used meanwhile. a victim that cannot be written is passed over by
+  // keeping it pinned until we are done
+  std::vector<Frame*> skipped;
+  for (;;) {
+    if ((f = s.policy->victim()) == NULL) break;
+    if (!f->dirty) {
+      hashRemove(bucketOf(s, hash(f->fid, f->pid)), f);
+      PageFile::countEviction(f->owner);
+      f->owner = NULL;
+      break;
+    }
+
+    PageFile* owner = f->owner;
+    s.policy->reinstated(f);
+    f->pinCount++;
+    f->writing = true;
+    setClean(f);
+
+    pthread_mutex_unlock(&s.lock);
+    RC rc = owner->writePage(f->pid, f->data);
+    pthread_mutex_lock(&s.lock);
+
+    f->writing = false;
+    pthread_cond_broadcast(&s.loaded);
+    if (rc < 0) {
+      setDirty(f);
+      skipped.push_back(f);
+      continue;
+    }
+
+    // a frame dropped while the lock was free is ours. otherwise the
+    // policy chooses again, and evicts the frame as it would a clean one
+    if (--f->pinCount > 0) continue;
+    if (f->fid == 0) {
+      f->hashNext = NULL;
+      break;
+    }
+    s.policy->unpinned(f);
+  }
+
+  for (unsigned i = 0; i < skipped.size(); i++) {
+    if (--skipped[i]->pinCount == 0) {
+      if (skipped[i]->fid == 0) {
+        skipped[i]->hashNext = s.freeList;
+        s.freeList = skipped[i];
+      } else {
+        s.policy->unpinned(skipped[i]);
+      }
+    }
+  }
+
+  // the frame is not bound to any page until the caller binds it
+  if (f != NULL) {
+    f->fid = 0;
+    f->pid = -1;
+  }
+  return f;
+}
+
+BufferPool::Frame* BufferPool::fetch(int fid, PageId pid, bool& hit, bool wait)
+{
+  unsigned h = hash(fid, pid);
+  Shard&   s = shardOf(h);
+  Frame*   f;
+  Frame*   spare = NULL;
+
+  pthread_mutex_lock(&s.lock);
+
+  for (;;) {
+    if ((f = lookup(s, h, fid, pid, wait)) != NULL) {
+      if (spare != NULL) {
+        spare->hashNext = s.freeList;
+        s.freeList = spare;
+      }
+      if (f->loading) {
+        // someone else is loading the page and we may not wait
+        pthread_mutex_unlock(&s.lock);
+        hit = true;
+        return NULL;
+      }
+      if (f->pinCount++ == 0) s.policy->pinned(f);
+      s.policy->accessed(f);
+      pthread_mutex_unlock(&s.lock);
+      hit = true;
+      return f;
+    }
+    if (spare != NULL) break;
+
+    // takeFrame() lets go of the lock while it writes a page back,
+    // so look again in case someone else brought the page in meanwhile
+    if ((spare = takeFrame(s)) == NULL) {
+      // every frame of the shard is pinned
+      pthread_mutex_unlock(&s.lock);
+      hit = false;
+      return NULL;
+    }
+  }
+
+  hit = false;
+
+  f = spare;
+  f->fid = fid;
+  f->pid = pid;
+  f->pinCount = 1;
+  f->loading = true;
+  f->hashNext = bucketOf(s, h);
+  bucketOf(s, h) = f;
+  s.policy->inserted(f);
+
+  pthread_mutex_unlock(&s.lock);
+  return f;
+}
+
+BufferPool::Frame* BufferPool::find(int fid, PageId pid)
+{
+  unsigned h = hash(fid, pid);
+  Shard&   s = shardOf(h);
+  Frame*   f;
+
+  pthread_mutex_lock(&s.lock);
+  f = lookup(s, h, fid, pid);
+  if (f != NULL) {
+    if (f->pinCount++ == 0) s.policy->pinned(f);
+    s.policy->accessed(f);
+  }
+  pthread_mutex_unlock(&s.lock);
+
+  return f;
+}
+
+BufferPool::Frame* BufferPool::fetchFree()
+{
+  // spread the unbound frames over the shards, and fall back
+  // to the other shards when one has every frame pinned
+  unsigned start = __sync_fetch_and_add(&nextFreeShard, 1);
+
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    Shard& s = shards[(start + i) % SHARD_COUNT];
+    Frame* f;
+
+    pthread_mutex_lock(&s.lock);
+    f = takeFrame(s);
+    if (f != NULL) {
+      f->fid = 0;
+      f->pid = -1;
+      f->pinCount = 1;
+      f->loading = false;
+    }
+    pthread_mutex_unlock(&s.lock);
+
+    if (f != NULL) {
+      memset(f->data, 0, PageFile::PAGE_SIZE);
+      return f;
+    }
+  }
+
+  return NULL;
+}
+
+void BufferPool::markDirty(Frame* frame, PageFile* owner)
+{
+  Shard& s = shards[frame->shard];
+
+  pthread_mutex_lock(&s.lock);
+  // a page dirtied through another file object changes hands
+  if (frame->owner != owner) {
+    setClean(frame);
+    frame->owner = owner;
+  }
+  setDirty(frame);
+  pthread_mutex_unlock(&s.lock);
+}
+
+int BufferPool::collectDirty(int fid, Frame** frames)
+{
+  int count = 0;
+
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    Shard& s = shards[i];
+
+    pthread_mutex_lock(&s.lock);
+    for (int j = 0; j < s.frameCount; j++) {
+      Frame* f = &s.frames[j];
+      if (f->fid != fid || !f->dirty) continue;
+
+      // the frame is marked clean before it is written, so that
+      // a change made while the write is in flight dirties it again
+      if (f->pinCount++ == 0) s.policy->pinned(f);
+      setClean(f);
+      frames[count++] = f;
+    }
+    pthread_mutex_unlock(&s.lock);
+  }
+
+  return count;
+}
+
+bool BufferPool::overDirtyLimit(int dirtyPages) const
+{
+  int dirty = dirtyCount;
+  return dirty * 100 > getFrameCount() * DIRTY_LIMIT_PERCENT &&
+         dirtyPages * 100 >= dirty * FLUSH_SHARE_PERCENT;
+}
+
+void BufferPool::complete(Frame* frame, const PageFile* owner, bool used)
+{
+  Shard& s = shards[frame->shard];
+
+  pthread_mutex_lock(&s.lock);
+  if (!used) s.policy->prefetched(frame);
+  // the owner is only written through once the page is dirty,
+  // and only a writable file dirties pages
+  frame->owner = const_cast<PageFile*>(owner);
+  frame->loading = false;
+  pthread_cond_broadcast(&s.loaded);
+  pthread_mutex_unlock(&s.lock);
+}
+
+void BufferPool::abort(Frame* frame)
+{
+  Shard& s = shards[frame->shard];
+
+  pthread_mutex_lock(&s.lock);
+  if (frame->fid != 0) {
+    hashRemove(bucketOf(s, hash(frame->fid, frame->pid)), frame);
+    s.policy->removed(frame);
+  }
+  frame->fid = 0;
+  frame->pid = -1;
+  frame->loading = false;
+  frame->pinCount = 0;
+  frame->hashNext = s.freeList;
+  s.freeList = frame;
+  pthread_cond_broadcast(&s.loaded);
+  pthread_mutex_unlock(&s.lock);
+}
+
+void BufferPool::unpin(Frame* frame)
+{
+  Shard& s = shards[frame->shard];
+
+  pthread_mutex_lock(&s.lock);
+  if (--frame->pinCount == 0) {
+    if (frame->fid == 0) {
+      // the page was dropped while pinned
+      frame->hashNext = s.freeList;
+      s.freeList = frame;
+    } else {
+      s.policy->unpinned(frame);
+    }
+  }
+  pthread_mutex_unlock(&s.lock);
+}
+
+void BufferPool::invalidate(int fid, PageId pid)
+{
+  unsigned h = hash(fid, pid);
+  Shard&   s = shardOf(h);
+
+  pthread_mutex_lock(&s.lock);
+  for (Frame* f = bucketOf(s, h); f != NULL; f = f->hashNext) {
+    if (f->fid == fid && f->pid == pid) {
+      drop(s, f);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&s.lock);
+}
+
+void BufferPool::invalidateFile(int fid)
+{
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    Shard& s = shards[i];
+
+    pthread_mutex_lock(&s.lock);
+    waitWrites(s, NULL, fid);
+    for (int j = 0; j < s.frameCount; j++) {
+      if (s.frames[j].fid == fid) drop(s, &s.frames[j]);
+    }
+    pthread_mutex_unlock(&s.lock);
+  }
+}
+
+void BufferPool::detach(const PageFile* owner)
+{
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    Shard& s = shards[i];
+
+    pthread_mutex_lock(&s.lock);
+    waitWrites(s, owner, 0);
+    for (int j = 0; j < s.frameCount; j++) {
+      Frame* f = &s.frames[j];
+      if (f->owner != owner) continue;
+      if (f->dirty) drop(s, f);
+      f->owner = NULL;
+    }
+    pthread_mutex_unlock(&s.lock);
+  }
+}
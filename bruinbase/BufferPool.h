@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <pthread.h>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "ReplacementPolicy.h"
+
+/**
+ * a cache frame holding one page.
+ * a frame returned by BufferPool::fetch() is pinned and cannot be evicted
+ * until it is handed back through complete()/abort() and unpin().
+ */
+struct BufferFrame {
+  int     fid;        // file id of the cached page. 0 if not bound to a page
+  PageId  pid;        // page id of the cached page
+  int     shard;      // the shard owning the frame
+  int     pinCount;   // # of users currently holding the frame
+  bool    loading;    // true while the page is being read from disk
+  bool    dirty;      // true if the page was changed since it was written
+  bool    writing;    // true while the page is written back for an eviction
+  PageFile* owner;    // the file the page belongs to
+  BufferFrame* hashNext;   // next frame in the same hash bucket
+  BufferFrame* listPrev;   // links of the replacement policy's lists
+  BufferFrame* listNext;
+  int     queue;      // which list of the replacement policy holds the frame
+  bool    referenced; // reference bit of the replacement policy
+  unsigned stamp;     // when the replacement policy took the page in
+  char*   data;       // the page content
+};
+
+/**
+ * the page cache shared by every open PageFile.
+ * cached pages are identified by (file id, PageId). the frames are split
+ * into SHARD_COUNT shards, each with its own hash table, replacement
+ * policy and lock, so that threads touching different pages rarely wait
+ * on each other.
+ */
+class BufferPool {
+ public:
+
+  static const int DEFAULT_SIZE_MB = 16;       // default capacity in MB
+  static const int SHARD_COUNT = 16;           // # of independently locked shards
+  static const int MIN_FRAMES_PER_SHARD = 8;   // lower bound on the shard size
+  static const int DIRTY_LIMIT_PERCENT = 50;   // dirty share that calls for a flush
+  static const int FLUSH_SHARE_PERCENT = 12;   // share of the dirty frames a file flushes
+
+  typedef BufferFrame Frame;
+
+  BufferPool();
+  ~BufferPool();
+
+  /**
+   * set the capacity of the pool. all cached pages are dropped.
+   * must not be called while any frame is pinned.
+   * if the memory cannot be allocated, the pool keeps its old capacity.
+   * @param sizeMB[IN] the capacity in MB
+   * @return error code. 0 if no error
+   */
+  RC setSize(int sizeMB);
+
+  /**
+   * @return the capacity of the pool in MB
+   */
+  int getSize() const { return sizeMB; }
+
+  /**
+   * choose how the pool picks the pages to evict. all cached pages are
+   * dropped. must not be called while any frame is pinned.
+   * @param kind[IN] the replacement policy
+   */
+  void setPolicy(ReplacementPolicy::Kind kind);
+
+  /**
+   * @return the replacement policy of the pool
+   */
+  ReplacementPolicy::Kind getPolicy() const { return policyKind; }
+
+  /**
+   * allocate a new file id. the pool never hands out the same id twice.
+   * PageFile gives a reopened file its old id back only when the device,
+   * inode, size and modification time are all unchanged since it was
+   * closed, so its cached pages still match the disk and can be used.
+   * any other file, or a file changed behind our back, gets a new id,
+   * and the stale pages of the old id age out of the pool.
+   * @return a new file id (> 0)
+   */
+  int newFileId();
+
+  /**
+   * find the page (fid, pid) in the pool and pin it.
+   * on a hit, hit is set to true and the frame holds the page content.
+   * on a miss, hit is set to false and an empty frame is reserved for the
+   * page. the caller must fill frame->data and then call complete(), or
+   * call abort() if the page could not be read.
+   * if another user is still loading the page, fetch() waits for it,
+   * or returns NULL with hit set to true when wait is false.
+   * @param fid[IN] the file id of the page
+   * @param pid[IN] the page id
+   * @param hit[OUT] whether the page was found in the pool
+   * @param wait[IN] whether to wait for a page being loaded
+   * @return the pinned frame. NULL if every frame in the shard is pinned
+   */
+  Frame* fetch(int fid, PageId pid, bool& hit, bool wait = true);
+
+  /**
+   * find the page (fid, pid) in the pool and pin it.
+   * unlike fetch(), nothing is reserved when the page is not cached.
+   * @param fid[IN] the file id of the page
+   * @param pid[IN] the page id
+   * @return the pinned frame. NULL if the page is not in the pool
+   */
+  Frame* find(int fid, PageId pid);
+
+  /**
+   * pin a zero-filled frame that is not bound to any page.
+   * the frame returns to the free list when it is unpinned.
+   * @return the pinned frame. NULL if every frame in the pool is pinned
+   */
+  Frame* fetchFree();
+
+  /**
+   * mark a frame reserved by fetch() as loaded.
+   * @param frame[IN] the frame whose data has been filled in
+   * @param owner[IN] the file the page belongs to
+   * @param used[IN] false if the page was read ahead of its use
+   */
+  void complete(Frame* frame, const PageFile* owner, bool used = true);
+
+  /**
+   * give up a frame reserved by fetch() whose page could not be read.
+   * the frame is released, so the caller must not call unpin() on it.
+   * @param frame[IN] the frame to drop
+   */
+  void abort(Frame* frame);
+
+  /**
+   * mark a pinned frame as dirty. the frame is written to its owner
+   * before it is evicted.
+   * @param frame[IN] the pinned frame
+   * @param owner[IN] the file the page belongs to
+   */
+  void markDirty(Frame* frame, PageFile* owner);
+
+  /**
+   * pin every dirty frame of the file and mark it clean.
+   * the caller writes the pages out and unpins the frames.
+   * @param fid[IN] the file id
+   * @param frames[OUT] the dirty frames. must hold getFrameCount() entries
+   * @return the number of frames stored in frames
+   */
+  int collectDirty(int fid, Frame** frames);
+
+  /**
+   * find out whether a writer should flush its file. finding the dirty
+   * pages of a file takes a pass over every frame, so a file with only a
+   * few of them leaves them to the evictions.
+   * @param dirtyPages[IN] the # of dirty pages of the writer's file
+   * @return true if so many frames are dirty that the file should flush
+   */
+  bool overDirtyLimit(int dirtyPages) const;
+
+  /**
+   * @return the total number of frames in the pool
+   */
+  int getFrameCount() const { return SHARD_COUNT * shards[0].frameCount; }
+
+  /**
+   * release a frame pinned by fetch().
+   * @param frame[IN] the frame to release
+   */
+  void unpin(Frame* frame);
+
+  /**
+   * drop the page (fid, pid) from the pool if it is cached.
+   * if the page is pinned, its frame is freed when the last user unpins it.
+   * @param fid[IN] the file id of the page
+   * @param pid[IN] the page id
+   */
+  void invalidate(int fid, PageId pid);
+
+  /**
+   * drop every page of the file from the pool.
+   * dirty pages are dropped too, so flush the file first.
+   * @param fid[IN] the file id
+   */
+  void invalidateFile(int fid);
+
+  /**
+   * forget a closing file as the owner of its cached pages.
+   * clean pages stay cached for the next user of the file id,
+   * and pages still dirty are dropped.
+   * @param owner[IN] the closing file
+   */
+  void detach(const PageFile* owner);
+
+
+ private:
+  struct Shard {
+    pthread_mutex_t lock;
+    pthread_cond_t  loaded;     // signaled when a loading or writing frame settles
+    Frame*  frames;             // all frames of the shard
+    char*   pages;              // the page memory backing the frames
+    int     frameCount;
+    Frame** buckets;            // hash table of the cached frames
+    int     bucketMask;         // (# of buckets - 1). # of buckets is 2^n
+    Frame*  freeList;           // frames not holding any page
+    ReplacementPolicy* policy;  // picks the frames to evict
+  };
+
+  static unsigned hash(int fid, PageId pid);
+
+  Shard& shardOf(unsigned h) { return shards[h % SHARD_COUNT]; }
+  static Frame*& bucketOf(Shard& s, unsigned h) { return s.buckets[(h / SHARD_COUNT) & s.bucketMask]; }
+
+  RC   resize(int mb);
+  RC   allocateFrames(int mb);
+  void releaseFrames();
+
+  // the following helpers must be called with the shard lock held.
+  // takeFrame() lets go of the lock while it writes a dirty victim back
+  static Frame* lookup(Shard& s, unsigned h, int fid, PageId pid, bool wait = true);
+  Frame* takeFrame(Shard& s);
+  static void hashRemove(Frame*& bucket, Frame* f);
+  static void waitWrites(Shard& s, const PageFile* owner, int fid);
+  void drop(Shard& s, Frame* f);
+  void setClean(Frame* f);
+  void setDirty(Frame* f);
+
+  Shard  shards[SHARD_COUNT];
+  int    sizeMB;
+  ReplacementPolicy::Kind policyKind;
+  int    lastFileId;
+  unsigned nextFreeShard;     // where fetchFree() looks first
+  int    dirtyCount;          // # of dirty frames in the pool
+
+  pthread_mutex_t idLock;     // protects lastFileId
+};
+
+#endif // BUFFERPOOL_H
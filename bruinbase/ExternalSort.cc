@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include "ExternalSort.h"
+
+using std::string;
+using std::vector;
+
+int ExternalSort::memoryLimit = 64 * 1024 * 1024;
+
+static string defaultTempDir()
+{
+  const char* dir = getenv("TMPDIR");
+  return (dir != NULL && *dir != '\0') ? dir : "/tmp";
+}
+
+string ExternalSort::tempDir = defaultTempDir();
+
+//
+// orders the records of a buffer through their pointers. records that
+// are equal keep the order they were added in, which is their order in
+// the buffer, so that the sort is stable.
+//
+struct RecordOrder {
+  ExternalSort::LessFunction less;
+
+  bool operator()(const char* r1, const char* r2) const
+  {
+    if (less(r1, r2)) return true;
+    if (less(r2, r1)) return false;
+    return r1 < r2;
+  }
+};
+
+ExternalSort::ExternalSort(int recordSize, LessFunction less)
+  : recordSize(recordSize), less(less)
+{
+  perPage = PageFile::PAGE_SIZE / recordSize;
+
+  // a worker per CPU, up to MAX_THREADS
+  long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+  threadCount = (cpus < 1) ? 1 : (cpus > MAX_THREADS) ? MAX_THREADS : (int) cpus;
+
+  // a buffer for every worker to sort, and one more for add() to fill
+  // meanwhile. a record takes its pointer in the sort order as well.
+  capacity = memoryLimit / (threadCount + 1) / (recordSize + (int) sizeof(char*));
+  if (capacity < perPage) capacity = perPage;
+
+  // the merge reads READ_CHUNK pages of every run at once
+  fanIn = memoryLimit / (READ_CHUNK * PageFile::PAGE_SIZE);
+  if (fanIn < 2) fanIn = 2;
+
+  recordCount = 0;
+  finished = false;
+  current = NULL;
+  nextSeq = 0;
+  emitted = 0;
+  busy = 0;
+  stopping = false;
+  workerError = 0;
+  runsWritten = 0;
+  inMemory = false;
+  stats.clear();
+
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&workReady, NULL);
+  pthread_cond_init(&bufferFree, NULL);
+}
+
+ExternalSort::~ExternalSort()
+{
+  stopWorkers();
+
+  for (unsigned i = 0; i < buffers.size(); i++) freeBuffer(buffers[i]);
+  for (unsigned i = 0; i < readers.size(); i++) delete [] readers[i].chunk;
+
+  // the temporary files were removed when they were created
+  for (unsigned i = 0; i < files.size(); i++) {
+    stats.add(files[i]->getStats());
+    files[i]->discard();
+    delete files[i];
+  }
+
+  pthread_cond_destroy(&bufferFree);
+  pthread_cond_destroy(&workReady);
+  pthread_mutex_destroy(&lock);
+}
+
+RC ExternalSort::setMemoryLimit(int sizeMB)
+{
+  if (sizeMB <= 0 || sizeMB > INT_MAX / (1024 * 1024)) return RC_INVALID_ATTRIBUTE;
+  memoryLimit = sizeMB * 1024 * 1024;
+  return 0;
+}
+
+IoStats ExternalSort::getStats() const
+{
+  IoStats total = stats;
+  for (unsigned i = 0; i < files.size(); i++) total.add(files[i]->getStats());
+  return total;
+}
+
+RC ExternalSort::add(const void* record)
+{
+  RC rc;
+
+  if (finished) return RC_INVALID_ATTRIBUTE;
+
+  if (current == NULL) {
+    current = newBuffer();
+  } else if (current->count == capacity) {
+    if ((rc = handOff()) < 0) return rc;
+  }
+
+  memcpy(current->records + (size_t) current->count * recordSize, record, recordSize);
+  current->count++;
+  recordCount++;
+  return 0;
+}
+
+RC ExternalSort::finish()
+{
+  RC rc;
+
+  if (finished) return RC_INVALID_ATTRIBUTE;
+  finished = true;
+
+  // every record fit in one buffer. sort it in memory.
+  if (workers.empty()) {
+    inMemory = true;
+    if (current != NULL) sortBuffer(current);
+    return 0;
+  }
+
+  // write the last buffer as a run too, and wait for all the runs
+  pthread_mutex_lock(&lock);
+  if (current->count > 0) queueBuffer(current);
+  current = NULL;
+  pthread_mutex_unlock(&lock);
+  stopWorkers();
+  if (workerError < 0) return workerError;
+
+  // the merge needs the memory of the buffers
+  for (unsigned i = 0; i < buffers.size(); i++) freeBuffer(buffers[i]);
+  buffers.clear();
+  freeList.clear();
+
+  // the workers finished the runs in any order
+  std::sort(runs.begin(), runs.end(), runBefore);
+
+  while ((int) runs.size() > fanIn) {
+    if ((rc = mergePass()) < 0) return rc;
+  }
+  return startMerge(0, runs.size());
+}
+
+RC ExternalSort::next(void* record)
+{
+  if (!finished) return RC_INVALID_ATTRIBUTE;
+
+  if (inMemory) {
+    if (current == NULL || emitted == current->count) return RC_END_OF_STREAM;
+    memcpy(record, current->order[emitted++], recordSize);
+    return 0;
+  }
+
+  int winner = tree[0];
+  if (exhausted(winner)) return RC_END_OF_STREAM;
+
+  memcpy(record, recordOf(winner), recordSize);
+  emitted++;
+  return advance(winner);
+}
+
+// order runs by the sequence # of their first records
+bool ExternalSort::runBefore(const Run& r1, const Run& r2)
+{
+  return r1.seq < r2.seq;
+}
+
+ExternalSort::Buffer* ExternalSort::newBuffer()
+{
+  Buffer* b = new Buffer;
+  b->records = new char[(size_t) capacity * recordSize];
+  b->order = new char*[capacity];
+  b->count = 0;
+  b->seq = 0;
+  buffers.push_back(b);
+  return b;
+}
+
+void ExternalSort::freeBuffer(Buffer* b)
+{
+  delete [] b->records;
+  delete [] b->order;
+  delete b;
+}
+
+void ExternalSort::sortBuffer(Buffer* b)
+{
+  RecordOrder order = { less };
+
+  for (int i = 0; i < b->count; i++) {
+    b->order[i] = b->records + (size_t) i * recordSize;
+  }
+  std::sort(b->order, b->order + b->count, order);
+}
+
+void ExternalSort::queueBuffer(Buffer* b)
+{
+  b->seq = nextSeq++;
+  queued.push_back(b);
+  pthread_cond_signal(&workReady);
+}
+
+RC ExternalSort::handOff()
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&lock);
+
+  // the workers start with the first full buffer
+  if (workers.empty()) {
+    for (int i = 0; i < threadCount; i++) {
+      pthread_t t;
+      if (pthread_create(&t, NULL, workerMain, this) != 0) break;
+      workers.push_back(t);
+    }
+    if (workers.empty()) {
+      pthread_mutex_unlock(&lock);
+      return RC_INVALID_ATTRIBUTE;
+    }
+  }
+
+  queueBuffer(current);
+  current = NULL;
+
+  // take a free buffer, allocate one while under budget, or wait
+  while (current == NULL && workerError == 0) {
+    if (!freeList.empty()) {
+      current = freeList.back();
+      freeList.pop_back();
+    } else if ((int) buffers.size() < threadCount + 1) {
+      current = newBuffer();
+    } else {
+      pthread_cond_wait(&bufferFree, &lock);
+    }
+  }
+  if (current == NULL) rc = workerError;
+
+  pthread_mutex_unlock(&lock);
+
+  if (current != NULL) current->count = 0;
+  return rc;
+}
+
+void* ExternalSort::workerMain(void* arg)
+{
+  ExternalSort* s = (ExternalSort*) arg;
+  PageFile* file = NULL;   // the runs of this worker go here
+  RC rc;
+
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    while (s->queued.empty() && !s->stopping) {
+      pthread_cond_wait(&s->workReady, &s->lock);
+    }
+    if (s->queued.empty()) break;
+
+    Buffer* b = s->queued.front();
+    s->queued.erase(s->queued.begin());
+    s->busy++;
+    pthread_mutex_unlock(&s->lock);
+
+    s->sortBuffer(b);
+    rc = s->writeRun(b, file);
+
+    pthread_mutex_lock(&s->lock);
+    if (rc < 0 && s->workerError == 0) s->workerError = rc;
+    b->count = 0;
+    s->freeList.push_back(b);
+    s->busy--;
+    pthread_cond_broadcast(&s->bufferFree);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+}
+
+void ExternalSort::stopWorkers()
+{
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_broadcast(&workReady);
+  pthread_mutex_unlock(&lock);
+
+  for (unsigned i = 0; i < workers.size(); i++) pthread_join(workers[i], NULL);
+  workers.clear();
+}
+
+RC ExternalSort::newTempFile(PageFile*& file)
+{
+  RC rc;
+  string name = tempDir + "/bruinbase-sort-XXXXXX";
+  vector<char> path(name.begin(), name.end());
+  path.push_back('\0');
+
+  int fd = ::mkstemp(&path[0]);
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  ::close(fd);
+
+  // the open file lives on without its name
+  file = new PageFile;
+  rc = file->open(&path[0], 'w');
+  ::unlink(&path[0]);
+  if (rc < 0) {
+    delete file;
+    file = NULL;
+    return rc;
+  }
+
+  pthread_mutex_lock(&lock);
+  files.push_back(file);
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+RC ExternalSort::writeRun(Buffer* b, PageFile*& file)
+{
+  RC rc;
+  vector<char> page(PageFile::PAGE_SIZE);
+  Run run;
+  int slot = 0;
+
+  if (file == NULL && (rc = newTempFile(file)) < 0) return rc;
+
+  run.file = file;
+  run.first = file->endPid();
+  run.count = b->count;
+  run.seq = b->seq;
+
+  // pack the records into pages. a record never spans two pages.
+  PageId pid = run.first;
+  for (int i = 0; i < b->count; i++) {
+    memcpy(&page[slot * recordSize], b->order[i], recordSize);
+    if (++slot == perPage || i == b->count - 1) {
+      memset(&page[slot * recordSize], 0, PageFile::PAGE_SIZE - slot * recordSize);
+      if ((rc = file->write(pid++, &page[0])) < 0) return rc;
+      slot = 0;
+    }
+  }
+
+  pthread_mutex_lock(&lock);
+  runs.push_back(run);
+  runsWritten++;
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+RC ExternalSort::mergePass()
+{
+  RC rc;
+  PageFile* file;
+  vector<Run> merged;
+  vector<char> page(PageFile::PAGE_SIZE);
+
+  if ((rc = newTempFile(file)) < 0) return rc;
+
+  // merge every fanIn runs in a row into one run of the new file
+  for (unsigned i = 0; i < runs.size(); i += fanIn) {
+    unsigned to = std::min(i + fanIn, (unsigned) runs.size());
+    if (to - i == 1) {
+      merged.push_back(runs[i]);
+      continue;
+    }
+    if ((rc = startMerge(i, to)) < 0) return rc;
+
+    Run run;
+    run.file = file;
+    run.first = file->endPid();
+    run.count = 0;
+    run.seq = runs[i].seq;
+
+    PageId pid = run.first;
+    int slot = 0;
+    int winner;
+    while (!exhausted(winner = tree[0])) {
+      memcpy(&page[slot * recordSize], recordOf(winner), recordSize);
+      run.count++;
+      if (++slot == perPage) {
+        if ((rc = file->write(pid++, &page[0])) < 0) return rc;
+        slot = 0;
+      }
+      if ((rc = advance(winner)) < 0) return rc;
+    }
+    if (slot > 0) {
+      memset(&page[slot * recordSize], 0, PageFile::PAGE_SIZE - slot * recordSize);
+      if ((rc = file->write(pid, &page[0])) < 0) return rc;
+    }
+    merged.push_back(run);
+    runsWritten++;
+  }
+
+  runs.swap(merged);
+  return 0;
+}
+
+RC ExternalSort::startMerge(int from, int to)
+{
+  RC rc;
+
+  for (unsigned i = 0; i < readers.size(); i++) delete [] readers[i].chunk;
+  readers.clear();
+
+  for (int i = from; i < to; i++) {
+    RunReader r;
+    r.run = runs[i];
+    r.chunk = new char[READ_CHUNK * PageFile::PAGE_SIZE];
+    r.nextPid = runs[i].first;
+    r.slot = 0;
+    r.slots = 0;
+    r.left = runs[i].count;
+    readers.push_back(r);
+    if ((rc = fillChunk(readers.back())) < 0) return rc;
+  }
+
+  //
+  // the loser tree over k runs is a complete binary tree with the runs
+  // as its leaves k ... 2k-1. every inner node 1 ... k-1 holds the run
+  // that lost the match at the node, and tree[0] the overall winner.
+  //
+  int k = readers.size();
+  tree.assign(std::max(k, 1), 0);
+  if (k > 1) tree[0] = playMatch(1);
+  return 0;
+}
+
+int ExternalSort::playMatch(int node)
+{
+  int k = readers.size();
+  if (node >= k) return node - k;
+
+  int a = playMatch(2 * node);
+  int b = playMatch(2 * node + 1);
+  if (beats(a, b)) {
+    tree[node] = b;
+    return a;
+  }
+  tree[node] = a;
+  return b;
+}
+
+RC ExternalSort::advance(int run)
+{
+  RC rc;
+  RunReader& r = readers[run];
+
+  if (++r.slot == r.slots && r.left > 0) {
+    if ((rc = fillChunk(r)) < 0) return rc;
+  }
+
+  // replay the matches on the way from the run up to the root
+  int k = readers.size();
+  int winner = run;
+  for (int t = (run + k) / 2; t > 0; t /= 2) {
+    if (beats(tree[t], winner)) std::swap(tree[t], winner);
+  }
+  tree[0] = winner;
+  return 0;
+}
+
+RC ExternalSort::fillChunk(RunReader& r)
+{
+  RC rc;
+  PageId pids[READ_CHUNK];
+  void*  bufs[READ_CHUNK];
+  long long pagesLeft = (r.left + perPage - 1) / perPage;
+  int n = (int) std::min((long long) READ_CHUNK, pagesLeft);
+
+  for (int i = 0; i < n; i++) {
+    pids[i] = r.nextPid + i;
+    bufs[i] = r.chunk + i * PageFile::PAGE_SIZE;
+  }
+  if ((rc = r.run.file->readPages(pids, n, bufs)) < 0) return rc;
+
+  r.nextPid += n;
+  r.slots = (int) std::min(r.left, (long long) n * perPage);
+  r.slot = 0;
+  r.left -= r.slots;
+
+  // start reading the chunk after this one
+  n = (int) std::min((long long) READ_CHUNK, (r.left + perPage - 1) / perPage);
+  if (n > 0) {
+    for (int i = 0; i < n; i++) pids[i] = r.nextPid + i;
+    r.run.file->willNeed(pids, n);
+  }
+  return 0;
+}
+
+bool ExternalSort::exhausted(int run) const
+{
+  return readers[run].slot >= readers[run].slots;
+}
+
+const char* ExternalSort::recordOf(int run) const
+{
+  const RunReader& r = readers[run];
+  return r.chunk + (r.slot / perPage) * PageFile::PAGE_SIZE + (r.slot % perPage) * recordSize;
+}
+
+bool ExternalSort::beats(int a, int b) const
+{
+  // an exhausted run loses every match
+  if (exhausted(a)) return false;
+  if (exhausted(b)) return true;
+
+  const char* ra = recordOf(a);
+  const char* rb = recordOf(b);
+  if (less(ra, rb)) return true;
+  if (less(rb, ra)) return false;
+
+  // equal records come out in the order they were added
+  return readers[a].run.seq < readers[b].run.seq;
+}
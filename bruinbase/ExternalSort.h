@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * sorts fixed-size records that may not fit in memory.
+ * records are passed to add() in any order; after finish(), next()
+ * returns them in sorted order. the sort is stable.
+ *
+ * records are collected in buffers of the memory budget. a full buffer
+ * is sorted and written to a temporary PageFile as a sorted run by a
+ * pool of worker threads, while add() keeps filling the next buffer.
+ * the runs are then merged with a loser tree, in more than one pass if
+ * there are too many runs to read at once. when every record fits in a
+ * single buffer, nothing is written and next() reads the buffer.
+ */
+class ExternalSort {
+ public:
+  /**
+   * the ordering of the records.
+   * @return true if record r1 goes before record r2
+   */
+  typedef bool (*LessFunction)(const void* r1, const void* r2);
+
+  static const int MAX_THREADS = 8;   // most worker threads of a sort
+  static const int READ_CHUNK = 16;   // # of pages a run is read ahead by
+
+  /**
+   * @param recordSize[IN] the size of a record in bytes, up to PAGE_SIZE
+   * @param less[IN] the ordering of the records
+   */
+  ExternalSort(int recordSize, LessFunction less);
+  ~ExternalSort();
+
+  /**
+   * set the memory budget of the sorts created from now on.
+   * @param sizeMB[IN] the memory budget in MB
+   * @return error code. 0 if no error
+   */
+  static RC setMemoryLimit(int sizeMB);
+
+  /**
+   * set the directory of the temporary files. $TMPDIR, or /tmp if it
+   * is not set, by default. the files are removed as soon as they are
+   * created, so nothing is left behind.
+   * @param dir[IN] the directory
+   */
+  static void setTempDir(const std::string& dir) { tempDir = dir; }
+
+  /**
+   * add a record to sort.
+   * @param record[IN] the record, recordSize bytes
+   * @return error code. 0 if no error
+   */
+  RC add(const void* record);
+
+  /**
+   * end the input and prepare to return the records in order.
+   * waits for the runs being written and merges runs until
+   * few enough are left to merge in one pass.
+   * @return error code. 0 if no error
+   */
+  RC finish();
+
+  /**
+   * return the next record in sorted order.
+   * @param record[OUT] the record, recordSize bytes
+   * @return RC_END_OF_STREAM after the last record. 0 otherwise
+   */
+  RC next(void* record);
+
+  /**
+   * @return the number of records added
+   */
+  long long getRecordCount() const { return recordCount; }
+
+  /**
+   * @return the number of sorted runs written to the disk
+   */
+  int getRunCount() const { return runsWritten; }
+
+  /**
+   * @return the I/O statistics of the temporary files
+   */
+  IoStats getStats() const;
+
+ private:
+  // a buffer of records and its sort order
+  struct Buffer {
+    char*  records;   // room for capacity records
+    char** order;     // the records in sorted order, after sortBuffer()
+    int    count;     // # of records in the buffer
+    int    seq;       // the sequence # of its run
+  };
+
+  // a sorted run on the disk
+  struct Run {
+    PageFile* file;      // the temporary file holding it
+    PageId    first;     // its first page
+    long long count;     // # of records
+    int       seq;       // runs of earlier records have lower numbers
+  };
+
+  // reads a run a chunk of pages at a time
+  struct RunReader {
+    Run       run;
+    char*     chunk;     // READ_CHUNK pages
+    PageId    nextPid;   // the next page to read into chunk
+    int       slot;      // the current record in chunk
+    int       slots;     // # of records in chunk
+    long long left;      // # of records not yet read into chunk
+  };
+
+  Buffer* newBuffer();
+  void  freeBuffer(Buffer* b);
+  void  sortBuffer(Buffer* b);
+  void  queueBuffer(Buffer* b);     // with lock held
+  RC    handOff();
+  RC    writeRun(Buffer* b, PageFile*& file);
+  RC    newTempFile(PageFile*& file);
+  void  stopWorkers();
+
+  RC    mergePass();
+  RC    startMerge(int from, int to);
+  int   playMatch(int node);
+  RC    advance(int run);
+  RC    fillChunk(RunReader& r);
+  bool  exhausted(int run) const;
+  const char* recordOf(int run) const;
+  bool  beats(int a, int b) const;
+
+  static bool  runBefore(const Run& r1, const Run& r2);
+  static void* workerMain(void* arg);
+
+  int          recordSize;
+  LessFunction less;
+  int          perPage;       // # of records in a page of a run
+  int          capacity;      // # of records in a buffer
+  int          threadCount;   // # of worker threads
+  long long    recordCount;
+  bool         finished;
+
+  std::vector<Buffer*> buffers;     // every buffer allocated
+  Buffer*      current;             // the buffer add() fills
+  int          nextSeq;             // the sequence # of the next run
+  long long    emitted;             // # of records next() returned
+
+  // worker pool state, guarded by lock
+  pthread_mutex_t lock;
+  pthread_cond_t  workReady;        // signaled when a buffer is queued
+  pthread_cond_t  bufferFree;       // signaled when a buffer is freed
+  std::vector<Buffer*> queued;      // full buffers waiting for a worker
+  std::vector<Buffer*> freeList;    // buffers add() can fill next
+  std::vector<pthread_t> workers;
+  int          busy;                // # of buffers being written
+  bool         stopping;
+  RC           workerError;         // the first error of a worker
+
+  std::vector<PageFile*> files;     // every temporary file
+  std::vector<Run> runs;            // the runs not merged yet
+  int          runsWritten;
+
+  // the merge of the last pass
+  std::vector<RunReader> readers;
+  std::vector<int> tree;            // loser tree. tree[0] is the winner
+  int          fanIn;               // most runs merged at once
+  bool         inMemory;            // next() reads the single buffer
+
+  IoStats      stats;               // of the discarded temporary files
+
+  static int         memoryLimit;   // the budget of new sorts in bytes
+  static std::string tempDir;
+};
+
+#endif // EXTERNALSORT_H
@@ -0,0 +1,533 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "IoQueue.h"
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// io_uring is only used on Linux, and can be compiled out
+// with -DBRUINBASE_NO_IO_URING
+#if defined(__linux__) && !defined(BRUINBASE_NO_IO_URING)
+#define USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+//
+// helper for submitAndWait(): counts down the outstanding requests
+//
+struct IoLatch {
+  pthread_mutex_t lock;
+  pthread_cond_t  zero;
+  int             remaining;
+};
+
+static void latchDone(IoRequest* req)
+{
+  IoLatch* latch = (IoLatch*) req->arg;
+
+  pthread_mutex_lock(&latch->lock);
+  if (--latch->remaining == 0) pthread_cond_signal(&latch->zero);
+  pthread_mutex_unlock(&latch->lock);
+}
+
+// run a request synchronously
+static void runRequest(IoRequest* req)
+{
+  ssize_t rc;
+
+  if (req->op == IoRequest::READ) {
+    rc = ::pread(req->fd, req->buffer, req->size, req->offset);
+  } else {
+    rc = ::pwrite(req->fd, req->buffer, req->size, req->offset);
+  }
+  req->result = (rc < 0) ? -errno : rc;
+}
+
+IoQueue::IoQueue()
+{
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&slotFree, NULL);
+  pthread_cond_init(&workReady, NULL);
+  started = false;
+  stopping = false;
+  ringFd = -1;
+  ringBroken = false;
+  inflight = 0;
+  reaping = false;
+  workerCount = 0;
+}
+
+IoQueue::~IoQueue()
+{
+  if (started) {
+#ifdef USE_IO_URING
+    if (ringFd >= 0) {
+      // a request without a completion callback tells the reaper to quit.
+      // after a failure of the ring, the reaper quits by itself once the
+      // kernel has completed the requests it took
+      IoRequest stop;
+      memset(&stop, 0, sizeof(stop));
+      stop.fd = -1;
+      ringSubmit(&stop, 1);
+
+      pthread_mutex_lock(&lock);
+      while (ringBroken && reaping && inflight > 0) pthread_cond_wait(&slotFree, &lock);
+      bool stuck = ringBroken && reaping;
+      pthread_mutex_unlock(&lock);
+
+      if (stuck) {
+        // the reaper waits on a ring that completes nothing anymore.
+        // it keeps the ring, since nothing can wake it
+        pthread_detach(reaper);
+      } else {
+        pthread_join(reaper, NULL);
+        ::munmap(sqes, sqesSize);
+        if (cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+        ::munmap(sqRing, sqRingSize);
+        ::close(ringFd);
+      }
+    }
+#endif
+    if (workerCount > 0) {
+      pthread_mutex_lock(&lock);
+      stopping = true;
+      pthread_cond_broadcast(&workReady);
+      pthread_mutex_unlock(&lock);
+      for (int i = 0; i < workerCount; i++) pthread_join(workers[i], NULL);
+    }
+  }
+
+  pthread_cond_destroy(&workReady);
+  pthread_cond_destroy(&slotFree);
+  pthread_mutex_destroy(&lock);
+}
+
+void IoQueue::start()
+{
+  pthread_mutex_lock(&lock);
+  if (!started) {
+    started = true;
+    if (!setupRing()) startThreads();
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+bool IoQueue::usingRing()
+{
+  start();
+  return ringFd >= 0 && !ringBroken;
+}
+
+void IoQueue::submit(IoRequest* reqs, int n)
+{
+  if (n <= 0) return;
+  start();
+
+  if (ringFd >= 0) {
+    ringSubmit(reqs, n);
+    return;
+  }
+  threadSubmit(reqs, n);
+}
+
+void IoQueue::submitAndWait(IoRequest* reqs, int n)
+{
+  IoLatch latch;
+
+  if (n <= 0) return;
+
+  // a single request is not worth the round trip
+  if (n == 1) {
+    runRequest(reqs);
+    return;
+  }
+
+  pthread_mutex_init(&latch.lock, NULL);
+  pthread_cond_init(&latch.zero, NULL);
+  latch.remaining = n;
+
+  for (int i = 0; i < n; i++) {
+    reqs[i].done = latchDone;
+    reqs[i].arg = &latch;
+  }
+  submit(reqs, n);
+
+  pthread_mutex_lock(&latch.lock);
+  while (latch.remaining > 0) pthread_cond_wait(&latch.zero, &latch.lock);
+  pthread_mutex_unlock(&latch.lock);
+
+  pthread_mutex_destroy(&latch.lock);
+  pthread_cond_destroy(&latch.zero);
+}
+
+//
+// io_uring back end
+//
+
+#ifdef USE_IO_URING
+
+static int ringSetup(unsigned entries, struct io_uring_params* p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+bool IoQueue::setupRing()
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  int fd = ringSetup(QUEUE_DEPTH, &p);
+  if (fd < 0) return false;
+
+  // IORING_OP_READ/WRITE came with the kernels that
+  // report IORING_FEAT_FAST_POLL
+  if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_FAST_POLL)) {
+    ::close(fd);
+    return false;
+  }
+
+  sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+    cqRingSize = sqRingSize;
+  }
+
+  sqRing = ::mmap(NULL, sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) { ::close(fd); return false; }
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cqRing = sqRing;
+  } else {
+    cqRing = ::mmap(NULL, cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) { ::munmap(sqRing, sqRingSize); ::close(fd); return false; }
+  }
+
+  sqes = ::mmap(NULL, sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+    ::munmap(sqRing, sqRingSize);
+    ::close(fd);
+    return false;
+  }
+
+  char* sq = (char*) sqRing;
+  char* cq = (char*) cqRing;
+  sqHead  = (unsigned*) (sq + p.sq_off.head);
+  sqTail  = (unsigned*) (sq + p.sq_off.tail);
+  sqMask  = (unsigned*) (sq + p.sq_off.ring_mask);
+  sqArray = (unsigned*) (sq + p.sq_off.array);
+  cqHead  = (unsigned*) (cq + p.cq_off.head);
+  cqTail  = (unsigned*) (cq + p.cq_off.tail);
+  cqMask  = (unsigned*) (cq + p.cq_off.ring_mask);
+  cqes    = cq + p.cq_off.cqes;
+  sqEntries = p.sq_entries;
+  cqEntries = p.cq_entries;
+
+  // a request is known in the rings by its slot
+  ringSlots.assign(cqEntries, NULL);
+  freeSlots.clear();
+  for (unsigned i = cqEntries; i > 0; i--) freeSlots.push_back(i - 1);
+
+  ringFd = fd;
+  reaping = true;
+  if (pthread_create(&reaper, NULL, reapMain, this) != 0) {
+    ::munmap(sqes, sqesSize);
+    if (cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+    ::munmap(sqRing, sqRingSize);
+    ::close(fd);
+    ringFd = -1;
+    reaping = false;
+    return false;
+  }
+
+  return true;
+}
+
+void IoQueue::ringSubmit(IoRequest* reqs, int n)
+{
+  struct io_uring_sqe* sqeArray = (struct io_uring_sqe*) sqes;
+  std::vector<IoRequest*> orphans;
+  int i = 0;
+
+  pthread_mutex_lock(&lock);
+
+  while (i < n && !ringBroken) {
+    // fill as many submission entries as the rings have room for.
+    // entries of other threads may still wait for the kernel
+    unsigned tail = *sqTail;
+    unsigned room = sqEntries - (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+    unsigned count = 0;
+    while (i < n && count < room && inflight < cqEntries) {
+      IoRequest* req = &reqs[i++];
+      unsigned idx = (tail + count) & *sqMask;
+      struct io_uring_sqe* sqe = &sqeArray[idx];
+      unsigned slot = freeSlots.back();
+
+      freeSlots.pop_back();
+      ringSlots[slot] = req;
+
+      memset(sqe, 0, sizeof(*sqe));
+      if (req->done == NULL) {
+        sqe->opcode = IORING_OP_NOP;
+      } else {
+        sqe->opcode = (req->op == IoRequest::READ) ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = req->fd;
+        sqe->addr = (unsigned long) req->buffer;
+        sqe->len = req->size;
+        sqe->off = req->offset;
+      }
+      sqe->user_data = slot;
+      sqArray[idx] = idx;
+
+      count++;
+      inflight++;
+    }
+
+    if (count == 0) {
+      // every slot is taken. wait for the reaper.
+      pthread_cond_wait(&slotFree, &lock);
+      continue;
+    }
+    __atomic_store_n(sqTail, tail + count, __ATOMIC_RELEASE);
+    enterAll(orphans);
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  // the ring failed. the requests it gave back and the ones it never got
+  // go to the thread pool, or are run here if it has no thread
+  for (unsigned k = 0; k < orphans.size(); k++) {
+    runRequest(orphans[k]);
+    orphans[k]->done(orphans[k]);
+  }
+  if (i < n) threadSubmit(&reqs[i], n - i);
+}
+
+void IoQueue::enterAll(std::vector<IoRequest*>& orphans)
+{
+  // hand the published entries to the kernel. called with the lock held.
+  // only this function makes the kernel consume entries, so the head
+  // only moves while one thread holds the lock here
+  for (;;) {
+    unsigned left = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (left == 0 || ringBroken) return;
+
+    if (ringEnter(ringFd, left, 0, 0) >= 0 || errno == EINTR) continue;
+    if (errno != EAGAIN && errno != EBUSY) {
+      ringFailed(orphans);
+      return;
+    }
+
+    // the kernel is short of memory for requests or of room for
+    // completions, and both come back as completions are reaped.
+    // wait for them, or give way to the reaper if we have none out
+    if (inflight > left) {
+      pthread_cond_wait(&slotFree, &lock);
+    } else {
+      pthread_mutex_unlock(&lock);
+      sched_yield();
+      pthread_mutex_lock(&lock);
+    }
+  }
+}
+
+void IoQueue::ringFailed(std::vector<IoRequest*>& orphans)
+{
+  struct io_uring_sqe* sqeArray = (struct io_uring_sqe*) sqes;
+
+  // called with the lock held. from now on requests go to the thread pool
+  if (ringBroken) return;
+  ringBroken = true;
+  startThreads();
+
+  // take back the entries the kernel has not consumed, or a later
+  // io_uring_enter() could still run them. their requests are handed to
+  // the workers, or to the caller if no worker could be started
+  unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  for (unsigned t = head; t != *sqTail; t++) {
+    unsigned slot = (unsigned) sqeArray[sqArray[t & *sqMask]].user_data;
+    IoRequest* req = ringSlots[slot];
+
+    ringSlots[slot] = NULL;
+    freeSlots.push_back(slot);
+    inflight--;
+    if (req->done == NULL) continue;
+    if (workerCount > 0) pending.push_back(req);
+    else orphans.push_back(req);
+  }
+  __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+
+  pthread_cond_broadcast(&workReady);
+  pthread_cond_broadcast(&slotFree);
+}
+
+void* IoQueue::reapMain(void* arg)
+{
+  ((IoQueue*) arg)->reap();
+  return NULL;
+}
+
+void IoQueue::reap()
+{
+  struct io_uring_cqe* cqeArray = (struct io_uring_cqe*) cqes;
+  std::vector<unsigned> reaped;
+  std::vector<IoRequest*> orphans;
+  std::vector<IoRequest*> lost;
+  bool stop = false;
+  int error = 0;
+
+  while (!stop) {
+    if (ringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+      if (errno == EAGAIN || errno == EBUSY) sched_yield();
+      else if (errno != EINTR) error = errno;
+    }
+
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe* cqe = &cqeArray[head & *cqMask];
+      unsigned slot = (unsigned) cqe->user_data;
+      IoRequest* req = ringSlots[slot];
+
+      reaped.push_back(slot);
+      if (req->done == NULL) {
+        stop = true;
+        continue;
+      }
+      req->result = cqe->res;
+      req->done(req);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&lock);
+    for (unsigned i = 0; i < reaped.size(); i++) {
+      ringSlots[reaped[i]] = NULL;
+      freeSlots.push_back(reaped[i]);
+    }
+    inflight -= reaped.size();
+    reaped.clear();
+
+    if (error != 0) {
+      // the ring cannot be waited on anymore. the requests the kernel
+      // still has are failed, the others go to the thread pool
+      ringFailed(orphans);
+      for (unsigned slot = 0; slot < ringSlots.size(); slot++) {
+        if (ringSlots[slot] == NULL) continue;
+        if (ringSlots[slot]->done != NULL) lost.push_back(ringSlots[slot]);
+        ringSlots[slot] = NULL;
+        freeSlots.push_back(slot);
+      }
+      inflight = 0;
+    }
+
+    // a failed ring is left once the kernel has completed its requests
+    if (ringBroken && inflight == 0) stop = true;
+    if (stop) reaping = false;
+    pthread_cond_broadcast(&slotFree);
+    pthread_mutex_unlock(&lock);
+  }
+
+  for (unsigned i = 0; i < orphans.size(); i++) {
+    runRequest(orphans[i]);
+    orphans[i]->done(orphans[i]);
+  }
+  for (unsigned i = 0; i < lost.size(); i++) {
+    lost[i]->result = -error;
+    lost[i]->done(lost[i]);
+  }
+}
+
+#else  // !USE_IO_URING
+
+bool IoQueue::setupRing()
+{
+  return false;
+}
+
+void IoQueue::ringSubmit(IoRequest* reqs, int n)
+{
+}
+
+void* IoQueue::reapMain(void* arg)
+{
+  return NULL;
+}
+
+void IoQueue::reap()
+{
+}
+
+#endif // USE_IO_URING
+
+//
+// thread pool back end
+//
+
+void IoQueue::threadSubmit(IoRequest* reqs, int n)
+{
+  pthread_mutex_lock(&lock);
+  if (workerCount > 0) {
+    for (int i = 0; i < n; i++) {
+      if (reqs[i].done != NULL) pending.push_back(&reqs[i]);
+    }
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  pthread_mutex_unlock(&lock);
+
+  // without a worker thread, the requests are run right here
+  for (int i = 0; i < n; i++) {
+    if (reqs[i].done == NULL) continue;
+    runRequest(&reqs[i]);
+    reqs[i].done(&reqs[i]);
+  }
+}
+
+void IoQueue::startThreads()
+{
+  // make do with the workers that could be started
+  while (workerCount < THREAD_COUNT) {
+    if (pthread_create(&workers[workerCount], NULL, workerMain, this) != 0) break;
+    workerCount++;
+  }
+}
+
+void* IoQueue::workerMain(void* arg)
+{
+  ((IoQueue*) arg)->work();
+  return NULL;
+}
+
+void IoQueue::work()
+{
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (pending.empty() && !stopping) pthread_cond_wait(&workReady, &lock);
+    if (pending.empty()) break;
+
+    IoRequest* req = pending.front();
+    pending.pop_front();
+
+    pthread_mutex_unlock(&lock);
+    runRequest(req);
+    req->done(req);
+    pthread_mutex_lock(&lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef IOQUEUE_H
+#define IOQUEUE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <deque>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * one asynchronous read or write of a file region.
+ */
+struct IoRequest {
+  enum Op { READ, WRITE } op;
+  int     fd;         // the file to read from or write to
+  void*   buffer;     // the memory to read into or write from
+  size_t  size;       // # of bytes to transfer
+  off_t   offset;     // file offset of the transfer
+  ssize_t result;     // # of bytes transferred, or -errno. set on completion
+
+  /**
+   * called once the request completes, possibly on another thread.
+   * the request must stay valid until then.
+   */
+  void  (*done)(IoRequest* req);
+  void*   arg;        // free for use by the completion callback
+};
+
+/**
+ * keeps many reads and writes in flight at once.
+ * requests go to an io_uring when the kernel supports it, and to a small
+ * pool of threads doing plain pread()/pwrite() otherwise, or once the
+ * ring has failed.
+ */
+class IoQueue {
+ public:
+
+  static const int QUEUE_DEPTH = 128;    // # of io_uring submission entries
+  static const int THREAD_COUNT = 8;     // # of threads of the fallback pool
+
+  IoQueue();
+  ~IoQueue();
+
+  /**
+   * start the requests and return without waiting for them.
+   * req->done(req) is called for each request when it completes.
+   * @param reqs[IN] the requests to start
+   * @param n[IN] the number of requests
+   */
+  void submit(IoRequest* reqs, int n);
+
+  /**
+   * start the requests and wait until all of them complete.
+   * the done and arg fields of the requests are overwritten.
+   * @param reqs[IN/OUT] the requests to run. result is set on return
+   * @param n[IN] the number of requests
+   */
+  void submitAndWait(IoRequest* reqs, int n);
+
+  /**
+   * @return true if requests go to an io_uring
+   */
+  bool usingRing();
+
+ private:
+  void start();
+
+  // io_uring back end
+  bool setupRing();
+  void ringSubmit(IoRequest* reqs, int n);
+  void enterAll(std::vector<IoRequest*>& orphans);
+  void ringFailed(std::vector<IoRequest*>& orphans);
+  static void* reapMain(void* arg);
+  void reap();
+
+  // thread pool back end
+  void threadSubmit(IoRequest* reqs, int n);
+  void startThreads();
+  static void* workerMain(void* arg);
+  void work();
+
+  pthread_mutex_t lock;
+  bool            started;    // back end is set up lazily on first use
+  bool            stopping;
+
+  // io_uring state
+  int       ringFd;           // -1 if the thread pool is used
+  bool      ringBroken;       // the ring failed, and requests go to the thread pool
+  unsigned  sqEntries;
+  unsigned  cqEntries;
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  void*     sqes;
+  void*     cqes;
+  void*     sqRing;
+  void*     cqRing;
+  size_t    sqRingSize;
+  size_t    cqRingSize;
+  size_t    sqesSize;
+  unsigned  inflight;         // # of requests submitted but not reaped
+  std::vector<IoRequest*> ringSlots;  // the request of each slot in flight. NULL if free
+  std::vector<unsigned>   freeSlots;  // the free slots, by index
+  pthread_cond_t  slotFree;   // signaled when inflight drops
+  pthread_t       reaper;
+  bool            reaping;    // whether the reaper is still running
+
+  // thread pool state
+  std::deque<IoRequest*> pending;
+  pthread_cond_t  workReady;
+  pthread_t       workers[THREAD_COUNT];
+  int             workerCount;  // # of workers started. 0 runs requests on the caller's thread
+};
+
+#endif // IOQUEUE_H
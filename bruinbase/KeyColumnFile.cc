@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include "Bruinbase.h"
+#include "KeyColumnFile.h"
+
+using std::string;
+
+// the keys start on page 1, behind the FileHeader on page 0
+static const PageId KEY_BASE = 1;
+
+KeyColumnFile::KeyColumnFile()
+{
+  epid = 0;
+  lastCount = 0;
+}
+
+RC KeyColumnFile::open(const string& filename, char mode)
+{
+  RC         rc;
+  PageHandle page;
+  FileHeader header;
+
+  if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  if (pf.endPid() == 0) {
+    // a new file. write the header if we are allowed to
+    if (mode == 'w' || mode == 'W') {
+      header.magic = FILE_MAGIC;
+      header.version = FILE_VERSION;
+      header.pageSize = PageFile::PAGE_SIZE;
+      if ((rc = PageFile::newPage(page)) < 0) goto fail;
+      memcpy(page.data(), &header, sizeof(header));
+      if ((rc = pf.write(0, page)) < 0) goto fail;
+      page.release();
+    }
+    epid = 0;
+    lastCount = 0;
+    return 0;
+  }
+
+  if ((rc = pf.pin(0, page)) < 0) goto fail;
+  memcpy(&header, page.data(), sizeof(header));
+  page.release();
+  if (header.magic != FILE_MAGIC || header.version > FILE_VERSION ||
+      header.pageSize != PageFile::PAGE_SIZE) {
+    rc = RC_INVALID_FILE_FORMAT;
+    goto fail;
+  }
+
+  // the last page may have room for more keys
+  epid = pf.endPid() - KEY_BASE;
+  lastCount = 0;
+  if (epid > 0) {
+    if ((rc = pf.pin(epid - 1 + KEY_BASE, page)) < 0) goto fail;
+    memcpy(&lastCount, page.data(), sizeof(int));
+    if (lastCount < 0 || lastCount > KEYS_PER_PAGE) {
+      rc = RC_INVALID_FILE_FORMAT;
+      goto fail;
+    }
+  }
+  return 0;
+
+ fail:
+  page.release();
+  epid = 0;
+  lastCount = 0;
+  pf.close();
+  return rc;
+}
+
+RC KeyColumnFile::close()
+{
+  epid = 0;
+  lastCount = 0;
+  return pf.close();
+}
+
+RC KeyColumnFile::append(int key)
+{
+  RC         rc;
+  PageHandle page;
+
+  // a full last page, or none, means a new page of zeros
+  if (epid == 0 || lastCount == KEYS_PER_PAGE) {
+    if ((rc = PageFile::newPage(page)) < 0) return rc;
+    epid++;
+    lastCount = 0;
+  } else {
+    if ((rc = pf.pin(epid - 1 + KEY_BASE, page)) < 0) return rc;
+  }
+
+  memcpy(page.data() + sizeof(int) * (1 + lastCount), &key, sizeof(int));
+  lastCount++;
+  memcpy(page.data(), &lastCount, sizeof(int));
+
+  return pf.write(epid - 1 + KEY_BASE, page);
+}
+
+RC KeyColumnFile::readPage(PageId pid, int keys[], int& count) const
+{
+  RC         rc;
+  PageHandle page;
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+  if ((rc = pf.pin(pid + KEY_BASE, page)) < 0) return rc;
+
+  memcpy(&count, page.data(), sizeof(int));
+  if (count < 0 || count > KEYS_PER_PAGE) return RC_INVALID_FILE_FORMAT;
+  memcpy(keys, page.data() + sizeof(int), count * sizeof(int));
+
+  return 0;
+}
+
+long long KeyColumnFile::getKeyCount() const
+{
+  if (epid == 0) return 0;
+  return (long long) (epid - 1) * KEYS_PER_PAGE + lastCount;
+}
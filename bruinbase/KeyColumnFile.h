@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef KEYCOLUMNFILE_H
+#define KEYCOLUMNFILE_H
+
+#include <string>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * the key column of a table stored by LOAD ... WITH COLUMNS.
+ * it holds the keys of the table file once more, packed in the order of
+ * the records, so that a query that references no value reads a few
+ * pages of keys instead of every page of the table.
+ */
+class KeyColumnFile {
+ public:
+  // number of keys per page. the first four bytes of a page hold the count
+  static const int KEYS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int)) / sizeof(int);
+
+  // identifies a key column file in its FileHeader on page 0
+  static const int FILE_MAGIC = 0x4c4f4342;   // "BCOL"
+
+  // the current format version of key column files
+  static const int FILE_VERSION = 1;
+
+  KeyColumnFile();
+
+  /**
+   * open a file in read or write mode.
+   * when opened in 'w' mode, if the file does not exist, it is created.
+   * 'm' mode is read-only and memory-maps the file (see PageFile::open).
+   * @param filename[IN] the name of the file to open
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode);
+
+  /**
+   * close the file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * append a key at the end of the column.
+   * @param key[IN] the key of the record appended to the table
+   * @return error code. 0 if no error
+   */
+  RC append(int key);
+
+  /**
+   * read the keys of a page of the column.
+   * @param pid[IN] the page to read. the first page of keys is 0
+   * @param keys[OUT] the keys, room for KEYS_PER_PAGE of them
+   * @param count[OUT] the number of keys on the page
+   * @return error code. 0 if no error
+   */
+  RC readPage(PageId pid, int keys[], int& count) const;
+
+  /**
+   * @return the number of pages of keys
+   */
+  PageId getPageCount() const { return epid; }
+
+  /**
+   * @return the number of keys in the column
+   */
+  long long getKeyCount() const;
+
+  /**
+   * tell the operating system how the column is going to be read.
+   * @param pattern[IN] the access pattern
+   * @return error code. 0 if no error
+   */
+  RC setAccessPattern(PageFile::AccessPattern pattern) { return pf.setAccessPattern(pattern); }
+
+  /**
+   * @return the I/O statistics of the file since it was last opened
+   */
+  const IoStats& getStats() const { return pf.getStats(); }
+
+ private:
+  PageFile pf;        // the PageFile used to store the keys
+  PageId   epid;      // the number of pages of keys
+  int      lastCount; // the number of keys on the last page
+};
+
+#endif // KEYCOLUMNFILE_H
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "KeySearch.h"
+#include <strings.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(BRUINBASE_NO_SIMD)
+#define USE_SIMD
+#include <immintrin.h>
+#endif
+
+// the scalar fallback: stop at the first key that is not smaller
+static int linearSearch(const int* keys, int stride, int n, int key)
+{
+  int i;
+  for (i = 0; i < n && keys[i * stride] < key; i++);
+  return i;
+}
+
+//
+// halve the range [base, base + n keys) until at most limit keys are left.
+// the comparison only picks the next base, which compiles to a conditional
+// move, so there is no branch to mispredict. the answer stays within
+// [base, base + n] throughout.
+//
+static inline const int* narrow(const int* base, int stride, int& n, int key, int limit)
+{
+  while (n > limit) {
+    int half = n / 2;
+    base = (base[half * stride] < key) ? base + half * stride : base;
+    n -= half;
+  }
+  return base;
+}
+
+static int binarySearch(const int* keys, int stride, int n, int key)
+{
+  if (n == 0) return 0;
+  const int* base = narrow(keys, stride, n, key, 1);
+  return (base - keys) / stride + (*base < key);
+}
+
+#ifdef USE_SIMD
+
+//
+// the SIMD strategies narrow the range down to BLOCK_KEYS keys and then
+// compare a window of exactly BLOCK_KEYS keys that covers it. the window
+// is moved back when it would run past the last key. that is harmless,
+// since every key before the range is smaller than the search key and
+// every key after it is not. the smaller keys of the window are counted
+// in vector registers, and the order of the lanes does not matter.
+//
+
+static inline int windowStart(const int* keys, const int* base, int stride, int n)
+{
+  int start = (base - keys) / stride;
+  return (start < n - KeySearch::BLOCK_KEYS) ? start : n - KeySearch::BLOCK_KEYS;
+}
+
+// load four keys into a vector
+static inline __m128i sseLoad(const int* p, int stride)
+{
+  if (stride == 1) return _mm_loadu_si128((const __m128i*) p);
+  if (stride == 2) {
+    // take the even ints of two vectors of (key, payload) pairs
+    __m128 lo = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*) p));
+    __m128 hi = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*) (p + 4)));
+    return _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+  }
+  return _mm_setr_epi32(p[0], p[stride], p[2 * stride], p[3 * stride]);
+}
+
+static int sseSearch(const int* keys, int stride, int n, int key)
+{
+  if (n < KeySearch::BLOCK_KEYS) return binarySearch(keys, stride, n, key);
+
+  int total = n;
+  const int* base = narrow(keys, stride, n, key, KeySearch::BLOCK_KEYS);
+  int start = windowStart(keys, base, stride, total);
+  const int* p = keys + start * stride;
+
+  // a smaller key makes its lane -1, so subtracting the comparison counts it
+  __m128i k = _mm_set1_epi32(key);
+  __m128i count = _mm_setzero_si128();
+  for (int i = 0; i < KeySearch::BLOCK_KEYS; i += 4) {
+    count = _mm_sub_epi32(count, _mm_cmpgt_epi32(k, sseLoad(p + i * stride, stride)));
+  }
+  count = _mm_add_epi32(count, _mm_shuffle_epi32(count, _MM_SHUFFLE(1, 0, 3, 2)));
+  count = _mm_add_epi32(count, _mm_shuffle_epi32(count, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  return start + _mm_cvtsi128_si32(count);
+}
+
+// load eight keys into a vector
+__attribute__((target("avx2")))
+static inline __m256i avx2Load(const int* p, int stride)
+{
+  if (stride == 1) return _mm256_loadu_si256((const __m256i*) p);
+  if (stride == 2) {
+    __m256 lo = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*) p));
+    __m256 hi = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*) (p + 8)));
+    return _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+  }
+  __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                     _mm256_set1_epi32(stride));
+  return _mm256_i32gather_epi32(p, index, sizeof(int));
+}
+
+__attribute__((target("avx2")))
+static int avx2Search(const int* keys, int stride, int n, int key)
+{
+  if (n < KeySearch::BLOCK_KEYS) return binarySearch(keys, stride, n, key);
+
+  int total = n;
+  const int* base = narrow(keys, stride, n, key, KeySearch::BLOCK_KEYS);
+  int start = windowStart(keys, base, stride, total);
+  const int* p = keys + start * stride;
+
+  __m256i k = _mm256_set1_epi32(key);
+  __m256i count = _mm256_setzero_si256();
+  for (int i = 0; i < KeySearch::BLOCK_KEYS; i += 8) {
+    count = _mm256_sub_epi32(count, _mm256_cmpgt_epi32(k, avx2Load(p + i * stride, stride)));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  return start + _mm_cvtsi128_si32(sum);
+}
+
+#endif // USE_SIMD
+
+// the function of a strategy. NULL if it is not available
+static KeySearch::SearchFunction functionOf(KeySearch::Strategy s)
+{
+  switch (s) {
+  case KeySearch::LINEAR:
+    return linearSearch;
+  case KeySearch::BINARY:
+    return binarySearch;
+#ifdef USE_SIMD
+  case KeySearch::SSE:
+    return sseSearch;
+  case KeySearch::AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? avx2Search : NULL;
+#endif
+  default:
+    return NULL;
+  }
+}
+
+//
+// the default strategy. the keys of a node are contiguous, so AVX2 loads
+// a block of them at once and is at least as fast as the branch-free
+// binary search. SSE compares too few keys per instruction to gain on it.
+//
+static KeySearch::Strategy bestStrategy()
+{
+  if (functionOf(KeySearch::AVX2) != NULL) return KeySearch::AVX2;
+  return KeySearch::BINARY;
+}
+
+KeySearch::Strategy KeySearch::strategy = bestStrategy();
+KeySearch::SearchFunction KeySearch::search = functionOf(KeySearch::strategy);
+
+bool KeySearch::setStrategy(Strategy s)
+{
+  SearchFunction f = functionOf(s);
+  if (f == NULL) return false;
+
+  strategy = s;
+  search = f;
+  return true;
+}
+
+static const char* strategyNames[] = { "linear", "binary", "sse", "avx2" };
+
+bool KeySearch::parse(const char* name, Strategy& s)
+{
+  for (int i = 0; i < (int)(sizeof(strategyNames) / sizeof(strategyNames[0])); i++) {
+    if (strcasecmp(name, strategyNames[i]) == 0) {
+      s = (Strategy) i;
+      return true;
+    }
+  }
+  return false;
+}
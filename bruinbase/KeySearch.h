@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include <climits>
+
+/**
+ * searches the sorted keys of a B+tree node.
+ * the keys are ints, stride ints apart, so that they can sit in an array
+ * of (key, payload) pairs. several strategies are built in:
+ *  - LINEAR: scan the keys in order until one is not smaller
+ *  - BINARY: binary search without data-dependent branches
+ *  - SSE:    binary search down to a block of keys, then compare the
+ *            whole block with SSE2 and count the smaller keys
+ *  - AVX2:   the same with AVX2
+ * the SIMD strategies are compiled on x86 only, and not at all with
+ * -DBRUINBASE_NO_SIMD. AVX2 is used by default if the CPU has it, and
+ * BINARY otherwise.
+ */
+class KeySearch {
+ public:
+  enum Strategy { LINEAR, BINARY, SSE, AVX2 };
+
+  static const int BLOCK_KEYS = 16;  // keys compared at once by SSE and AVX2
+
+  /**
+   * @param keys[IN] the first key
+   * @param stride[IN] the distance between two keys in ints
+   * @param n[IN] the number of keys
+   * @param key[IN] the key to search for
+   * @return the number of keys smaller than key, which is the position
+   *         of the first key that is not smaller
+   */
+  static int countLess(const int* keys, int stride, int n, int key)
+  {
+    return search(keys, stride, n, key);
+  }
+
+  /**
+   * @return the number of keys smaller than or equal to key
+   */
+  static int countLessEqual(const int* keys, int stride, int n, int key)
+  {
+    return (key == INT_MAX) ? n : search(keys, stride, n, key + 1);
+  }
+
+  /**
+   * choose the search strategy.
+   * @param s[IN] the strategy
+   * @return false if the strategy is not built in or the CPU lacks it
+   */
+  static bool setStrategy(Strategy s);
+
+  /**
+   * @return the strategy in use
+   */
+  static Strategy getStrategy() { return strategy; }
+
+  /**
+   * look up a strategy by the name given on the command line.
+   * @param name[IN] "linear", "binary", "sse" or "avx2"
+   * @param s[OUT] the strategy
+   * @return true if the name is known
+   */
+  static bool parse(const char* name, Strategy& s);
+
+  typedef int (*SearchFunction)(const int* keys, int stride, int n, int key);
+
+ private:
+  static SearchFunction search;   // the function of the strategy in use
+  static Strategy strategy;
+};
+
+#endif // KEYSEARCH_H
@@ -9,31 +9,188 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "BufferPool.h"
+#include "IoQueue.h"
+#include <cerrno>
 #include <cstring>
+#include <climits>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
 using std::string;
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+// the current time in microseconds, for latency statistics
+static long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void IoStats::clear()
+{
+  reads = writes = 0;
+  cacheHits = cacheMisses = evictions = 0;
+  bytesRead = bytesWritten = 0;
+  memset(readLatency, 0, sizeof(readLatency));
+  memset(writeLatency, 0, sizeof(writeLatency));
+}
+
+void IoStats::add(const IoStats& other)
+{
+  reads += other.reads;
+  writes += other.writes;
+  cacheHits += other.cacheHits;
+  cacheMisses += other.cacheMisses;
+  evictions += other.evictions;
+  bytesRead += other.bytesRead;
+  bytesWritten += other.bytesWritten;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    readLatency[i] += other.readLatency[i];
+    writeLatency[i] += other.writeLatency[i];
+  }
+}
+
+int IoStats::bucketOf(long long usec)
+{
+  int bucket = 0;
+  while (usec > 0 && bucket < LATENCY_BUCKETS - 1) {
+    usec >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+IoStats PageFile::totals;
+BufferPool PageFile::cache;
+IoQueue PageFile::io;
+bool PageFile::writeBack = true;
+bool PageFile::directIO = false;
 
 PageFile::PageFile() 
 { 
   fd = -1; 
+  fid = 0;
   epid = 0; 
+  writable = false;
+  map = NULL;
+  direct = false;
+  pattern = NORMAL;
+  dirtyPages = 0;
+  raPending = 0;
+  pthread_mutex_init(&raLock, NULL);
+  pthread_cond_init(&raIdle, NULL);
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
+  fid = 0;
   epid = 0;
+  writable = false;
+  map = NULL;
+  direct = false;
+  pattern = NORMAL;
+  dirtyPages = 0;
+  raPending = 0;
+  pthread_mutex_init(&raLock, NULL);
+  pthread_cond_init(&raIdle, NULL);
   open(filename.c_str(), mode);
 }
 
+PageFile::~PageFile()
+{
+  // the page cache must not keep pointing to a file that is gone
+  if (fd > 0) close();
+  pthread_cond_destroy(&raIdle);
+  pthread_mutex_destroy(&raLock);
+}
+
+// the buffer to bounce an unaligned page through for direct I/O
+#define ALIGNED_PAGE(name) char name[PageFile::PAGE_SIZE] __attribute__((aligned(PageFile::IO_ALIGN)))
+
+static bool isAligned(const void* buffer)
+{
+  return ((unsigned long) buffer) % PageFile::IO_ALIGN == 0;
+}
+
+#ifdef O_DIRECT
+// check whether the file can do direct I/O of our pages.
+// without the answer from statx(), assume the common 512-byte rule.
+static bool directAligned(int fd)
+{
+#ifdef STATX_DIOALIGN
+  struct statx stx;
+
+  if (::statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN)) {
+    if (stx.stx_dio_offset_align == 0) return false;
+    return PageFile::PAGE_SIZE % stx.stx_dio_offset_align == 0 &&
+           PageFile::IO_ALIGN % stx.stx_dio_mem_align == 0;
+  }
+#endif
+  return PageFile::PAGE_SIZE % 512 == 0;
+}
+#endif
+
+//
+// the page cache ids of the files opened so far, by device and inode.
+// the size and modification time tell if the file was changed behind
+// our back, which makes its cached pages useless.
+//
+struct FileIdentity {
+  int    fid;
+  off_t  size;
+  time_t mtime;
+  long   mtimeNsec;
+};
+
+static std::map<std::pair<dev_t, ino_t>, FileIdentity> fileIds;
+static pthread_mutex_t fileIdLock = PTHREAD_MUTEX_INITIALIZER;
+
+int PageFile::fileIdOf(const struct stat& st)
+{
+  std::pair<dev_t, ino_t> key(st.st_dev, st.st_ino);
+  int fid;
+
+  pthread_mutex_lock(&fileIdLock);
+  std::map<std::pair<dev_t, ino_t>, FileIdentity>::iterator it = fileIds.find(key);
+  if (it != fileIds.end() && it->second.size == st.st_size &&
+      it->second.mtime == st.st_mtim.tv_sec && it->second.mtimeNsec == st.st_mtim.tv_nsec) {
+    fid = it->second.fid;
+  } else {
+    // a new id leaves any stale pages to age out of the cache
+    fid = cache.newFileId();
+    FileIdentity& id = fileIds[key];
+    id.fid = fid;
+    id.size = st.st_size;
+    id.mtime = st.st_mtim.tv_sec;
+    id.mtimeNsec = st.st_mtim.tv_nsec;
+  }
+  pthread_mutex_unlock(&fileIdLock);
+
+  return fid;
+}
+
+void PageFile::rememberFile(int fid, const struct stat& st)
+{
+  pthread_mutex_lock(&fileIdLock);
+  FileIdentity& id = fileIds[std::make_pair(st.st_dev, st.st_ino)];
+  id.fid = fid;
+  id.size = st.st_size;
+  id.mtime = st.st_mtim.tv_sec;
+  id.mtimeNsec = st.st_mtim.tv_nsec;
+  pthread_mutex_unlock(&fileIdLock);
+}
+
 RC PageFile::open(const string& filename, char mode)
 {
   RC   rc;
@@ -46,6 +203,8 @@ RC PageFile::open(const string& filename, char mode)
   switch (mode) {
   case 'r':
   case 'R':
+  case 'm':
+  case 'M':
     oflag = O_RDONLY;
     break;
   case 'w':
@@ -56,125 +215,718 @@ RC PageFile::open(const string& filename, char mode)
     return RC_INVALID_FILE_MODE;
   }
 
+#ifdef O_DIRECT
+  // ask for direct I/O. a mapped file goes through the kernel cache anyway.
+  if (directIO && mode != 'm' && mode != 'M') oflag |= O_DIRECT;
+#endif
+
   // open the file
   fd = ::open(filename.c_str(), oflag, 0644);
+#ifdef O_DIRECT
+  if (fd < 0 && (oflag & O_DIRECT) && errno == EINVAL) {
+    // the file system does not support direct I/O at all
+    oflag &= ~O_DIRECT;
+    fd = ::open(filename.c_str(), oflag, 0644);
+  }
+#endif
   if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
 
+#ifdef O_DIRECT
+  // keep direct I/O only if our pages meet its alignment rules
+  direct = (oflag & O_DIRECT) && directAligned(fd);
+  if ((oflag & O_DIRECT) && !direct) ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+#else
+  direct = false;
+#endif
+
   // get the size of the file to set the end pid
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
+  if (statbuf.st_size % PAGE_SIZE != 0) { ::close(fd); fd = -1; return RC_INVALID_FILE_FORMAT; }
   epid = statbuf.st_size / PAGE_SIZE;
 
+  // an unchanged file finds the pages it left in the cache
+  fid = fileIdOf(statbuf);
+  writable = (oflag & O_RDWR) != 0;
+
+  // statistics are kept per open
+  stats.clear();
+
+  // no readahead until we see the file read in order
+  pattern = NORMAL;
+  raLast = -1;
+  raRun = 0;
+  raEnd = 0;
+  raWindow = 0;
+
+  // map the whole file in 'm' mode. if the file cannot be mapped,
+  // we simply fall back to reading it through the page cache.
+  if ((mode == 'm' || mode == 'M') && epid > 0) {
+    void* addr = ::mmap(NULL, (size_t)epid * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) map = (char*) addr;
+  }
+
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
-
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
+  // write out the dirty pages. the file is closed even if this fails.
+  rc = flush();
+
+  // let the background reads of the file finish
+  waitReads();
+
+  if (map != NULL) {
+    ::munmap(map, (size_t)epid * PAGE_SIZE);
+    map = NULL;
   }
 
+  // the cached pages stay for the next open of the file, which must
+  // recognize the file as we leave it
+  struct stat statbuf;
+  if (writable && ::fstat(fd, &statbuf) == 0) rememberFile(fid, statbuf);
+  cache.detach(this);
+
+  // close the file
+  if (::close(fd) < 0) rc = RC_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
+  fid = 0;
+  epid = 0;
+  writable = false;
+  direct = false;
+  std::vector<BufferFrame*>().swap(flushFrames);
+  return rc;
+}
+
+RC PageFile::discard()
+{
+  RC rc = 0;
+
+  if (fd <= 0) return RC_FILE_CLOSE_FAILED;
+
+  // let the background reads of the file finish
+  waitReads();
+
+  if (map != NULL) {
+    ::munmap(map, (size_t)epid * PAGE_SIZE);
+    map = NULL;
+  }
+
+  // nothing of the file is worth keeping, dirty pages included
+  cache.invalidateFile(fid);
+
+  if (::close(fd) < 0) rc = RC_FILE_CLOSE_FAILED;
+
+  fd = -1; 
+  fid = 0;
   epid = 0;
+  writable = false;
+  direct = false;
+  std::vector<BufferFrame*>().swap(flushFrames);
+  return rc;
+}
+
+static bool comparePid(const BufferFrame* f1, const BufferFrame* f2)
+{
+  return f1->pid < f2->pid;
+}
+
+RC PageFile::flush()
+{
+  RC rc = 0;
+
+  if (fd <= 0) return RC_FILE_WRITE_FAILED;
+  if (!writable) return 0;
+
+  // grab the dirty pages of this file and sort them by PageId.
+  // the array is allocated once and kept until the file is closed
+  std::vector<BufferPool::Frame*>& frames = flushFrames;
+  if (frames.size() != (size_t)cache.getFrameCount()) frames.resize(cache.getFrameCount());
+  int count = cache.collectDirty(fid, &frames[0]);
+  std::sort(frames.begin(), frames.begin() + count, comparePid);
+
+  // write each run of consecutive pages with a single pwritev()
+  for (int i = 0, j; i < count; i = j) {
+    for (j = i + 1; j < count && j - i < IOV_MAX; j++) {
+      if (frames[j]->pid != frames[j-1]->pid + 1) break;
+    }
+    if (writeRun(frames[i]->pid, &frames[i], j - i) < 0) {
+      // keep the pages dirty so that they are not lost
+      for (int k = i; k < j; k++) cache.markDirty(frames[k], this);
+      rc = RC_FILE_WRITE_FAILED;
+    }
+  }
+
+  for (int i = 0; i < count; i++) cache.unpin(frames[i]);
+
+  return rc;
+}
+
+RC PageFile::writeRun(PageId pid, BufferFrame** frames, int count)
+{
+  struct iovec iov[IOV_MAX];
+
+  for (int i = 0; i < count; i++) {
+    iov[i].iov_base = frames[i]->data;
+    iov[i].iov_len = PAGE_SIZE;
+  }
+
+  ssize_t size = (ssize_t)count * PAGE_SIZE;
+  long long start = now();
+  if (::pwritev(fd, iov, count, (off_t)pid * PAGE_SIZE) != size) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  countWrite(count, now() - start);
+
   return 0;
 }
 
-PageId PageFile::endPid() const 
+RC PageFile::setAccessPattern(AccessPattern pattern)
 {
-  return epid;
+  int advice;
+
+  if (fd <= 0) return RC_INVALID_FILE_MODE;
+
+  this->pattern = pattern;
+  raRun = 0;
+  raWindow = 0;
+  raEnd = 0;
+
+  if (map != NULL) {
+    switch (pattern) {
+    case SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+    case RANDOM:     advice = MADV_RANDOM; break;
+    default:         advice = MADV_NORMAL; break;
+    }
+    return (::madvise(map, (size_t)epid * PAGE_SIZE, advice) < 0) ? RC_INVALID_ATTRIBUTE : 0;
+  }
+
+  switch (pattern) {
+  case SEQUENTIAL: advice = POSIX_FADV_SEQUENTIAL; break;
+  case RANDOM:     advice = POSIX_FADV_RANDOM; break;
+  default:         advice = POSIX_FADV_NORMAL; break;
+  }
+  return (::posix_fadvise(fd, 0, 0, advice) != 0) ? RC_INVALID_ATTRIBUTE : 0;
 }
 
-RC PageFile::seek(PageId pid) const
+PageId PageFile::endPid() const 
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  return epid;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
-  if (pid < 0) return RC_INVALID_PID; 
+  RC   rc;
+  bool hit;
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+  if (pid < 0) return RC_INVALID_PID; 
+  if (!writable) return RC_FILE_WRITE_FAILED;
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  if (!writeBack) {
+    // write the buffer to the disk page
+    if ((rc = writePage(pid, buffer)) < 0) return rc;
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+    // if the page is in read cache, refresh the cached copy
+    BufferPool::Frame* frame = cache.find(fid, pid);
+    if (frame != NULL) {
+      if (frame->data != buffer) memcpy(frame->data, buffer, PAGE_SIZE);
+      cache.unpin(frame);
     }
+    return 0;
   }
 
-  // if the written pid >= end pid, update the end pid
+  // put the page in the cache. the whole page is overwritten,
+  // so a page that is not cached yet is not read from the disk
+  BufferPool::Frame* frame = cache.fetch(fid, pid, hit);
+  if (frame == NULL) {
+    // every frame of the shard is pinned. write around the cache.
+    return writePage(pid, buffer);
+  }
+
+  if (frame->data != buffer) memcpy(frame->data, buffer, PAGE_SIZE);
+  if (!hit) cache.complete(frame, this);
+  cache.markDirty(frame, this);
+  cache.unpin(frame);
+
+  return pageDirtied(pid);
+}
+
+RC PageFile::write(PageId pid, const PageHandle& handle)
+{
+  if (pid < 0) return RC_INVALID_PID; 
+  if (!handle.isPinned()) return RC_INVALID_ATTRIBUTE;
+
+  // the handle holds the cached page itself. nothing to copy.
+  if (handle.frame != NULL && handle.frame->fid == fid && handle.frame->pid == pid) {
+    if (!writable) return RC_FILE_WRITE_FAILED;
+    if (!writeBack) return writePage(pid, handle.page);
+
+    cache.markDirty(handle.frame, this);
+    return pageDirtied(pid);
+  }
+
+  return write(pid, handle.page);
+}
+
+RC PageFile::pageDirtied(PageId pid)
+{
+  // the page is on its way to the disk, so the file already ends after it
   if (pid >= epid) epid = pid + 1;
 
-  // increase page write count
-  writeCount++;
+  // under memory pressure, write out our dirty pages
+  if (cache.overDirtyLimit(dirtyPages)) return flush();
 
   return 0;
 }
 
 RC PageFile::read(PageId pid, void* buffer) const
 {
-  RC rc;
+  RC   rc;
+  bool hit;
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  // a mapped file is read straight from the mapping
+  if (map != NULL) {
+    memcpy(buffer, map + (size_t)pid * PAGE_SIZE, PAGE_SIZE);
+    return 0;
+  }
+
+  // pin the page in the cache. on a miss, the cache hands us
+  // an empty frame to read the page into
+  BufferPool::Frame* frame = cache.fetch(fid, pid, hit);
+  countLookup(hit);
+  if (frame == NULL) {
+    // every frame of the shard is pinned. read around the cache.
+    return readPage(pid, buffer);
+  }
+
+  if (!hit) {
+    if ((rc = readPage(pid, frame->data)) < 0) {
+      cache.abort(frame);
+      return rc;
+    }
+    cache.complete(frame, this);
+  }
+
+  memcpy(buffer, frame->data, PAGE_SIZE);
+  cache.unpin(frame);
+
+  readAhead(pid);
+
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, PageHandle& handle) const
+{
+  RC   rc;
+  bool hit;
 
+  handle.release();
   if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
 
-  //
-  // if the page is in cache, read it from there
-  //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
+  // a mapped page needs no frame. hand out the mapping itself.
+  if (map != NULL) {
+    handle.page = map + (size_t)pid * PAGE_SIZE;
+    return 0;
+  }
+
+  BufferPool::Frame* frame = cache.fetch(fid, pid, hit);
+  if (frame == NULL) return RC_BUFFER_FULL;
+  countLookup(hit);
+
+  if (!hit) {
+    if ((rc = readPage(pid, frame->data)) < 0) {
+      cache.abort(frame);
+      return rc;
+    }
+    cache.complete(frame, this);
+  }
+
+  handle.frame = frame;
+  handle.page = frame->data;
+
+  readAhead(pid);
+
+  return 0;
+}
+
+RC PageFile::readPages(const PageId* pids, int n, void** bufs) const
+{
+  RC   rc = 0;
+  bool hit;
+
+  for (int i = 0; i < n; i++) {
+    if (pids[i] < 0 || pids[i] >= epid) return RC_INVALID_PID;
+  }
+
+  // a mapped file is read straight from the mapping
+  if (map != NULL) {
+    if (bufs == NULL) return 0;
+    for (int i = 0; i < n; i++) {
+      memcpy(bufs[i], map + (size_t)pids[i] * PAGE_SIZE, PAGE_SIZE);
+    }
+    return 0;
+  }
+
+  std::vector<BufferPool::Frame*> frames(n);
+  std::vector<IoRequest> reqs;
+  std::vector<int> owners;      // the index of the page each request reads
+  std::vector<int> later;       // pages that someone else is loading
+
+  reqs.reserve(n);
+  owners.reserve(n);
+
+  // pin the pages in the cache, and set up a read for each miss.
+  // we must not wait for a page that is being loaded, since the loader
+  // may be this very batch (a page listed twice) or another thread
+  // waiting for one of our frames. such pages are read at the end.
+  for (int i = 0; i < n; i++) {
+    frames[i] = cache.fetch(fid, pids[i], hit, false);
+    if (frames[i] == NULL && hit) {
+      later.push_back(i);
+      continue;
+    }
+    countLookup(hit);
+    if (hit) continue;
+
+    if (frames[i] == NULL && bufs == NULL) continue;
+
+    // no frame to spare. read around the cache. a buffer that
+    // direct I/O cannot use is read on the spot instead.
+    if (frames[i] == NULL && direct && !isAligned(bufs[i])) {
+      RC err = readPage(pids[i], bufs[i]);
+      if (err < 0) rc = err;
+      continue;
+    }
+    IoRequest req;
+    req.op = IoRequest::READ;
+    req.fd = fd;
+    req.buffer = (frames[i] != NULL) ? frames[i]->data : bufs[i];
+    req.size = PAGE_SIZE;
+    req.offset = (off_t)pids[i] * PAGE_SIZE;
+    reqs.push_back(req);
+    owners.push_back(i);
+  }
+
+  // the reads run side by side, so each is charged the time of the batch
+  long long start = now();
+  if (!reqs.empty()) io.submitAndWait(&reqs[0], reqs.size());
+  long long usec = now() - start;
+
+  for (unsigned j = 0; j < reqs.size(); j++) {
+    BufferPool::Frame* frame = frames[owners[j]];
+
+    if (reqs[j].result != PAGE_SIZE) {
+      rc = RC_FILE_READ_FAILED;
+      if (frame != NULL) cache.abort(frame);
+      frames[owners[j]] = NULL;
+      continue;
+    }
+    countRead(1, usec);
+    if (frame != NULL) cache.complete(frame, this, bufs != NULL);
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (frames[i] == NULL) continue;
+    if (bufs != NULL) memcpy(bufs[i], frames[i]->data, PAGE_SIZE);
+    cache.unpin(frames[i]);
+  }
+
+  // now that our own frames are settled, wait for the rest
+  if (bufs != NULL) {
+    for (unsigned j = 0; j < later.size(); j++) {
+      RC err = read(pids[later[j]], bufs[later[j]]);
+      if (err < 0) rc = err;
     }
   }
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
+  return rc;
+}
+
+RC PageFile::willNeed(const PageId* pids, int n) const
+{
+  for (int i = 0; i < n; i++) {
+    if (pids[i] < 0 || pids[i] >= epid) return RC_INVALID_PID;
+  }
+
+  // for a mapped file, let the kernel fetch the pages
+  if (map != NULL) {
+    long sysPage = ::sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < n; i++) {
+      size_t offset = (size_t)pids[i] * PAGE_SIZE;
+      size_t start = offset - offset % sysPage;
+      ::madvise(map + start, offset + PAGE_SIZE - start, MADV_WILLNEED);
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+    return 0;
+  }
+
+  startReads(pids, n);
+  return 0;
+}
+
+void PageFile::readAhead(PageId pid) const
+{
+  PageId pids[READAHEAD_MAX];
+
+  if (pid == raLast) return;
+
+  // anything but the next page ends the sequential run
+  if (pid != raLast + 1 || pattern == RANDOM) {
+    raLast = pid;
+    raRun = 0;
+    raWindow = 0;
+    raEnd = 0;
+    return;
+  }
+  raLast = pid;
+
+  // a couple of pages in order may be chance. a few more are not.
+  if (++raRun < READAHEAD_TRIGGER && pattern != SEQUENTIAL) return;
+
+  // wait until the reader is halfway through the pages read ahead
+  if (raEnd - pid > raWindow / 2) return;
+
+  // open the window, or double it since the reader keeps up with it.
+  // the window never takes more than a quarter of the page cache.
+  int limit = cache.getFrameCount() / 4;
+  if (limit > READAHEAD_MAX) limit = READAHEAD_MAX;
+  if (raWindow == 0) {
+    raWindow = (pattern == SEQUENTIAL) ? READAHEAD_MAX / 4 : READAHEAD_MIN;
+  } else {
+    raWindow *= 2;
+  }
+  if (raWindow > limit) raWindow = limit;
+
+  PageId first = std::max(raEnd, pid + 1);
+  PageId last = std::min(pid + 1 + raWindow, epid);
+  if (first >= last) return;
+
+  for (PageId p = first; p < last; p++) pids[p - first] = p;
+  startReads(pids, last - first);
+  raEnd = last;
+}
+
+//
+// a batch of background reads. freed when its last read completes.
+//
+struct ReadBatch {
+  const PageFile* file;
+  int             remaining;
+  long long       started;    // when the reads were submitted
+  std::vector<IoRequest>    reqs;
+  std::vector<BufferFrame*> frames;
+};
+
+void PageFile::startReads(const PageId* pids, int n) const
+{
+  bool hit;
+  ReadBatch* batch = new ReadBatch;
+
+  batch->file = this;
+  batch->reqs.reserve(n);
+  batch->frames.reserve(n);
+
+  // reserve a frame for every page that is not cached yet.
+  // pages that are cached or on their way are left alone.
+  for (int i = 0; i < n; i++) {
+    BufferPool::Frame* frame = cache.fetch(fid, pids[i], hit, false);
+    if (frame == NULL) continue;
+    if (hit) {
+      cache.unpin(frame);
+      continue;
     }
+
+    IoRequest req;
+    req.op = IoRequest::READ;
+    req.fd = fd;
+    req.buffer = frame->data;
+    req.size = PAGE_SIZE;
+    req.offset = (off_t)pids[i] * PAGE_SIZE;
+    req.done = readDone;
+    req.arg = batch;
+    batch->reqs.push_back(req);
+    batch->frames.push_back(frame);
+  }
+
+  if (batch->reqs.empty()) {
+    delete batch;
+    return;
+  }
+
+  batch->remaining = batch->reqs.size();
+  batch->started = now();
+  pthread_mutex_lock(&raLock);
+  raPending += batch->remaining;
+  pthread_mutex_unlock(&raLock);
+  io.submit(&batch->reqs[0], batch->reqs.size());
+}
+
+void PageFile::readDone(IoRequest* req)
+{
+  ReadBatch* batch = (ReadBatch*) req->arg;
+  BufferFrame* frame = batch->frames[req - &batch->reqs[0]];
+
+  if (req->result == PAGE_SIZE) {
+    batch->file->countRead(1, now() - batch->started);
+    cache.complete(frame, batch->file, false);
+    cache.unpin(frame);
+  } else {
+    cache.abort(frame);
+  }
+
+  // the file may be closed as soon as the lock is released,
+  // so this is the last use of it
+  const PageFile* file = batch->file;
+  pthread_mutex_lock(&file->raLock);
+  if (--file->raPending == 0) pthread_cond_broadcast(&file->raIdle);
+  pthread_mutex_unlock(&file->raLock);
+
+  if (__sync_sub_and_fetch(&batch->remaining, 1) == 0) delete batch;
+}
+
+void PageFile::waitReads() const
+{
+  pthread_mutex_lock(&raLock);
+  while (raPending > 0) pthread_cond_wait(&raIdle, &raLock);
+  pthread_mutex_unlock(&raLock);
+}
+
+RC PageFile::newPage(PageHandle& handle)
+{
+  handle.release();
+
+  BufferPool::Frame* frame = cache.fetchFree();
+  if (frame == NULL) return RC_BUFFER_FULL;
+
+  handle.frame = frame;
+  handle.page = frame->data;
+
+  return 0;
+}
+
+RC PageFile::readPage(PageId pid, void* buffer) const
+{
+  // direct I/O needs an aligned buffer
+  if (direct && !isAligned(buffer)) {
+    ALIGNED_PAGE(page);
+    RC rc = readPage(pid, page);
+    if (rc == 0) memcpy(buffer, page, PAGE_SIZE);
+    return rc;
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
+
+  long long start = now();
+  if (::pread(fd, buffer, PAGE_SIZE, (off_t)pid * PAGE_SIZE) != PAGE_SIZE) {
     return RC_FILE_READ_FAILED;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
 
   // increase the page read count
-  readCount++;
+  countRead(1, now() - start);
+
+  return 0;
+}
+
+RC PageFile::writePage(PageId pid, const void* buffer)
+{
+  // direct I/O needs an aligned buffer
+  if (direct && !isAligned(buffer)) {
+    ALIGNED_PAGE(page);
+    memcpy(page, buffer, PAGE_SIZE);
+    return writePage(pid, page);
+  }
+
+  long long start = now();
+  if (::pwrite(fd, buffer, PAGE_SIZE, (off_t)pid * PAGE_SIZE) != PAGE_SIZE) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  // if the written pid >= end pid, update the end pid
+  if (pid >= epid) epid = pid + 1;
+
+  // increase page write count
+  countWrite(1, now() - start);
 
   return 0;
 }
+
+void PageFile::countRead(int pages, long long usec) const
+{
+  int bucket = IoStats::bucketOf(usec);
+
+  __sync_fetch_and_add(&stats.reads, pages);
+  __sync_fetch_and_add(&stats.bytesRead, (long long)pages * PAGE_SIZE);
+  __sync_fetch_and_add(&stats.readLatency[bucket], 1);
+  __sync_fetch_and_add(&totals.reads, pages);
+  __sync_fetch_and_add(&totals.bytesRead, (long long)pages * PAGE_SIZE);
+  __sync_fetch_and_add(&totals.readLatency[bucket], 1);
+}
+
+void PageFile::countWrite(int pages, long long usec) const
+{
+  int bucket = IoStats::bucketOf(usec);
+
+  __sync_fetch_and_add(&stats.writes, pages);
+  __sync_fetch_and_add(&stats.bytesWritten, (long long)pages * PAGE_SIZE);
+  __sync_fetch_and_add(&stats.writeLatency[bucket], 1);
+  __sync_fetch_and_add(&totals.writes, pages);
+  __sync_fetch_and_add(&totals.bytesWritten, (long long)pages * PAGE_SIZE);
+  __sync_fetch_and_add(&totals.writeLatency[bucket], 1);
+}
+
+void PageFile::countLookup(bool hit) const
+{
+  if (hit) {
+    __sync_fetch_and_add(&stats.cacheHits, 1);
+    __sync_fetch_and_add(&totals.cacheHits, 1);
+  } else {
+    __sync_fetch_and_add(&stats.cacheMisses, 1);
+    __sync_fetch_and_add(&totals.cacheMisses, 1);
+  }
+}
+
+void PageFile::countEviction(const PageFile* owner)
+{
+  if (owner != NULL) __sync_fetch_and_add(&owner->stats.evictions, 1);
+  __sync_fetch_and_add(&totals.evictions, 1);
+}
+
+void PageFile::countDirty(PageFile* owner, int delta)
+{
+  if (owner != NULL) __sync_fetch_and_add(&owner->dirtyPages, delta);
+}
+
+RC PageFile::setCacheSize(int sizeMB)
+{
+  return cache.setSize(sizeMB);
+}
+
+void PageFile::setCachePolicy(ReplacementPolicy::Kind kind)
+{
+  cache.setPolicy(kind);
+}
+
+PageHandle::PageHandle()
+{
+  frame = NULL;
+  page = NULL;
+}
+
+PageHandle::~PageHandle()
+{
+  release();
+}
+
+void PageHandle::release()
+{
+  if (frame != NULL) PageFile::cache.unpin(frame);
+  frame = NULL;
+  page = NULL;
+}
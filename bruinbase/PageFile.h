@@ -11,35 +11,181 @@
 #define PAGEFILE_H
 
 #include <string>
+#include <vector>
+#include <pthread.h>
 #include "Bruinbase.h"
+#include "ReplacementPolicy.h"
 
 typedef int PageId;
 
+// the page size is fixed at compile time. build with
+// -DBRUINBASE_PAGE_SIZE=4096 (or "make PAGE_SIZE=4096") to change it.
+#ifndef BRUINBASE_PAGE_SIZE
+#define BRUINBASE_PAGE_SIZE 1024
+#endif
+
+#if BRUINBASE_PAGE_SIZE < 1024 || (BRUINBASE_PAGE_SIZE & (BRUINBASE_PAGE_SIZE - 1)) != 0
+#error "BRUINBASE_PAGE_SIZE must be a power of two no smaller than 1024"
+#endif
+
+/**
+ * the header stored at the beginning of page 0 of table and index files.
+ * it records the page size the file was written with, so that a build
+ * with a different page size refuses the file instead of misreading it.
+ */
+struct FileHeader {
+  int magic;      // identifies the kind of file
+  int version;    // format version of the file
+  int pageSize;   // PageFile::PAGE_SIZE of the build that wrote the file
+};
+
+/**
+ * I/O and page cache statistics of one PageFile, or of all of them.
+ */
+struct IoStats {
+  // the latency histograms have a bucket for under 1 usec, then one
+  // bucket for each power of two: bucket i counts [2^(i-1), 2^i) usec.
+  // the last bucket also takes everything slower.
+  static const int LATENCY_BUCKETS = 22;
+
+  long long reads;          // # of pages read from the disk
+  long long writes;         // # of pages written to the disk
+  long long cacheHits;      // # of page reads served by the page cache
+  long long cacheMisses;    // # of page reads that went to the disk
+  long long evictions;      // # of pages evicted from the page cache
+  long long bytesRead;      // # of bytes read from the disk
+  long long bytesWritten;   // # of bytes written to the disk
+  long long readLatency[LATENCY_BUCKETS];   // latencies of disk reads
+  long long writeLatency[LATENCY_BUCKETS];  // latencies of disk writes
+
+  IoStats() { clear(); }
+
+  /**
+   * reset every counter to zero.
+   */
+  void clear();
+
+  /**
+   * add the counters of other to this.
+   * @param other[IN] the statistics to add
+   */
+  void add(const IoStats& other);
+
+  /**
+   * @return the histogram bucket of a latency
+   * @param usec[IN] the latency in microseconds
+   */
+  static int bucketOf(long long usec);
+};
+
+class BufferPool;
+struct BufferFrame;
+struct stat;
+class IoQueue;
+struct IoRequest;
+
+/**
+ * a page pinned in the page cache.
+ * while the handle holds a page, data() points directly into the cache
+ * and the page cannot be evicted. the page is unpinned when the handle
+ * is released or destroyed. handles cannot be copied.
+ */
+class PageHandle {
+ public:
+  PageHandle();
+  ~PageHandle();
+
+  /**
+   * @return pointer to the pinned page. NULL if no page is pinned
+   */
+  char* data() const { return page; }
+
+  /**
+   * @return true if the handle holds a page
+   */
+  bool isPinned() const { return page != NULL; }
+
+  /**
+   * unpin the page held by the handle, if any.
+   */
+  void release();
+
+ private:
+  PageHandle(const PageHandle&);
+  PageHandle& operator=(const PageHandle&);
+
+  BufferFrame* frame;   // the cache frame holding the page
+  char*        page;    // the page content
+
+  friend class PageFile;
+};
+
 /**
  * read/write a file in the unit of a page
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  static const int PAGE_SIZE = BRUINBASE_PAGE_SIZE;  // 1KB unless configured
+
+  // page buffers used for disk I/O are aligned to this many bytes.
+  // the page cache frames always are.
+  static const int IO_ALIGN = (PAGE_SIZE < 4096) ? PAGE_SIZE : 4096;
+
+  static const int READAHEAD_TRIGGER = 3; // # of pages read in order that start readahead
+  static const int READAHEAD_MIN = 8;     // first readahead window in pages
+  static const int READAHEAD_MAX = 256;   // largest readahead window in pages
+
+  /**
+   * how the pages of a file are going to be accessed.
+   * see setAccessPattern().
+   */
+  enum AccessPattern { NORMAL, SEQUENTIAL, RANDOM };
 
   PageFile();
   PageFile(const std::string& filename, char mode);
 
+  /**
+   * close the file if it is still open.
+   */
+  ~PageFile();
+
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * a file whose size is not a multiple of PAGE_SIZE is refused, since
+   * it was written with another page size.
+   * with setDirectIO(true), the file is opened with O_DIRECT, unless
+   * the file system cannot do direct I/O in units of PAGE_SIZE.
+   * when opened in 'm' mode, the file is read-only and memory-mapped.
+   * pages are then served straight from the mapping, bypassing the page
+   * cache, and are not counted as disk reads.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
 
   /**
-   * close the file.
+   * close the file. all dirty pages of the file are flushed first.
    * @return error code. 0 if no error
    */
   RC close();
+
+  /**
+   * close a temporary file without writing its dirty pages, and drop
+   * all of its pages from the page cache. the caller removes the file.
+   * @return error code. 0 if no error
+   */
+  RC discard();
+
+  /**
+   * write every dirty page of the file in the page cache to the disk.
+   * pages are written in PageId order, and runs of consecutive pages
+   * are written with a single system call.
+   * @return error code. 0 if no error
+   */
+  RC flush();
   
   /**
    * read a disk page into memory buffer.
@@ -48,17 +194,87 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * pin a disk page in the page cache without copying it.
+   * the page stays valid until the handle is released. if the page is
+   * modified through the handle, it must be written back with
+   * write(pid, handle).
+   * @param pid[IN] the page to pin
+   * @param handle[OUT] the handle holding the pinned page
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, PageHandle& handle) const;
+
+  /**
+   * read a batch of disk pages. the pages missing from the page cache are
+   * read with all their reads in flight at once, and are left in the cache.
+   * a page listed more than once is read only once.
+   * @param pids[IN] the pages to read
+   * @param n[IN] the number of pages
+   * @param bufs[OUT] the memory buffers for the pages. if NULL, the pages
+   *                  are only loaded into the page cache
+   * @return error code. 0 if no error
+   */
+  RC readPages(const PageId* pids, int n, void** bufs) const;
+
+  /**
+   * tell the file that the pages will be read soon.
+   * reads of the pages missing from the page cache are started in the
+   * background, and the call returns without waiting for them.
+   * use this for access patterns the readahead cannot guess, such as
+   * following the sibling links of B+tree leaves.
+   * @param pids[IN] the pages to read ahead
+   * @param n[IN] the number of pages
+   * @return error code. 0 if no error
+   */
+  RC willNeed(const PageId* pids, int n) const;
+
+  /**
+   * pin a zero-filled page in the page cache that does not belong to
+   * any file yet. it can be written to a file with write(pid, handle).
+   * @param handle[OUT] the handle holding the new page
+   * @return error code. 0 if no error
+   */
+  static RC newPage(PageHandle& handle);
   
   /**
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * in write-back mode, the page is only stored in the page cache and
+   * marked dirty. it reaches the disk when the file is flushed or closed,
+   * or when the cache needs the space.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * write a page pinned by pin() or newPage() to the disk page.
+   * when the handle holds the cached copy of pid itself, the page
+   * is only marked dirty (or written out in write-through mode)
+   * without any copy.
+   * @param pid[IN] page to write to
+   * @param handle[IN] the pinned page to write
+   * @return error code. 0 if no error
+   */
+  RC write(PageId pid, const PageHandle& handle);
     
+  /**
+   * tell the operating system how the file is going to be read, so that
+   * it can tune its readahead. uses madvise() on a file opened in 'm'
+   * mode and posix_fadvise() otherwise.
+   * the pattern also steers our own readahead: when pages are read in
+   * order, the following pages are read into the cache in the background
+   * with a window that doubles as the reader keeps up. RANDOM turns this
+   * off, and SEQUENTIAL starts with a large window.
+   * @param pattern[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC setAccessPattern(AccessPattern pattern);
+
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
    * that is, the last page can be read by "read(endPid()-1, buffer)".
@@ -66,47 +282,194 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return the statistics of the file since it was last opened.
+   * they stay available after the file is closed.
+   */
+  const IoStats& getStats() const { return stats; }
+
+  /**
+   * @return the statistics of all PageFiles together
+   */
+  static const IoStats& getTotalStats() { return totals; }
+
   /**
    * @return the total # of disk reads
    */
-  static int getPageReadCount()  { return readCount; }
+  static long long getPageReadCount()  { return totals.reads; }
   
   /**
    * @return the total # of disk writes
    */
-  static int getPageWriteCount() { return writeCount; }
+  static long long getPageWriteCount() { return totals.writes; }
 
- protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
+   * set the size of the page cache shared by all PageFiles.
+   * every cached page is dropped, so call this before opening any file.
+   * @param sizeMB[IN] the cache size in MB
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  static RC setCacheSize(int sizeMB);
+
+  /**
+   * choose how the page cache picks the pages to evict.
+   * every cached page is dropped, so call this before opening any file.
+   * @param kind[IN] the replacement policy. ARC by default
+   */
+  static void setCachePolicy(ReplacementPolicy::Kind kind);
+
+  /**
+   * choose between write-back (the default) and write-through caching
+   * of page writes for all PageFiles.
+   * @param on[IN] true for write-back, false for write-through
+   */
+  static void setWriteBack(bool on) { writeBack = on; }
+
+  /**
+   * choose whether files opened from now on bypass the kernel page cache
+   * with O_DIRECT, so that pages are cached once, in our own page cache.
+   * files opened in 'm' mode are never opened for direct I/O.
+   * @param on[IN] true for direct I/O, false for buffered I/O (the default)
+   */
+  static void setDirectIO(bool on) { directIO = on; }
+
+  /**
+   * @return true if the file does direct I/O
+   */
+  bool isDirect() const { return direct; }
 
  private:
-  int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
-
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
-
-  static int cacheClock; // clock tick counter for LRU policy
-
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
-
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  PageFile(const PageFile&);
+  PageFile& operator=(const PageFile&);
+
+  /**
+   * read a page from the disk, bypassing the cache.
+   * @param pid[IN] the page to read
+   * @param buffer[OUT] pointer to memory buffer
+   * @return error code. 0 if no error
+   */
+  RC readPage(PageId pid, void *buffer) const;
+
+  /**
+   * write a memory buffer to the disk page, bypassing the cache.
+   * @param pid[IN] the page to write to
+   * @param buffer[IN] the content to write
+   * @return error code. 0 if no error
+   */
+  RC writePage(PageId pid, const void *buffer);
+
+  /**
+   * account for a page that was just marked dirty in the cache.
+   * @param pid[IN] the dirty page
+   * @return error code. 0 if no error
+   */
+  RC pageDirtied(PageId pid);
+
+  /**
+   * write a run of consecutive pages to the disk with one system call.
+   * @param pid[IN] the first page of the run
+   * @param frames[IN] the cache frames holding the pages of the run
+   * @param count[IN] the number of pages in the run
+   * @return error code. 0 if no error
+   */
+  RC writeRun(PageId pid, BufferFrame** frames, int count);
+
+  /**
+   * note an access to pid and read ahead if the file is read in order.
+   * @param pid[IN] the page just read
+   */
+  void readAhead(PageId pid) const;
+
+  /**
+   * start background reads of the given pages into the cache.
+   * @param pids[IN] the pages to read
+   * @param n[IN] the number of pages
+   */
+  void startReads(const PageId* pids, int n) const;
+
+  /**
+   * completion callback of the background reads.
+   */
+  static void readDone(IoRequest* req);
+
+  /**
+   * wait until the background reads of the file have completed.
+   */
+  void waitReads() const;
+
+  /**
+   * count disk reads or writes in the file and total statistics.
+   * @param pages[IN] the number of pages moved
+   * @param usec[IN] how long the transfer took
+   */
+  void countRead(int pages, long long usec) const;
+  void countWrite(int pages, long long usec) const;
+
+  /**
+   * count a page read that hit or missed the page cache.
+   * @param hit[IN] whether the page was cached
+   */
+  void countLookup(bool hit) const;
+
+  /**
+   * count a page evicted from the page cache.
+   * @param owner[IN] the file of the page. may be NULL
+   */
+  static void countEviction(const PageFile* owner);
+
+  /**
+   * count a page of the file that became dirty or clean in the page cache.
+   * @param owner[IN] the file of the page. may be NULL
+   * @param delta[IN] 1 for a page that became dirty, -1 for one that became clean
+   */
+  static void countDirty(PageFile* owner, int delta);
+
+  /**
+   * find the page cache id of a file. a file that has not changed since
+   * it was last closed gets its old id back, and with it the pages it
+   * left in the cache.
+   * @param st[IN] the status of the open file
+   * @return the file id
+   */
+  static int fileIdOf(const struct stat& st);
+
+  /**
+   * remember the status of a file as the cache pages of fid have it.
+   * @param fid[IN] the file id
+   * @param st[IN] the status of the file
+   */
+  static void rememberFile(int fid, const struct stat& st);
+
+  int     fd;       // file descriptor of the associated unix file
+  int     fid;      // id of the file in the page cache
+  PageId  epid;     // (last page id + 1) of the file
+  bool    writable; // whether the file was opened in 'w' mode
+  char*   map;      // the file mapping in 'm' mode. NULL otherwise
+  bool    direct;   // whether the file was opened with O_DIRECT
+  AccessPattern pattern;    // the pattern given to setAccessPattern()
+
+  mutable PageId raLast;    // the page read last
+  mutable int    raRun;     // # of pages read in order up to raLast
+  mutable PageId raEnd;     // (last page read ahead + 1)
+  mutable int    raWindow;  // current readahead window. 0 if not reading ahead
+  mutable int    raPending; // # of background reads in flight
+  mutable pthread_mutex_t raLock;   // protects raPending
+  mutable pthread_cond_t  raIdle;   // signaled when raPending drops to 0
+
+  int     dirtyPages;       // # of pages of the file dirty in the cache
+  std::vector<BufferFrame*> flushFrames;  // scratch space of flush()
+
+  mutable IoStats stats;    // statistics of the file since it was opened
+
+  static BufferPool cache; // the page cache shared by all PageFiles
+  static IoQueue io;       // runs the reads of readPages()
+  static bool writeBack;   // whether writes are cached as dirty pages
+  static bool directIO;    // whether files are opened with O_DIRECT
+
+  static IoStats totals;   // statistics of all files together
+
+  friend class PageHandle;
+  friend class BufferPool;
 };
   
 #endif // PAGEFILE_H
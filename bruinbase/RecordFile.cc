@@ -9,7 +9,10 @@
 
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include <climits>
+#include <cmath>
 #include <cstring>
+#include <vector>
 
 using std::string;
 
@@ -32,6 +35,51 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+// read the record in the n'th slot of a slotted page (format version 2).
+// a value on overflow pages gets only its prefix, and length and overflow
+// are set to its full length and first overflow page. returns false then
+static bool readSlotted(const char* page, int n, int& key, std::string& value,
+                        int& length, PageId& overflow);
+
+// whether a record of the given slot data size fits in a slotted page
+static bool fitsSlotted(char* page, int size);
+
+// add a record behind the last one of a slotted page. data holds the
+// value, or the prefix, full length and first overflow page of a spilled
+// value. returns false if the page does not have the room
+static bool appendSlotted(char* page, int key, const char* data, int size, bool spilled);
+
+// # of overflow pages of the records of a slotted page
+static int overflowPageCount(const char* page);
+
+// the size of the slot data of a spilled value
+static const int SPILLED_SIZE = RecordFile::OVERFLOW_PREFIX + sizeof(int) + sizeof(PageId);
+
+// an overflow page starts with a record count of 0, so that it holds no
+// records for anything that reads it as a record page, the next overflow
+// page of the chain (0 at its end), and the # of value bytes on the page
+static const int OVERFLOW_HEADER = sizeof(int) + sizeof(PageId) + sizeof(int);
+
+// page 0 of a page map: its FileHeader, the # of table file pages it
+// covers, and the size of its entries
+struct PageMapHeader {
+  FileHeader header;
+  PageId     pages;
+  int        entrySize;
+};
+
+// the name of a file next to a table file: t.ext for t.tbl
+static string sideFileName(const string& filename, const char* ext);
+
+// the size of the Bloom filter of a page for a false positive rate,
+// and the # of bits a value sets in a filter of the given size
+static int filterSize(double rate);
+static int filterHashCount(int bits);
+
+// add a value to a Bloom filter, or check whether it may hold the value
+static void filterAdd(char* filter, int bits, int hashes, const string& value);
+static bool filterMayContain(const char* filter, int bits, int hashes, const char* value);
+
 
 //
 // helper functions for RecordId manipulation
@@ -103,10 +151,18 @@ bool operator != (const RecordId& r1, const RecordId& r2)
 }
 
 
+// the false positive rate of the Bloom filters of new tables
+double RecordFile::filterRate = 0.01;
+
 RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  base = 1;
+  version = FILE_VERSION;
+  countPid = -1;
+  countNext = 0;
+  filterBits = filterHashes = 0;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
@@ -116,22 +172,65 @@ RecordFile::RecordFile(const string& filename, char mode)
 
 RC RecordFile::open(const string& filename, char mode)
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC         rc;
+  PageHandle page;
+  FileHeader header;
+  bool       created = false;
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  //
+  // check the file header on page 0. the records start on page 1.
+  //
+  base = 1;
+  version = FILE_VERSION;
+  countPid = -1;
+  if (pf.endPid() == 0) {
+    // a new file. write the header if we are allowed to
+    if (mode == 'w' || mode == 'W') {
+      header.magic = FILE_MAGIC;
+      header.version = FILE_VERSION;
+      header.pageSize = PageFile::PAGE_SIZE;
+      if ((rc = PageFile::newPage(page)) < 0) goto fail;
+      memcpy(page.data(), &header, sizeof(header));
+      if ((rc = pf.write(0, page)) < 0) goto fail;
+      page.release();
+      created = true;
+    }
+  } else {
+    if ((rc = pf.pin(0, page)) < 0) goto fail;
+    memcpy(&header, page.data(), sizeof(header));
+    page.release();
+
+    if (header.magic != FILE_MAGIC) {
+      // a table from before the header was introduced. its records
+      // start on page 0, and it can only have 1KB pages.
+      if (PageFile::PAGE_SIZE != 1024) { rc = RC_INVALID_FILE_FORMAT; goto fail; }
+      base = 0;
+      version = 1;
+    } else if (header.pageSize != PageFile::PAGE_SIZE || header.version > FILE_VERSION) {
+      rc = RC_INVALID_FILE_FORMAT;
+      goto fail;
+    } else {
+      version = header.version;
+    }
+  }
+
+  // a table without usable page maps is read and written without them
+  if (base == 1) openPageMaps(filename, mode, created);
   
   //
   // in the rest of this function, we set the end record id
   //
 
   // get the end pid of the file
-  erid.pid = pf.endPid();
+  erid.pid = pf.endPid() - base;
 
-  // if the end pid is zero, the file is empty.
+  // if there are no record pages, the file is empty.
   // set the end record id to (0, 0).
-  if (erid.pid == 0) {
+  if (erid.pid <= 0) {
+    erid.pid = 0;
     erid.sid = 0;
     return 0;
   }
@@ -139,90 +238,554 @@ RC RecordFile::open(const string& filename, char mode)
   // obtain # records in the last page to set sid of the end record id.
   // read the last page of the file and get # records in the page.
   // remeber that the id of the last page is endPid()-1 not endPid().
-  if ((rc = pf.read(--erid.pid, page)) < 0) {
-    // an error occurred during page read
-    erid.pid = erid.sid = 0;
-    pf.close();
-    return rc;
-  }
+  if ((rc = pf.pin(--erid.pid + base, page)) < 0) goto fail;
 
-  // get # records in the last page
-  erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
+  // get # records in the last page. a slotted page may still have
+  // room for a short record, which append() finds out
+  erid.sid = getRecordCount(page.data());
+  if (version == 1 && erid.sid >= RECORDS_PER_PAGE) {
     // the last page is full. advance the end record id to the next page.
     erid.pid++;
     erid.sid = 0;
   }
   
   return 0;
+
+  // an error occurred during page read
+ fail:
+  page.release();
+  erid.pid = erid.sid = 0;
+  zones.close(-1);
+  filters.close(-1);
+  pf.close();
+  return rc;
 }
 
 RC RecordFile::close()
 {
+  // the page maps match the table again
+  zones.close(pf.endPid());
+  filters.close(pf.endPid());
+
   erid.pid = 0;
   erid.sid = 0;
 
   return pf.close();
 }
 
-RC RecordFile::read(const RecordId& rid, int& key, string& value) const
+void RecordFile::openPageMaps(const string& filename, char mode, bool create)
+{
+  int size = 2 * sizeof(int);
+
+  zones.open(sideFileName(filename, ".zone"), mode, create, ZONE_MAGIC, size, pf.endPid());
+  if (zones.isOpen() && size != 2 * (int) sizeof(int)) zones.close(-1);
+
+  // a new table gets filters only if they are turned on
+  size = filterSize(filterRate);
+  if (create && size == 0) return;
+  filters.open(sideFileName(filename, ".bloom"), mode, create, FILTER_MAGIC, size, pf.endPid());
+  filterBits = size * 8;
+  filterHashes = filterHashCount(filterBits);
+}
+
+RC RecordFile::addToPageMaps(PageId pid, bool first, int key, const string& value)
+{
+  RC   rc;
+  int  zone[2] = { key, key };
+  char filter[PageFile::PAGE_SIZE];
+
+  // widen the zone of the page to the key
+  if (zones.isWritable()) {
+    if (!first) {
+      if ((rc = zones.read(pid, zone)) < 0) return rc;
+      if (key < zone[0]) zone[0] = key;
+      if (key > zone[1]) zone[1] = key;
+    }
+    if ((rc = zones.write(pid, zone)) < 0) return rc;
+  }
+
+  // and add the value to its filter
+  if (filters.isWritable()) {
+    if (first) {
+      memset(filter, 0, filterBits / 8);
+    } else if ((rc = filters.read(pid, filter)) < 0) {
+      return rc;
+    }
+    filterAdd(filter, filterBits, filterHashes, value);
+    if ((rc = filters.write(pid, filter)) < 0) return rc;
+  }
+
+  return 0;
+}
+
+RC RecordFile::clearPageMaps(PageId pid)
+{
+  RC   rc;
+  int  zone[2] = { INT_MAX, INT_MIN };
+  char filter[PageFile::PAGE_SIZE];
+
+  if (zones.isWritable() && (rc = zones.write(pid, zone)) < 0) return rc;
+  if (filters.isWritable()) {
+    memset(filter, 0, filterBits / 8);
+    if ((rc = filters.write(pid, filter)) < 0) return rc;
+  }
+  return 0;
+}
+
+RC RecordFile::skipPages(RecordId& rid, int minKey, int maxKey, const char* value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  int  zone[2];
+  char filter[PageFile::PAGE_SIZE];
+  bool filtered = (value != NULL && filters.isOpen());
+  bool zoned = zones.isOpen() && (minKey > INT_MIN || maxKey < INT_MAX || !filtered);
+
+  if (rid.sid != 0 || (!zoned && !filtered)) return 0;
+
+  // overflow pages have empty entries and are skipped as well
+  for (; rid < erid; rid.pid++) {
+    if (zoned) {
+      if ((rc = zones.read(rid.pid, zone)) < 0) return rc;
+      if (zone[0] > zone[1] || zone[0] > maxKey || zone[1] < minKey) continue;
+    }
+    if (filtered) {
+      if ((rc = filters.read(rid.pid, filter)) < 0) return rc;
+      if (!filterMayContain(filter, filterBits, filterHashes, value)) continue;
+    }
+    return 0;
+  }
+  if (erid < rid) rid = erid;
+
+  return 0;
+}
+
+RC RecordFile::setFilterRate(double percent)
+{
+  if (percent < 0 || percent >= 100) return RC_INVALID_ATTRIBUTE;
+  filterRate = percent / 100;
+  return 0;
+}
+
+RC RecordFile::read(const RecordId& rid, int& key, string& value) const
+{
+  RC         rc;
+  PageHandle page;
+  int        length;
+  PageId     overflow;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= (version == 1 ? RECORDS_PER_PAGE : MAX_SLOTS_PER_PAGE)) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record
+  if ((rc = pf.pin(rid.pid + base, page)) < 0) return rc;
 
   // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  if (version == 1) {
+    readSlot(page.data(), rid.sid, key, value);
+  } else {
+    // a slotted page may end before the slot
+    if (rid.sid >= getRecordCount(page.data())) return RC_INVALID_RID;
+    if (!readSlotted(page.data(), rid.sid, key, value, length, overflow)) {
+      page.release();
+      return readOverflow(overflow, length, value);
+    }
+  }
 
   return 0;
 }
 
+RC RecordFile::readInline(const RecordId& rid, int& key, string& value, bool& complete) const
+{
+  RC         rc;
+  PageHandle page;
+  int        length;
+  PageId     overflow;
+
+  complete = true;
+  if (version == 1) return read(rid, key, value);
+
+  if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= MAX_SLOTS_PER_PAGE) return RC_INVALID_RID;
+  if (rid >= erid) return RC_INVALID_RID;
+
+  if ((rc = pf.pin(rid.pid + base, page)) < 0) return rc;
+  if (rid.sid >= getRecordCount(page.data())) return RC_INVALID_RID;
+  complete = readSlotted(page.data(), rid.sid, key, value, length, overflow);
+
+  return 0;
+}
+
+RC RecordFile::readOverflow(PageId first, int length, string& value) const
+{
+  RC         rc;
+  PageHandle page;
+  PageId     pid = first;
+  int        used;
+
+  value.reserve(length);
+  while ((int) value.size() < length) {
+    // a broken chain must not send us off the file
+    if (pid < base || pid >= pf.endPid()) return RC_INVALID_FILE_FORMAT;
+    if ((rc = pf.pin(pid, page)) < 0) return rc;
+
+    memcpy(&pid, page.data() + sizeof(int), sizeof(PageId));
+    memcpy(&used, page.data() + sizeof(int) + sizeof(PageId), sizeof(int));
+    if (used <= 0 || used > PageFile::PAGE_SIZE - OVERFLOW_HEADER) return RC_INVALID_FILE_FORMAT;
+    value.append(page.data() + OVERFLOW_HEADER, used);
+  }
+  return 0;
+}
+
+RC RecordFile::writeOverflow(const string& value, PageId start, PageId& first)
+{
+  RC         rc;
+  PageHandle page;
+  int        room = PageFile::PAGE_SIZE - OVERFLOW_HEADER;
+  int        count = 0;
+
+  // the chain runs over consecutive pages, so that reading it goes
+  // forward through the file
+  first = start;
+  for (size_t done = OVERFLOW_PREFIX; done < value.size(); done += room) {
+    int    used = (value.size() - done < (size_t) room) ? value.size() - done : room;
+    PageId next = (done + used < value.size()) ? start + 1 : 0;
+
+    if ((rc = PageFile::newPage(page)) < 0) return rc;
+    memcpy(page.data(), &count, sizeof(int));
+    memcpy(page.data() + sizeof(int), &next, sizeof(PageId));
+    memcpy(page.data() + sizeof(int) + sizeof(PageId), &used, sizeof(int));
+    memcpy(page.data() + OVERFLOW_HEADER, value.data() + done, used);
+    if ((rc = pf.write(start, page)) < 0) return rc;
+    page.release();
+    start++;
+  }
+  return 0;
+}
+
+RC RecordFile::next(RecordId& rid) const
+{
+  RC         rc;
+  PageHandle page;
+
+  if (version == 1) {
+    ++rid;
+    return 0;
+  }
+
+  // look up the record count of the page, unless it is the last page,
+  // whose count is in the end record id. the overflow pages of the
+  // records of a page come right behind it, so the page also tells
+  // where the next page with records is, without reading them.
+  if (rid.pid != countPid) {
+    if (rid.pid < 0 || rid.pid >= erid.pid) {
+      countSlots = erid.sid;
+      countNext = rid.pid + 1;
+    } else {
+      if ((rc = pf.pin(rid.pid + base, page)) < 0) {
+        rid = erid;
+        return rc;
+      }
+      countSlots = getRecordCount(page.data());
+      countNext = rid.pid + 1 + overflowPageCount(page.data());
+    }
+    countPid = rid.pid;
+  }
+
+  // if the end of a page is reached, move to the next page
+  if (++rid.sid >= countSlots && rid.pid < erid.pid) {
+    rid.pid = countNext;
+    rid.sid = 0;
+    if (erid < rid) rid = erid;
+  }
+  return 0;
+}
+
+void RecordFile::pagesOf(const RecordId* rids, int n, std::vector<PageId>& pids) const
+{
+  // neighboring records mostly share a page, so drop the repeats as we go
+  pids.reserve(n);
+  for (int i = 0; i < n; i++) {
+    PageId pid = rids[i].pid + base;
+    if (rids[i].pid < 0 || pid >= pf.endPid()) continue;
+    if (!pids.empty() && pids.back() == pid) continue;
+    pids.push_back(pid);
+  }
+}
+
+RC RecordFile::prefetch(const RecordId* rids, int n) const
+{
+  std::vector<PageId> pids;
+
+  pagesOf(rids, n, pids);
+  if (pids.empty()) return 0;
+  return pf.readPages(&pids[0], pids.size(), NULL);
+}
+
+RC RecordFile::willNeed(const RecordId* rids, int n) const
+{
+  std::vector<PageId> pids;
+
+  pagesOf(rids, n, pids);
+  if (pids.empty()) return 0;
+  return pf.willNeed(&pids[0], pids.size());
+}
+
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC         rc;
+  PageHandle page;
 
   // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
+  // we pin the page and fill in the slot in place
   if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
-  } else {
-    // if this is the first slot of an empty page
-    // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    if ((rc = pf.pin(erid.pid + base, page)) < 0) return rc;
   }
-    
-  // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
 
-  // the first four bytes in the page stores # records in the page.
-  // update this number.
-  setRecordCount(page, erid.sid + 1);
+  if (version == 1) {
+    // if this is the first slot of an empty page
+    // we can simply start from a page of zeros
+    if (erid.sid == 0 && (rc = PageFile::newPage(page)) < 0) return rc;
+
+    // write the record to the first empty slot 
+    writeSlot(page.data(), erid.sid, key, value);
+
+    // the first four bytes in the page stores # records in the page.
+    // update this number.
+    setRecordCount(page.data(), erid.sid + 1);
+  } else {
+    // a long value keeps a prefix in the slot. the first overflow
+    // page is filled in below, once the page of the record is known
+    bool   spilled = (int) value.size() >= MAX_VALUE_LENGTH;
+    char   data[SPILLED_SIZE];
+    int    size = value.size();
+    PageId first = 0;
+    if (spilled) {
+      memcpy(data, value.data(), OVERFLOW_PREFIX);
+      memcpy(data + OVERFLOW_PREFIX, &size, sizeof(int));
+      size = SPILLED_SIZE;
+    }
+    const char* bytes = spilled ? data : value.data();
+
+    // a record that does not fit in the last page starts a new one
+    // at the end of the file, which overflow pages may have moved
+    if (erid.sid > 0 && !fitsSlotted(page.data(), size)) {
+      page.release();
+      erid.sid = 0;
+    }
+    if (erid.sid == 0) {
+      if ((rc = PageFile::newPage(page)) < 0) return rc;
+      erid.pid = pf.endPid() - base;
+      if (erid.pid < 0) erid.pid = 0;
+    }
+
+    // the overflow pages go behind the page of the record
+    if (spilled) {
+      PageId start = pf.endPid();
+      if (start <= erid.pid + base) start = erid.pid + base + 1;
+      if ((rc = writeOverflow(value, start, first)) < 0) return rc;
+      memcpy(data + OVERFLOW_PREFIX + sizeof(int), &first, sizeof(PageId));
+
+      // they hold no records
+      for (PageId pid = start; pid < pf.endPid(); pid++) {
+        if ((rc = clearPageMaps(pid - base)) < 0) return rc;
+      }
+    }
+
+    appendSlotted(page.data(), key, bytes, size, spilled);
+    countPid = -1;
+  }
 
   // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  if ((rc = pf.write(erid.pid + base, page)) < 0) return rc;
+
+  // keep the zone map and the filters up to date
+  if ((rc = addToPageMaps(erid.pid, erid.sid == 0, key, value)) < 0) return rc;
     
   // we need to output the rid of the record slot
   rid = erid;
 
   // advance the end record id by one to the next empty slot
-  ++erid;
+  if (version == 1) {
+    ++erid;
+  } else {
+    erid.sid++;
+  }
 
   return 0;
 }
 
+RC RecordFile::setAccessPattern(PageFile::AccessPattern pattern)
+{
+  return pf.setAccessPattern(pattern);
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
 }
 
+PageMap::PageMap()
+{
+  magic = 0;
+  entrySize = perPage = 0;
+  opened = writable = false;
+}
+
+RC PageMap::open(const string& filename, char mode, bool create, int magic,
+                 int& entrySize, PageId pages)
+{
+  RC            rc;
+  PageHandle    page;
+  PageMapHeader header;
+  bool          writer = (mode == 'w' || mode == 'W');
+
+  // an existing table that has no map does not get one
+  if (!create && writer) {
+    if ((rc = pf.open(filename, 'r')) < 0) return rc;
+    pf.close();
+  }
+  if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  if (!create) {
+    // the map must cover the pages of the table
+    if ((rc = pf.pin(0, page)) < 0) goto fail;
+    memcpy(&header, page.data(), sizeof(header));
+    page.release();
+    if (header.header.magic != magic || header.header.version > FILE_VERSION ||
+        header.header.pageSize != PageFile::PAGE_SIZE || header.pages != pages ||
+        header.entrySize <= 0 || header.entrySize > PageFile::PAGE_SIZE) {
+      rc = RC_INVALID_FILE_FORMAT;
+      goto fail;
+    }
+    entrySize = header.entrySize;
+  }
+
+  this->magic = magic;
+  this->entrySize = entrySize;
+  perPage = PageFile::PAGE_SIZE / entrySize;
+
+  // until close(), the map does not match the table on the disk
+  if (writer) {
+    if ((rc = writeHeader(-1)) < 0) goto fail;
+    writable = true;
+  }
+  opened = true;
+  return 0;
+
+ fail:
+  page.release();
+  pf.close();
+  return rc;
+}
+
+RC PageMap::close(PageId pages)
+{
+  RC rc = 0;
+
+  if (!opened) return 0;
+  if (writable) rc = writeHeader(pages);
+  opened = writable = false;
+
+  if (pf.close() < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  return rc;
+}
+
+RC PageMap::writeHeader(PageId pages)
+{
+  RC            rc;
+  PageHandle    page;
+  PageMapHeader header;
+
+  header.header.magic = magic;
+  header.header.version = FILE_VERSION;
+  header.header.pageSize = PageFile::PAGE_SIZE;
+  header.pages = pages;
+  header.entrySize = entrySize;
+
+  if ((rc = PageFile::newPage(page)) < 0) return rc;
+  memcpy(page.data(), &header, sizeof(header));
+  return pf.write(0, page);
+}
+
+RC PageMap::read(PageId pid, void* entry) const
+{
+  RC         rc;
+  PageHandle page;
+
+  if (pid < 0) return RC_INVALID_PID;
+  if ((rc = pf.pin(1 + pid / perPage, page)) < 0) return rc;
+  memcpy(entry, page.data() + (pid % perPage) * entrySize, entrySize);
+
+  return 0;
+}
+
+RC PageMap::write(PageId pid, const void* entry)
+{
+  RC         rc;
+  PageHandle page;
+  PageId     mpid = 1 + pid / perPage;
+
+  if (pid < 0) return RC_INVALID_PID;
+
+  // the entries are written in page order, so a page past the end is new
+  if (mpid >= pf.endPid()) {
+    rc = PageFile::newPage(page);
+  } else {
+    rc = pf.pin(mpid, page);
+  }
+  if (rc < 0) return rc;
+
+  memcpy(page.data() + (pid % perPage) * entrySize, entry, entrySize);
+  return pf.write(mpid, page);
+}
+
+static const int WORD_BITS = sizeof(unsigned) * 8;
+
+RecordIdBitmap::RecordIdBitmap(const RecordFile& rf)
+{
+  size_t slots = (size_t) (rf.endRid().pid + 1) * RecordFile::MAX_SLOTS_PER_PAGE;
+  bits.assign((slots + WORD_BITS - 1) / WORD_BITS, 0);
+  count = 0;
+  word = 0;
+}
+
+void RecordIdBitmap::add(const RecordId& rid)
+{
+  if (rid.pid < 0 || rid.sid < 0 || rid.sid >= RecordFile::MAX_SLOTS_PER_PAGE) return;
+
+  size_t bit = (size_t) rid.pid * RecordFile::MAX_SLOTS_PER_PAGE + rid.sid;
+  if (bit / WORD_BITS >= bits.size()) return;
+
+  unsigned mask = 1u << (bit % WORD_BITS);
+  if (bits[bit / WORD_BITS] & mask) return;
+  bits[bit / WORD_BITS] |= mask;
+  count++;
+}
+
+int RecordIdBitmap::next(RecordId rids[], int max)
+{
+  int n = 0;
+
+  // take the set bits of each word from the lowest up, clearing
+  // them as we go, so that the next call picks up where we stop
+  while (n < max && word < bits.size()) {
+    if (bits[word] == 0) {
+      word++;
+      continue;
+    }
+    int b = __builtin_ctz(bits[word]);
+    bits[word] &= bits[word] - 1;
+
+    size_t bit = word * WORD_BITS + b;
+    rids[n].pid = bit / RecordFile::MAX_SLOTS_PER_PAGE;
+    rids[n].sid = bit % RecordFile::MAX_SLOTS_PER_PAGE;
+    n++;
+  }
+  return n;
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -276,3 +839,173 @@ static void writeSlot(char* page, int n, int key, const std::string& value)
     strcpy(ptr + sizeof(int), value.c_str());
   }
 }
+
+//
+// a slotted page (format version 2) starts with # records in the page,
+// followed by the slot directory. the n'th entry of the directory holds
+// the offset and the length of the record in the n'th slot. records are
+// packed from the back of the page toward the directory, each as its key
+// followed by its value without the terminating zero.
+//
+
+#if BRUINBASE_PAGE_SIZE <= 65536
+typedef unsigned short SlotOffset;
+#else
+typedef unsigned int SlotOffset;
+#endif
+
+typedef struct {
+  SlotOffset offset;  // where the record starts in the page
+  SlotOffset length;  // the length of the key and the slot data
+} SlotEntry;
+
+// set in the length of a slot whose value continues on overflow pages
+static const SlotOffset SLOT_SPILLED = (SlotOffset) 1 << (sizeof(SlotOffset) * 8 - 1);
+
+static SlotEntry* slotDirectory(char* page)
+{
+  return (SlotEntry*) (page + sizeof(int));
+}
+
+static bool readSlotted(const char* page, int n, int& key, std::string& value,
+                        int& length, PageId& overflow)
+{
+  const SlotEntry* slot = slotDirectory(const_cast<char*>(page)) + n;
+  const char* ptr = page + slot->offset;
+
+  memcpy(&key, ptr, sizeof(int));
+  if (!(slot->length & SLOT_SPILLED)) {
+    value.assign(ptr + sizeof(int), slot->length - sizeof(int));
+    return true;
+  }
+
+  ptr += sizeof(int);
+  value.assign(ptr, RecordFile::OVERFLOW_PREFIX);
+  memcpy(&length, ptr + RecordFile::OVERFLOW_PREFIX, sizeof(int));
+  memcpy(&overflow, ptr + RecordFile::OVERFLOW_PREFIX + sizeof(int), sizeof(PageId));
+  return false;
+}
+
+// the offset a record of the given slot data size would get in a
+// slotted page. smaller than the end of the directory if it does not fit
+static int slottedStart(char* page, int size)
+{
+  int        count = getRecordCount(page);
+  SlotEntry* slots = slotDirectory(page);
+
+  // the free space lies between the directory and the last record
+  int end = (count == 0) ? PageFile::PAGE_SIZE : slots[count - 1].offset;
+  return end - (int) sizeof(int) - size;
+}
+
+static bool fitsSlotted(char* page, int size)
+{
+  int count = getRecordCount(page);
+  return slottedStart(page, size) >= (int) (sizeof(int) + (count + 1) * sizeof(SlotEntry));
+}
+
+static bool appendSlotted(char* page, int key, const char* data, int size, bool spilled)
+{
+  int        count = getRecordCount(page);
+  SlotEntry* slots = slotDirectory(page);
+  int        start = slottedStart(page, size);
+
+  if (!fitsSlotted(page, size)) return false;
+
+  memcpy(page + start, &key, sizeof(int));
+  memcpy(page + start + sizeof(int), data, size);
+  slots[count].offset = start;
+  slots[count].length = (sizeof(int) + size) | (spilled ? SLOT_SPILLED : 0);
+  setRecordCount(page, count + 1);
+  return true;
+}
+
+static int overflowPageCount(const char* page)
+{
+  const SlotEntry* slots = slotDirectory(const_cast<char*>(page));
+  int count = getRecordCount(page);
+  int room = PageFile::PAGE_SIZE - OVERFLOW_HEADER;
+  int pages = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (!(slots[i].length & SLOT_SPILLED)) continue;
+
+    int length;
+    memcpy(&length, page + slots[i].offset + sizeof(int) + RecordFile::OVERFLOW_PREFIX, sizeof(int));
+    pages += (length - RecordFile::OVERFLOW_PREFIX + room - 1) / room;
+  }
+  return pages;
+}
+
+static string sideFileName(const string& filename, const char* ext)
+{
+  string::size_type n = filename.size();
+
+  if (n > 4 && filename.compare(n - 4, 4, ".tbl") == 0) {
+    return filename.substr(0, n - 4) + ext;
+  }
+  return filename + ext;
+}
+
+// the # of records a page of values of FILTER_VALUE_LENGTH characters holds
+static const int FILTER_RECORDS = (PageFile::PAGE_SIZE - sizeof(int)) /
+  (sizeof(int) + sizeof(SlotEntry) + RecordFile::FILTER_VALUE_LENGTH);
+
+static int filterSize(double rate)
+{
+  if (rate <= 0) return 0;
+
+  // with the best # of hashes, n values in m bits give a false positive
+  // rate of about 2^(-m/n ln 2), so m = n ln(1/rate) / (ln 2)^2
+  double bits = FILTER_RECORDS * -log(rate) / (log(2.0) * log(2.0));
+  int    size = (int) ceil(bits / 8);
+  return (size > PageFile::PAGE_SIZE) ? PageFile::PAGE_SIZE : size;
+}
+
+static int filterHashCount(int bits)
+{
+  int hashes = (int) (bits * log(2.0) / FILTER_RECORDS + 0.5);
+  return (hashes < 1) ? 1 : hashes;
+}
+
+// a 64-bit hash of a string: FNV-1a, with its bits mixed at the end so
+// that both halves can be used
+static unsigned long long hashValue(const char* s, size_t n)
+{
+  unsigned long long h = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// the bits of a value are h1 + i * h2 for the two halves of its hash
+static void filterAdd(char* filter, int bits, int hashes, const string& value)
+{
+  unsigned long long h = hashValue(value.data(), value.size());
+  unsigned h1 = (unsigned) h;
+  unsigned h2 = (unsigned) (h >> 32) | 1;
+
+  for (int i = 0; i < hashes; i++) {
+    unsigned bit = (h1 + i * h2) % bits;
+    filter[bit / 8] |= 1 << (bit % 8);
+  }
+}
+
+static bool filterMayContain(const char* filter, int bits, int hashes, const char* value)
+{
+  unsigned long long h = hashValue(value, strlen(value));
+  unsigned h1 = (unsigned) h;
+  unsigned h2 = (unsigned) (h >> 32) | 1;
+
+  for (int i = 0; i < hashes; i++) {
+    unsigned bit = (h1 + i * h2) % bits;
+    if (!(filter[bit / 8] & (1 << (bit % 8)))) return false;
+  }
+  return true;
+}
@@ -11,6 +11,7 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <vector>
 #include "PageFile.h"
 
 /**
@@ -26,7 +27,8 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
+// RecordId iterators. they step through the fixed slots of format
+// version 1. RecordFile::next() steps through the records of any file
 RecordId& operator++ (RecordId& rid);
 RecordId  operator++ (RecordId& rid, int);
 
@@ -38,28 +40,134 @@ bool operator<= (const RecordId& r1, const RecordId& r2);
 bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
+/**
+ * a file next to a table file with an entry of a fixed size for each page
+ * of the table, like the zone map. the map records how many table pages
+ * it covers, and it is not used if that does not match the table.
+ * while a writer has it open, it covers no table.
+ */
+class PageMap {
+ public:
+  // the current format version of page map files
+  static const int FILE_VERSION = 1;
+
+  PageMap();
+
+  /**
+   * open the map of a table file in the mode the table is opened in.
+   * @param filename[IN] the name of the map file
+   * @param mode[IN] the mode of the table file
+   * @param create[IN] true if the table file was just created. the map
+   *                   is started over, otherwise it must already exist
+   * @param magic[IN] identifies the kind of map in its FileHeader
+   * @param entrySize[IN/OUT] the size of an entry in bytes. a new map
+   *                   takes it and an existing map returns its own
+   * @param pages[IN] the number of pages of the table file
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode, bool create, int magic,
+          int& entrySize, PageId pages);
+
+  /**
+   * close the map. a writer records the pages of the table it covers.
+   * @param pages[IN] the number of pages of the table file
+   * @return error code. 0 if no error
+   */
+  RC close(PageId pages);
+
+  /**
+   * read or write the entry of a table page. the entries are written
+   * in page order.
+   * @param pid[IN] the table page
+   * @param entry[OUT/IN] the entry, entrySize bytes
+   * @return error code. 0 if no error
+   */
+  RC read(PageId pid, void* entry) const;
+  RC write(PageId pid, const void* entry);
+
+  /**
+   * @return whether the map is open, and so matches the table
+   */
+  bool isOpen() const { return opened; }
+
+  /**
+   * @return whether the map is kept up to date with the table
+   */
+  bool isWritable() const { return writable; }
+
+  /**
+   * @return the I/O statistics of the file since it was last opened
+   */
+  const IoStats& getStats() const { return pf.getStats(); }
+
+ private:
+  RC writeHeader(PageId pages);
+
+  PageFile pf;
+  int      magic;
+  int      entrySize;
+  int      perPage;     // # of entries in a page. they start on page 1
+  bool     opened;
+  bool     writable;
+};
+
 /**
  * read/write a record to a file
  */
 class RecordFile {
  public:
 
-  // maximum length of the value field
+  // maximum length of the value field. format version 1 truncates
+  // longer values, and version 2 moves them to overflow pages
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
+  // # of characters of a value on overflow pages that stay in its slot
+  static const int OVERFLOW_PREFIX = 32;
+
+  // number of record slots per page in format version 1
   static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
     // Note that we subtract sizeof(int) from PAGE_SIZE because the first
     // four bytes in the page is used to store # records in the page.
 
+  // most records a page can hold in any format. a record of format
+  // version 2 takes at least its key and its slot directory entry
+  static const int MAX_SLOTS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int)) / (2 * sizeof(int));
+
+  // identifies a table file in its FileHeader on page 0
+  static const int FILE_MAGIC = 0x4c425442;   // "BTBL"
+
+  // identify the zone map and Bloom filter files in their FileHeader
+  static const int ZONE_MAGIC = 0x4e5a4242;    // "BBZN"
+  static const int FILTER_MAGIC = 0x4c464242;  // "BBFL"
+
+  // the current format version of table files.
+  // version 1 gives every record a fixed slot of 4 + MAX_VALUE_LENGTH bytes.
+  // version 2 uses slotted pages: a slot directory after the record count
+  // grows from the front of the page, and records of the length of their
+  // values are packed from the back. a record keeps its slot number.
+  // a value of MAX_VALUE_LENGTH characters or more keeps its first
+  // OVERFLOW_PREFIX characters in the slot, and the rest goes to a chain
+  // of overflow pages right behind its page, which table scans skip.
+  static const int FILE_VERSION = 2;
+
   RecordFile();
   RecordFile(const std::string& filename, char mode);
   
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * 'm' mode is read-only and memory-maps the file (see PageFile::open).
+   * page 0 of the file holds a FileHeader, and a file written with a
+   * different page size is refused with RC_INVALID_FILE_FORMAT. files
+   * from before the header was introduced are still read, without it.
+   * new files get the current format. a file of format version 1 keeps
+   * its format, also when records are appended to it.
+   * a new file also gets a zone map, which is kept in a file next to it
+   * (t.zone for t.tbl) and holds the smallest and largest key of every
+   * page, and Bloom filters of the values of every page (t.bloom), unless
+   * they are turned off. either is not used if it does not match the file.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
@@ -79,6 +187,83 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read a record without following the overflow pages of its value.
+   * a condition on the value can often be decided from the prefix.
+   * @param rid[IN] the id of the record to read
+   * @param key[OUT] the record key
+   * @param value[OUT] the record value, or its first OVERFLOW_PREFIX
+   *                   characters if it continues on overflow pages
+   * @param complete[OUT] false if value holds only the prefix
+   * @return error code. 0 if no error
+   */
+  RC readInline(const RecordId& rid, int& key, std::string& value, bool& complete) const;
+
+  /**
+   * move a record id to the next record of the file.
+   * after the last record, the id becomes endRid().
+   * @param rid[IN/OUT] the id of a record of the file
+   * @return error code. 0 if no error
+   */
+  RC next(RecordId& rid) const;
+
+  /**
+   * skip the pages that cannot hold a record with a key in [minKey,
+   * maxKey] and, unless value is NULL, the value.
+   * if rid is the first record of a page, it moves to the first record
+   * of the next page from there that may hold such a record, or to
+   * endRid(). the zone map rules out keys and the Bloom filters values.
+   * without either, rid does not move.
+   * @param rid[IN/OUT] the id of a record of the file
+   * @param minKey[IN] the smallest key of interest
+   * @param maxKey[IN] the largest key of interest
+   * @param value[IN] the value of interest, or NULL for any value
+   * @return error code. 0 if no error
+   */
+  RC skipPages(RecordId& rid, int minKey, int maxKey, const char* value) const;
+
+  /**
+   * @return whether the file has a zone map skipPages() can use
+   */
+  bool hasZoneMap() const { return zones.isOpen(); }
+
+  /**
+   * @return whether the file has Bloom filters skipPages() can use
+   */
+  bool hasFilters() const { return filters.isOpen(); }
+
+  /**
+   * set the false positive rate of the Bloom filters of the files
+   * created from now on. the filters are sized for pages of values of
+   * about FILTER_VALUE_LENGTH characters; pages of longer values get
+   * fewer false positives, and pages of shorter ones more.
+   * @param percent[IN] the rate in percent, below 100. 0 for no filters
+   * @return error code. 0 if no error
+   */
+  static RC setFilterRate(double percent);
+
+  // the value length the Bloom filters are sized for
+  static const int FILTER_VALUE_LENGTH = 16;
+
+  /**
+   * load the pages holding the given records into the page cache with
+   * one batch of reads, so that reading the records afterwards does not
+   * wait on the disk one page at a time.
+   * @param rids[IN] the ids of the records about to be read
+   * @param n[IN] the number of record ids
+   * @return error code. 0 if no error
+   */
+  RC prefetch(const RecordId* rids, int n) const;
+
+  /**
+   * start reading the pages holding the given records into the page
+   * cache in the background, and return without waiting for them.
+   * @param rids[IN] the ids of the records to be read later
+   * @param n[IN] the number of record ids
+   * @return error code. 0 if no error
+   */
+  RC willNeed(const RecordId* rids, int n) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -90,15 +275,112 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * tell the operating system how the records are going to be read.
+   * @param pattern[IN] SEQUENTIAL for a table scan, RANDOM for
+   *                    record lookups through an index
+   * @return error code. 0 if no error
+   */
+  RC setAccessPattern(PageFile::AccessPattern pattern);
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
+  /**
+   * @return the I/O statistics of the file since it was last opened
+   */
+  const IoStats& getStats() const { return pf.getStats(); }
+
+  /**
+   * @return the I/O statistics of the zone map since it was last opened
+   */
+  const IoStats& getZoneStats() const { return zones.getStats(); }
+
+  /**
+   * @return the I/O statistics of the Bloom filters since they were opened
+   */
+  const IoStats& getFilterStats() const { return filters.getStats(); }
+
  private:
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  PageId   base;   // the PageFile page of the record page 0. skips the header
+  int      version; // the format version of the file
+
+  // the record count of the page next() looked at last,
+  // and the next page with records after it
+  mutable PageId countPid;
+  mutable int    countSlots;
+  mutable PageId countNext;
+
+  PageMap zones;        // the zone map: a (min, max) key pair per page
+  PageMap filters;      // a Bloom filter of the values of each page
+  int     filterBits;   // the size of a filter in bits
+  int     filterHashes; // # of bits a value sets in a filter
+
+  static double filterRate;  // the false positive rate of new filters
+
+  // open the zone map and the Bloom filters of the file.
+  // a new file gets new ones
+  void openPageMaps(const std::string& filename, char mode, bool create);
+
+  // add a record to the page maps of its page. first if it is the
+  // first record of the page, which starts the entries over
+  RC addToPageMaps(PageId pid, bool first, int key, const std::string& value);
+
+  // give an overflow page empty entries, which rule out every record
+  RC clearPageMaps(PageId pid);
+
+  // write the part of value behind its prefix to overflow pages
+  // from the page start on. the first one becomes first
+  RC writeOverflow(const std::string& value, PageId start, PageId& first);
+
+  // append the part of a value on the overflow pages from first on
+  RC readOverflow(PageId first, int length, std::string& value) const;
+
+  // the PageFile pages of the records, with neighboring repeats dropped
+  void pagesOf(const RecordId* rids, int n, std::vector<PageId>& pids) const;
+};
+
+/**
+ * a set of the record ids of a RecordFile, with one bit per record slot.
+ * the ids come back out in RecordId order, so reading the records in
+ * that order visits each page of the file once, however scattered the
+ * ids were when they were added.
+ */
+class RecordIdBitmap {
+ public:
+  /**
+   * @param rf[IN] the file the ids belong to. sizes the bitmap
+   */
+  RecordIdBitmap(const RecordFile& rf);
+
+  /**
+   * add a record id to the set. ids outside the file are ignored.
+   * @param rid[IN] the record id
+   */
+  void add(const RecordId& rid);
+
+  /**
+   * return the next ids of the set in RecordId order.
+   * @param rids[OUT] the ids, room for max of them
+   * @param max[IN] the most ids to return
+   * @return the number of ids returned. 0 after the last one
+   */
+  int next(RecordId rids[], int max);
+
+  /**
+   * @return the number of ids in the set
+   */
+  long long size() const { return count; }
+
+ private:
+  std::vector<unsigned> bits;   // bit (pid * MAX_SLOTS_PER_PAGE + sid)
+  long long count;              // # of bits set
+  size_t    word;               // the word next() continues from
 };
 
 #endif // RECORDFILE_H
@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "ReplacementPolicy.h"
+#include "BufferPool.h"
+#include <cstring>
+#include <strings.h>
+
+using namespace std;
+
+GhostList::GhostList(int capacity) : capacity(capacity < 1 ? 1 : capacity)
+{
+  // removed pages hold on to their slots until they get old, so the
+  // ring has room for as many of them as there are pages
+  ring.resize(2 * this->capacity);
+  head = used = count = 0;
+
+  // keep the table at most half full
+  int size = 1;
+  while (size < 2 * (int)ring.size()) size <<= 1;
+  table.assign(size, -1);
+  mask = size - 1;
+}
+
+static unsigned hashOf(int fid, int pid)
+{
+  unsigned h = (unsigned)pid * 2654435761u ^ (unsigned)fid * 40503u;
+  return h ^ (h >> 15);
+}
+
+int GhostList::find(int fid, int pid) const
+{
+  for (unsigned i = hashOf(fid, pid) & mask; table[i] >= 0; i = (i + 1) & mask) {
+    const Entry& e = ring[table[i]];
+    if (e.fid == fid && e.pid == pid) return i;
+  }
+  return -1;
+}
+
+void GhostList::unindex(int i)
+{
+  // shift the entries after the hole back, so that every entry
+  // stays reachable from its home position
+  table[i] = -1;
+  for (int j = (i + 1) & mask; table[j] >= 0; j = (j + 1) & mask) {
+    const Entry& e = ring[table[j]];
+    int home = hashOf(e.fid, e.pid) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      table[i] = table[j];
+      table[j] = -1;
+      i = j;
+    }
+  }
+}
+
+void GhostList::push(int fid, int pid)
+{
+  remove(fid, pid);
+  if (count == capacity) popOldest();
+  while (used == (int)ring.size()) popOldest();
+
+  int slot = (head + used++) % ring.size();
+  ring[slot].fid = fid;
+  ring[slot].pid = pid;
+  count++;
+
+  unsigned i = hashOf(fid, pid) & mask;
+  while (table[i] >= 0) i = (i + 1) & mask;
+  table[i] = slot;
+}
+
+void GhostList::popOldest()
+{
+  // skip the slots of removed pages
+  while (used > 0) {
+    Entry& e = ring[head];
+    head = (head + 1) % ring.size();
+    used--;
+    if (e.fid != 0) {
+      unindex(find(e.fid, e.pid));
+      e.fid = 0;
+      count--;
+      return;
+    }
+  }
+}
+
+bool GhostList::remove(int fid, int pid)
+{
+  int i = find(fid, pid);
+  if (i < 0) return false;
+
+  // the slot stays in the ring until it becomes the oldest
+  ring[table[i]].fid = 0;
+  unindex(i);
+  count--;
+  return true;
+}
+
+//
+// a list of frames linked through listPrev/listNext.
+// the front is the most recently added frame
+//
+class FrameList {
+ public:
+  FrameList()
+  {
+    head.listPrev = head.listNext = &head;
+    count = 0;
+  }
+
+  int size() const { return count; }
+
+  void pushFront(BufferFrame* f)
+  {
+    f->listNext = head.listNext;
+    f->listPrev = &head;
+    head.listNext->listPrev = f;
+    head.listNext = f;
+    count++;
+  }
+
+  void pushBack(BufferFrame* f)
+  {
+    f->listPrev = head.listPrev;
+    f->listNext = &head;
+    head.listPrev->listNext = f;
+    head.listPrev = f;
+    count++;
+  }
+
+  void remove(BufferFrame* f)
+  {
+    f->listPrev->listNext = f->listNext;
+    f->listNext->listPrev = f->listPrev;
+    f->listPrev = f->listNext = NULL;
+    count--;
+  }
+
+  // the least recently added frame that is not pinned
+  BufferFrame* oldestUnpinned()
+  {
+    for (BufferFrame* f = head.listPrev; f != &head; f = f->listPrev) {
+      if (f->pinCount == 0) return f;
+    }
+    return NULL;
+  }
+
+ private:
+  BufferFrame head;  // sentinel
+  int count;
+};
+
+//
+// LRU. only unpinned frames are listed, so the victim is always
+// at the end of the list. a reinstated frame goes back to the end
+// when it is unpinned, unless its page was used meanwhile
+//
+class LruPolicy : public ReplacementPolicy {
+ public:
+  void inserted(BufferFrame* f) { f->queue = 0; }
+  void reinstated(BufferFrame* f) { f->queue = REINSTATED; }
+  void accessed(BufferFrame* f) { f->queue = 0; }
+  void pinned(BufferFrame* f) { lru.remove(f); }
+
+  void unpinned(BufferFrame* f)
+  {
+    if (f->queue == REINSTATED) lru.pushBack(f);
+    else lru.pushFront(f);
+    f->queue = 0;
+  }
+
+  void removed(BufferFrame* f)
+  {
+    if (f->listNext != NULL) lru.remove(f);
+  }
+
+  BufferFrame* victim()
+  {
+    BufferFrame* f = lru.oldestUnpinned();
+    if (f != NULL) lru.remove(f);
+    return f;
+  }
+
+ private:
+  enum { REINSTATED = 1 };
+
+  FrameList lru;
+};
+
+//
+// CLOCK. the hand sweeps over the frames, and a frame whose page was used
+// since the last sweep gets a second chance
+//
+class ClockPolicy : public ReplacementPolicy {
+ public:
+  ClockPolicy(BufferFrame* frames, int frameCount)
+    : frames(frames), frameCount(frameCount), hand(0) { }
+
+  void inserted(BufferFrame* f) { f->queue = RESIDENT; f->referenced = true; }
+
+  // the hand goes back to the frame, so that it is the next candidate
+  void reinstated(BufferFrame* f)
+  {
+    f->queue = RESIDENT;
+    hand = f - frames;
+  }
+  void accessed(BufferFrame* f) { f->referenced = true; }
+  void pinned(BufferFrame*) { }
+  void unpinned(BufferFrame*) { }
+  void removed(BufferFrame* f) { f->queue = 0; }
+
+  BufferFrame* victim()
+  {
+    // two rounds clear every reference bit, so an unpinned
+    // resident frame is found in the second round at the latest
+    for (int i = 0; i < 2 * frameCount; i++) {
+      BufferFrame* f = &frames[hand];
+      if (++hand == frameCount) hand = 0;
+
+      if (f->queue != RESIDENT || f->pinCount > 0) continue;
+      if (f->referenced) {
+        f->referenced = false;
+        continue;
+      }
+      f->queue = 0;
+      return f;
+    }
+    return NULL;
+  }
+
+ private:
+  enum { RESIDENT = 1 };
+
+  BufferFrame* frames;
+  int frameCount;
+  int hand;
+};
+
+//
+// 2Q (Johnson and Shasha, VLDB 1994). a page enters the FIFO queue a1in
+// and leaves it without promotion however often it is used there, so
+// a scan flows through a1in without touching the pages in am. only a page
+// that comes back after its eviction from a1in, which a1out remembers,
+// is promoted to the LRU queue am.
+//
+class TwoQPolicy : public ReplacementPolicy {
+ public:
+  // the queue sizes recommended by the paper
+  TwoQPolicy(int frameCount) : a1out(frameCount / 2)
+  {
+    maxIn = frameCount / 4;
+    if (maxIn < 1) maxIn = 1;
+  }
+
+  void inserted(BufferFrame* f)
+  {
+    if (a1out.remove(f->fid, f->pid)) {
+      f->queue = AM;
+      am.pushFront(f);
+    } else {
+      f->queue = A1IN;
+      a1in.pushFront(f);
+    }
+  }
+
+  void reinstated(BufferFrame* f)
+  {
+    if (a1out.remove(f->fid, f->pid)) {
+      f->queue = A1IN;
+      a1in.pushBack(f);
+    } else {
+      f->queue = AM;
+      am.pushBack(f);
+    }
+  }
+
+  void accessed(BufferFrame* f)
+  {
+    if (f->queue == AM) {
+      am.remove(f);
+      am.pushFront(f);
+    }
+  }
+
+  void pinned(BufferFrame*) { }
+  void unpinned(BufferFrame*) { }
+
+  void removed(BufferFrame* f)
+  {
+    if (f->queue == A1IN) a1in.remove(f);
+    else if (f->queue == AM) am.remove(f);
+    f->queue = 0;
+  }
+
+  BufferFrame* victim()
+  {
+    BufferFrame* f = NULL;
+
+    if (a1in.size() > maxIn) f = a1in.oldestUnpinned();
+    if (f == NULL) f = am.oldestUnpinned();
+    if (f == NULL) f = a1in.oldestUnpinned();
+    if (f == NULL) return NULL;
+
+    if (f->queue == A1IN) {
+      a1in.remove(f);
+      a1out.push(f->fid, f->pid);
+    } else {
+      am.remove(f);
+    }
+    f->queue = 0;
+    return f;
+  }
+
+ private:
+  enum { A1IN = 1, AM = 2 };
+
+  FrameList a1in;    // pages used once, first in first out
+  FrameList am;      // pages used again, least recently used last
+  GhostList a1out;   // pages recently evicted from a1in
+  int maxIn;         // the size a1in is trimmed to
+};
+
+//
+// ARC (Megiddo and Modha, FAST 2003). t1 holds pages used once and t2
+// pages used at least twice. the ghost lists b1 and b2 remember pages
+// recently evicted from each, and a hit in one of them moves the target
+// size of t1 toward the list that would have kept the page.
+// a table scan uses each page several times in a row, once per record,
+// so uses within CORRELATED_LOADS later loads of the shard count as one,
+// or the scan would be taken for a frequently used set of pages. the
+// window spans two readahead batches, which is all a scan loads while
+// it reads one page. for a page read ahead, the window starts with its
+// first use.
+//
+class ArcPolicy : public ReplacementPolicy {
+ public:
+  ArcPolicy(int frameCount)
+    : b1(frameCount), b2(2 * frameCount), capacity(frameCount), target(0), loads(0) { }
+
+  void inserted(BufferFrame* f)
+  {
+    int b1Size = b1.size();
+    int b2Size = b2.size();
+
+    if (b1.remove(f->fid, f->pid)) {
+      // t1 was too small to keep the page
+      int delta = (b2Size > b1Size) ? b2Size / b1Size : 1;
+      target = (target + delta < capacity) ? target + delta : capacity;
+      f->queue = T2;
+      t2.pushFront(f);
+    } else if (b2.remove(f->fid, f->pid)) {
+      // t2 was too small to keep the page
+      int delta = (b1Size > b2Size) ? b1Size / b2Size : 1;
+      target = (target - delta > 0) ? target - delta : 0;
+      f->queue = T2;
+      t2.pushFront(f);
+    } else {
+      f->queue = T1;
+      t1.pushFront(f);
+    }
+    // loads skips UNUSED when it wraps around
+    if (++loads == UNUSED) ++loads;
+    f->stamp = loads;
+    trimGhosts();
+  }
+
+  // the target is left as it is, since the page never left the cache
+  void reinstated(BufferFrame* f)
+  {
+    if (b1.remove(f->fid, f->pid)) {
+      f->queue = T1;
+      t1.pushBack(f);
+    } else {
+      b2.remove(f->fid, f->pid);
+      f->queue = T2;
+      t2.pushBack(f);
+    }
+  }
+
+  void prefetched(BufferFrame* f) { f->stamp = UNUSED; }
+
+  void accessed(BufferFrame* f)
+  {
+    if (f->queue == T1) {
+      if (f->stamp == UNUSED) {
+        f->stamp = loads;
+        return;
+      }
+      if (loads - f->stamp < CORRELATED_LOADS) return;
+      t1.remove(f);
+    } else {
+      t2.remove(f);
+    }
+    f->queue = T2;
+    t2.pushFront(f);
+  }
+
+  void pinned(BufferFrame*) { }
+  void unpinned(BufferFrame*) { }
+
+  void removed(BufferFrame* f)
+  {
+    if (f->queue == T1) t1.remove(f);
+    else if (f->queue == T2) t2.remove(f);
+    f->queue = 0;
+  }
+
+  BufferFrame* victim()
+  {
+    BufferFrame* f = NULL;
+
+    if (t1.size() > target) f = t1.oldestUnpinned();
+    if (f == NULL) f = t2.oldestUnpinned();
+    if (f == NULL) f = t1.oldestUnpinned();
+    if (f == NULL) return NULL;
+
+    if (f->queue == T1) {
+      t1.remove(f);
+      b1.push(f->fid, f->pid);
+    } else {
+      t2.remove(f);
+      b2.push(f->fid, f->pid);
+    }
+    f->queue = 0;
+    trimGhosts();
+    return f;
+  }
+
+ private:
+  enum { T1 = 1, T2 = 2 };
+  static const unsigned CORRELATED_LOADS =
+    2 * PageFile::READAHEAD_MAX / BufferPool::SHARD_COUNT;
+  static const unsigned UNUSED = 0;  // stamp of a page not used yet
+
+  // keep |t1| + |b1| <= c and |t1| + |t2| + |b1| + |b2| <= 2c
+  void trimGhosts()
+  {
+    while (b1.size() > 0 && t1.size() + b1.size() > capacity) b1.popOldest();
+    while (b2.size() > 0 && t1.size() + t2.size() + b1.size() + b2.size() > 2 * capacity) {
+      b2.popOldest();
+    }
+  }
+
+  FrameList t1;     // resident pages used once
+  FrameList t2;     // resident pages used more than once
+  GhostList b1;     // pages recently evicted from t1
+  GhostList b2;     // pages recently evicted from t2
+  int capacity;     // c, the # of frames
+  int target;       // p, the size t1 should have
+  unsigned loads;   // # of pages taken in so far
+};
+
+ReplacementPolicy* ReplacementPolicy::create(Kind kind, BufferFrame* frames, int frameCount)
+{
+  switch (kind) {
+  case CLOCK:
+    return new ClockPolicy(frames, frameCount);
+  case TWO_Q:
+    return new TwoQPolicy(frameCount);
+  case ARC:
+    return new ArcPolicy(frameCount);
+  default:
+    return new LruPolicy();
+  }
+}
+
+static const char* policyNames[] = { "lru", "clock", "2q", "arc" };
+
+bool ReplacementPolicy::parse(const char* name, Kind& kind)
+{
+  for (int i = 0; i < (int)(sizeof(policyNames) / sizeof(policyNames[0])); i++) {
+    if (strcasecmp(name, policyNames[i]) == 0) {
+      kind = (Kind) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* ReplacementPolicy::nameOf(Kind kind)
+{
+  return policyNames[kind];
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef REPLACEMENTPOLICY_H
+#define REPLACEMENTPOLICY_H
+
+#include <vector>
+#include "Bruinbase.h"
+
+struct BufferFrame;
+
+/**
+ * decides which page of a page cache shard is evicted next.
+ * every shard of the BufferPool has its own policy object, and all of
+ * its functions are called with the shard lock held.
+ *
+ * a frame is known to the policy from inserted() or reinstated() until it
+ * is returned by victim() or passed to removed(). a known frame may be
+ * pinned; victim() must never return a pinned frame.
+ */
+class ReplacementPolicy {
+ public:
+  enum Kind {
+    LRU,    // least recently used
+    CLOCK,  // second chance over a circular sweep of the frames
+    TWO_Q,  // 2Q: pages seen once queue apart from pages seen again
+    ARC     // adaptive replacement cache
+  };
+
+  virtual ~ReplacementPolicy() { }
+
+  /**
+   * create a policy for a shard.
+   * @param kind[IN] the policy to create
+   * @param frames[IN] the frames of the shard
+   * @param frameCount[IN] the number of frames
+   * @return the new policy. the caller deletes it
+   */
+  static ReplacementPolicy* create(Kind kind, BufferFrame* frames, int frameCount);
+
+  /**
+   * look up a policy by the name given on the command line.
+   * @param name[IN] "lru", "clock", "2q" or "arc"
+   * @param kind[OUT] the policy
+   * @return true if the name is known
+   */
+  static bool parse(const char* name, Kind& kind);
+
+  /**
+   * @return the name of the policy
+   */
+  static const char* nameOf(Kind kind);
+
+  /**
+   * a page was just loaded into the frame. the frame is pinned.
+   * @param f[IN] the frame, with its fid and pid set
+   */
+  virtual void inserted(BufferFrame* f) = 0;
+
+  /**
+   * the frame just returned by victim() is taken back, because its page
+   * has to be written first. the frame is pinned. it returns to the place
+   * it was chosen from, as the next candidate once it is unpinned, and
+   * the history victim() recorded for it is dropped, since the page has
+   * not left the cache.
+   * @param f[IN] the frame
+   */
+  virtual void reinstated(BufferFrame* f) = 0;
+
+  /**
+   * the page just inserted was read ahead of its use, so the first
+   * access to it is not a repeated use.
+   * @param f[IN] the frame
+   */
+  virtual void prefetched(BufferFrame*) { }
+
+  /**
+   * the page of a known frame was asked for again.
+   * @param f[IN] the frame
+   */
+  virtual void accessed(BufferFrame* f) = 0;
+
+  /**
+   * the first user pinned a known frame.
+   * @param f[IN] the frame
+   */
+  virtual void pinned(BufferFrame* f) = 0;
+
+  /**
+   * the last user unpinned a known frame.
+   * @param f[IN] the frame
+   */
+  virtual void unpinned(BufferFrame* f) = 0;
+
+  /**
+   * the page of a known frame was dropped from the cache.
+   * the frame is forgotten without leaving any history behind.
+   * @param f[IN] the frame
+   */
+  virtual void removed(BufferFrame* f) = 0;
+
+  /**
+   * choose an unpinned frame to evict and forget it.
+   * @return the frame. NULL if every known frame is pinned
+   */
+  virtual BufferFrame* victim() = 0;
+};
+
+/**
+ * the ids of recently evicted pages, remembered by 2Q and ARC
+ * to recognize a page that comes back soon after its eviction.
+ * the ids are kept in a ring in eviction order, with an open-addressing
+ * hash table over the ring slots to find a page.
+ */
+class GhostList {
+ public:
+  /**
+   * @param capacity[IN] the most pages remembered at once. when a page is
+   *                     pushed onto a full list, the oldest is forgotten
+   */
+  GhostList(int capacity);
+
+  /**
+   * remember a page as the most recent entry.
+   * @param fid[IN] the file id of the page
+   * @param pid[IN] the page id
+   */
+  void push(int fid, int pid);
+
+  /**
+   * forget the oldest entry, if any.
+   */
+  void popOldest();
+
+  /**
+   * forget a page if it is remembered.
+   * @param fid[IN] the file id of the page
+   * @param pid[IN] the page id
+   * @return true if the page was remembered
+   */
+  bool remove(int fid, int pid);
+
+  /**
+   * @return the number of remembered pages
+   */
+  int size() const { return count; }
+
+ private:
+  struct Entry {
+    int fid;      // 0 for a slot whose page was removed
+    int pid;
+  };
+
+  int  find(int fid, int pid) const;
+  void unindex(int slot);
+
+  int capacity;             // the most pages remembered at once
+  std::vector<Entry> ring;  // the pages, oldest at head
+  int head;                 // the slot of the oldest entry
+  int used;                 // # of slots from head on, removed ones included
+  int count;                // # of pages remembered
+  std::vector<int> table;   // hash table of ring slots. -1 if empty
+  int mask;                 // (table size - 1)
+};
+
+#endif // REPLACEMENTPOLICY_H
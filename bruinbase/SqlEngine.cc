@@ -15,6 +15,8 @@
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "KeyColumnFile.h"
+#include "ValueIndex.h"
 #include <climits>
 
 using namespace std;
@@ -23,6 +25,25 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+// the mode SELECT opens its files in: 'r', or 'm' for memory-mapped reads
+char SqlEngine::readMode = 'r';
+
+// # of index entries whose table pages are read in one batch
+static const int FETCH_BATCH = 64;
+
+// an index range with at least one match per BY_PAGE_RATIO table pages
+// has its tuples fetched page by page, in RecordId order
+static const int BY_PAGE_RATIO = 4;
+
+// how full LOAD ... WITH INDEX fills the nodes of a new index, in percent
+int SqlEngine::fillPercent = 90;
+
+// whether SELECT prints the tuples found through an index in key order
+bool SqlEngine::keyOrder = true;
+
+std::map<std::string, IoStats> SqlEngine::fileStats;
+std::vector<FileStats> SqlEngine::lastSelect;
+
 int optimizeQuery(const vector<SelCond> &conditions, int &start_key, int &end_key, bool &use_tree)
 {
   start_key = INT_MIN;
@@ -116,6 +137,111 @@ RC SqlEngine::run(FILE* commandline)
   return 0;
 }
 
+// whether a <> condition on key excludes the key
+static bool excludedKey(const vector<SelCond>& cond, int key)
+{
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1 && cond[i].comp == SelCond::NE &&
+        key == atoi(cond[i].value)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//
+// narrow the conditions on value down to the range [low, high] of the
+// value index, where NULL is an open end. the range may be larger than
+// the conditions, which are checked on every entry anyway.
+// returns false if no condition on value limits the range.
+//
+static bool optimizeValueQuery(const vector<SelCond>& cond, const char*& low, const char*& high)
+{
+  bool found = false;
+
+  low = high = NULL;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 2) continue;
+    const char* v = cond[i].value;
+    switch (cond[i].comp) {
+      case SelCond::EQ:
+        if (low == NULL || strcmp(v, low) > 0) low = v;
+        if (high == NULL || strcmp(v, high) < 0) high = v;
+        break;
+      case SelCond::GT:
+      case SelCond::GE:
+        if (low == NULL || strcmp(v, low) > 0) low = v;
+        break;
+      case SelCond::LT:
+      case SelCond::LE:
+        if (high == NULL || strcmp(v, high) < 0) high = v;
+        break;
+      default:
+        continue;
+    }
+    found = true;
+  }
+  return found;
+}
+
+// whether a SELECT references nothing but keys
+static bool keysOnly(int attr, const vector<SelCond>& cond)
+{
+  if (attr != 1 && attr != 4) return false;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1) return false;
+  }
+  return true;
+}
+
+//
+// compare the value of a tuple with a condition value like strcmp().
+// when only the prefix of a long value was read, the rest is read from
+// its overflow pages only if the prefix cannot tell.
+//
+static RC compareValue(const RecordFile& rf, const RecordId& rid, string& value,
+                       bool& complete, const char* s, int& diff)
+{
+  RC  rc;
+  int key;
+
+  if (!complete) {
+    // the full value is longer than the prefix
+    diff = strncmp(value.c_str(), s, value.size());
+    if (diff != 0) return 0;
+    if (s[value.size()] == '\0') {
+      diff = 1;
+      return 0;
+    }
+    if ((rc = rf.read(rid, key, value)) < 0) return rc;
+    complete = true;
+  }
+
+  diff = strcmp(value.c_str(), s);
+  return 0;
+}
+
+// the # of index matches from which the tuples are fetched page by page
+static long long byPageThreshold(const RecordFile& rf)
+{
+  long long pages = rf.endRid().pid + 1;
+  return (pages / BY_PAGE_RATIO > FETCH_BATCH) ? pages / BY_PAGE_RATIO : FETCH_BATCH;
+}
+
+// count the index entries in [start_key, end_key], stopping at limit
+static long long countRange(BTreeIndex& index, int start_key, int end_key, long long limit)
+{
+  IndexScan scan;
+  int       keys[FETCH_BATCH];
+  RecordId  rids[FETCH_BATCH];
+  long long count = 0;
+  int       n;
+
+  if (scan.open(index, start_key, end_key) < 0) return 0;
+  while (count < limit && (n = scan.next(keys, rids, FETCH_BATCH)) > 0) count += n;
+  return count;
+}
+
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 {
   RecordFile rf;   // RecordFile containing the table
@@ -126,21 +252,50 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   string value;
   int    count;
   int    diff;
+  bool   complete;  // whether value holds the whole value of the tuple
+  FileStats fs;
+
+  int      keys[FETCH_BATCH];   // a batch of matching index entries
+  RecordId rids[FETCH_BATCH];
+  int      n;
+  int      ahead_keys[FETCH_BATCH];   // the batch after it
+  RecordId ahead_rids[FETCH_BATCH];
+  int      ahead;
+  bool     need_tuple;
+  RecordIdBitmap* by_page = NULL;  // the tuples to fetch in RecordId order
   
+  lastSelect.clear();
+
   // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
-    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+  if ((rc = rf.open(table + ".tbl", readMode)) < 0) {
+    if (rc == RC_INVALID_FILE_FORMAT) {
+      fprintf(stderr, "Error: table %s has an unsupported format or page size\n", table.c_str());
+    } else {
+      fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    }
     return rc;
   }
 
   BTreeIndex index;
-  IndexCursor cursor;
+  IndexScan scan;
   int start_key;
   int end_key;
   bool use_tree;
-  bool io_flag;
   string index_file = table + ".idx";
-  int index_error = index.open(index_file, 'r');
+  int index_error = index.open(index_file, readMode);
+  KeyColumnFile kc;
+  string column_file = table + ".key";
+  int column_error = RC_FILE_OPEN_FAILED;
+  ValueIndex vindex;
+  ValueIndexScan vscan;
+  ValueIndex::Entry entries[FETCH_BATCH];
+  string value_index_file = table + ".vidx";
+  int value_error = RC_FILE_OPEN_FAILED;
+  const char* low;   // the range of values to read from the value index
+  const char* high;
+  bool zone_map = rf.hasZoneMap();
+  bool filtered = rf.hasFilters();
+  const char* probe = NULL;  // a value the tuples must equal
   int optimize;
   // optimizeQuery checks start_key < end_key, etc. 
   // Returns -1 if an invalid query. If invalid, go to exit.
@@ -148,15 +303,144 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
     goto exit_select;
   }
 
-  // No index, so just read normally.
-  if (index_error || (!use_tree && attr != 4)) {
+  // an equality condition on value lets the Bloom filters skip pages
+  if (filtered) {
+    for (unsigned i = 0; i < cond.size(); i++) {
+      if (cond[i].attr == 2 && cond[i].comp == SelCond::EQ) probe = cond[i].value;
+    }
+  }
+
+  // No index, but the query needs nothing but keys. Read the key
+  // column of the table instead of the table, if it has one.
+  if ((index_error || (!use_tree && attr != 4)) && keysOnly(attr, cond) &&
+      (column_error = kc.open(column_file, readMode)) == 0) {
+    int column[KeyColumnFile::KEYS_PER_PAGE];
+
+    kc.setAccessPattern(PageFile::SEQUENTIAL);
+    count = 0;
+    for (PageId pid = 0; pid < kc.getPageCount(); pid++) {
+      if ((rc = kc.readPage(pid, column, n)) < 0) {
+        fprintf(stderr, "Error: while reading the key column of table %s\n", table.c_str());
+        goto exit_select;
+      }
+
+      // the conditions on key come down to the range and <> conditions
+      for (int j = 0; j < n; j++) {
+        if (column[j] < start_key || column[j] > end_key || excludedKey(cond, column[j])) continue;
+        count++;
+        if (attr == 1) fprintf(stdout, "%d\n", column[j]);
+      }
+    }
+  }
+
+  // No index on the key range, but the conditions on value limit the
+  // range of values. Read the entries of that range from the value index
+  // of the table, if it has one, in value order.
+  else if ((index_error || !use_tree) && optimizeValueQuery(cond, low, high) &&
+           (value_error = vindex.open(value_index_file, readMode)) == 0) {
+    rf.setAccessPattern(PageFile::RANDOM);
+    count = 0;
+
+    if ((rc = vscan.open(vindex, low, high)) < 0) {
+      fprintf(stderr, "Error: while reading the value index of table %s\n", table.c_str());
+      goto exit_select;
+    }
+
+    while ((n = vscan.next(entries, FETCH_BATCH)) > 0) {
+      for (int j = 0; j < n; j++) {
+        // the entry holds the key, and the value unless it is long
+        rid = entries[j].rid;
+        key = entries[j].key;
+        value.assign(entries[j].value, entries[j].size());
+        complete = entries[j].complete();
+        if (key < start_key || key > end_key || excludedKey(cond, key)) continue;
+
+        // check the conditions on value
+        for (unsigned i = 0; i < cond.size(); i++) {
+          if (cond[i].attr != 2) continue;
+          if ((rc = compareValue(rf, rid, value, complete, cond[i].value, diff)) < 0) {
+            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+            goto exit_select;
+          }
+
+          switch (cond[i].comp) {
+            case SelCond::EQ:
+              if (diff != 0) goto next_value;
+              break;
+            case SelCond::NE:
+              if (diff == 0) goto next_value;
+              break;
+            case SelCond::GT:
+              if (diff <= 0) goto next_value;
+              break;
+            case SelCond::LT:
+              if (diff >= 0) goto next_value;
+              break;
+            case SelCond::GE:
+              if (diff < 0) goto next_value;
+              break;
+            case SelCond::LE:
+              if (diff > 0) goto next_value;
+              break;
+          }
+        }
+
+        // the condition is met for the tuple. 
+        // increase matching tuple counter
+        count++;
+
+        // a printed value must be complete
+        if ((attr == 2 || attr == 3) && !complete && (rc = rf.read(rid, key, value)) < 0) {
+          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+          goto exit_select;
+        }
+
+        // print the tuple 
+        switch (attr) {
+          case 1:  // SELECT key
+            fprintf(stdout, "%d\n", key);
+            break;
+          case 2:  // SELECT value
+            fprintf(stdout, "%s\n", value.c_str());
+            break;
+          case 3:  // SELECT *
+            fprintf(stdout, "%d '%s'\n", key, value.c_str());
+            break;
+        }
+
+        next_value:
+        ;
+      }
+    }
+    if ((rc = n) < 0) {
+      fprintf(stderr, "Error: while reading the value index of table %s\n", table.c_str());
+      goto exit_select;
+    }
+  }
+
+  // No index, so just read normally. A count with no key range, which
+  // would read every tuple through the index, is also done here when the
+  // Bloom filters can skip the pages without the value.
+  else if (index_error || (!use_tree && (attr != 4 || probe))) {
     // fprintf(stderr, "NOT USING INDEX\n");
+    rf.setAccessPattern(PageFile::SEQUENTIAL);
+
     // scan the table file from the beginning
     rid.pid = rid.sid = 0;
     count = 0;
     while (rid < rf.endRid()) {
-      // read the tuple
-      if ((rc = rf.read(rid, key, value)) < 0) {
+      // skip the pages whose keys are all out of the range,
+      // or whose Bloom filter rules out the value
+      if (rid.sid == 0 && (start_key > INT_MIN || end_key < INT_MAX || probe)) {
+        if ((rc = rf.skipPages(rid, start_key, end_key, probe)) < 0) {
+          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+          goto exit_select;
+        }
+        if (rid >= rf.endRid()) break;
+      }
+
+      // read the tuple, leaving a long value on its overflow pages
+      if ((rc = rf.readInline(rid, key, value, complete)) < 0) {
         fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
         goto exit_select;
       }
@@ -169,7 +453,10 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
           diff = key - atoi(cond[i].value);
           break;
         case 2:
-          diff = strcmp(value.c_str(), cond[i].value);
+          if ((rc = compareValue(rf, rid, value, complete, cond[i].value, diff)) < 0) {
+            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+            goto exit_select;
+          }
           break;
         }
 
@@ -200,6 +487,12 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
       // increase matching tuple counter
       count++;
 
+      // a printed value must be complete
+      if ((attr == 2 || attr == 3) && !complete && (rc = rf.read(rid, key, value)) < 0) {
+        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+        goto exit_select;
+      }
+
       // print the tuple 
       switch (attr) {
         case 1:  // SELECT key
@@ -215,13 +508,17 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
       // move to the next tuple
       next_tuple:
-      ++rid;
+      if ((rc = rf.next(rid)) < 0) {
+        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+        goto exit_select;
+      }
     }
   }
 
   // Use BTreeIndex
   else {
     // fprintf(stderr, "USING INDEX\n");
+    rf.setAccessPattern(PageFile::RANDOM);
     count = 0;
 
     // Getting count(*) with no select conditions. Return index's keyCount
@@ -230,83 +527,133 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
       goto exit_while;
     }
 
-    index.locate(start_key, cursor);
+    // the tuple is needed for a condition on value or to print the value
+    need_tuple = (attr == 2 || attr == 3);
+    for (unsigned i = 0; i < cond.size(); i++) {
+      if (cond[i].attr == 2) need_tuple = true;
+    }
 
-    while (index.readForward(cursor, key, rid) == 0) {
-      io_flag = false;
+    // read the index entries in batches from one leaf at a time,
+    // so that the tuples of a whole batch are fetched together
+    if ((rc = scan.open(index, start_key, end_key)) < 0) {
+      fprintf(stderr, "Error: while reading the index of table %s\n", table.c_str());
+      goto exit_select;
+    }
 
-      if (key > end_key)
-        goto exit_while;
+    // when the range matches many tuples, collect all their RecordIds
+    // first and fetch them in RecordId order, so that each table page is
+    // read once for all of its tuples. the tuples then come out in table
+    // order, so this is only done when key order is not wanted.
+    if (need_tuple && (attr == 4 || !keyOrder) &&
+        countRange(index, start_key, end_key, byPageThreshold(rf)) >= byPageThreshold(rf)) {
+      by_page = new RecordIdBitmap(rf);
+      while ((n = scan.next(keys, rids, FETCH_BATCH)) > 0) {
+        for (int j = 0; j < n; j++) {
+          if (!excludedKey(cond, keys[j])) by_page->add(rids[j]);
+        }
+      }
+      if ((rc = n) < 0) {
+        fprintf(stderr, "Error: while reading the index of table %s\n", table.c_str());
+        goto exit_select;
+      }
+      rf.setAccessPattern(PageFile::SEQUENTIAL);
+    }
 
-      for (unsigned i = 0; i < cond.size(); i++) {
-        if (cond[i].attr == 1 &&
-            cond[i].comp == SelCond::NE &&
-            atoi(cond[i].value)) {
-          goto cursor_forward;
+    // while a batch is processed, the table pages of the next batch
+    // are read in the background, so that they are mostly in the cache
+    // by the time the batch comes up
+    n = by_page ? by_page->next(rids, FETCH_BATCH) : scan.next(keys, rids, FETCH_BATCH);
+    for (; n > 0; n = ahead) {
+      ahead = by_page ? by_page->next(ahead_rids, FETCH_BATCH)
+                      : scan.next(ahead_keys, ahead_rids, FETCH_BATCH);
+      if (need_tuple) {
+        rf.prefetch(rids, n);
+        if (ahead > 0) rf.willNeed(ahead_rids, ahead);
+      }
+
+      for (int j = 0; j < n; j++) {
+        rid = rids[j];
+
+        // the index range covers every key condition but <>.
+        // the keys fetched by page were checked when collected
+        if (!by_page) {
+          key = keys[j];
+          if (excludedKey(cond, key)) goto next_entry;
         }
 
-        else if (cond[i].attr == 2) {
-          // read the tuple
-          if (!io_flag) {
-            if ((rc = rf.read(rid, key, value)) < 0) {
-              fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-              goto exit_select;
-            }
+        // read the tuple
+        if (need_tuple) {
+          if ((rc = rf.readInline(rid, key, value, complete)) < 0) {
+            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+            goto exit_select;
           }
+        }
 
-          io_flag = true;
-          diff = strcmp(value.c_str(), cond[i].value);
+        // check the conditions on value
+        for (unsigned i = 0; i < cond.size(); i++) {
+          if (cond[i].attr != 2) continue;
+          if ((rc = compareValue(rf, rid, value, complete, cond[i].value, diff)) < 0) {
+            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+            goto exit_select;
+          }
 
           switch (cond[i].comp) {
             case SelCond::EQ:
-              if (diff != 0) goto next_tuple;
+              if (diff != 0) goto next_entry;
               break;
             case SelCond::NE:
-              if (diff == 0) goto next_tuple;
+              if (diff == 0) goto next_entry;
               break;
             case SelCond::GT:
-              if (diff <= 0) goto next_tuple;
+              if (diff <= 0) goto next_entry;
               break;
             case SelCond::LT:
-              if (diff >= 0) goto next_tuple;
+              if (diff >= 0) goto next_entry;
               break;
             case SelCond::GE:
-              if (diff < 0) goto next_tuple;
+              if (diff < 0) goto next_entry;
               break;
             case SelCond::LE:
-              if (diff > 0) goto next_tuple;
+              if (diff > 0) goto next_entry;
               break;
           }
         }
-      }
 
-      // the condition is met for the tuple. 
-      // increase matching tuple counter
-      count++;
+        // the condition is met for the tuple. 
+        // increase matching tuple counter
+        count++;
 
-      if ((attr == 2 || attr == 3) && !io_flag) {
-          // read the tuple
-          if ((rc = rf.read(rid, key, value)) < 0) {
-            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-            goto exit_select;
-          }
-      }
+        // a printed value must be complete
+        if ((attr == 2 || attr == 3) && !complete && (rc = rf.read(rid, key, value)) < 0) {
+          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+          goto exit_select;
+        }
 
-      // print the tuple 
-      switch (attr) {
-        case 1:  // SELECT key
-          fprintf(stdout, "%d\n", key);
-          break;
-        case 2:  // SELECT value
-          fprintf(stdout, "%s\n", value.c_str());
-          break;
-        case 3:  // SELECT *
-          fprintf(stdout, "%d '%s'\n", key, value.c_str());
-          break;
+        // print the tuple 
+        switch (attr) {
+          case 1:  // SELECT key
+            fprintf(stdout, "%d\n", key);
+            break;
+          case 2:  // SELECT value
+            fprintf(stdout, "%s\n", value.c_str());
+            break;
+          case 3:  // SELECT *
+            fprintf(stdout, "%d '%s'\n", key, value.c_str());
+            break;
+        }
+
+        next_entry:
+        ;
       }
 
-      cursor_forward:
-      ;
+      if (ahead > 0) {
+        memcpy(keys, ahead_keys, ahead * sizeof(int));
+        memcpy(rids, ahead_rids, ahead * sizeof(RecordId));
+      }
+    }
+    if ((rc = n) < 0) {
+      fprintf(stderr, "Error: while reading the index of table %s\n", table.c_str());
+      goto exit_select;
     }
   }
 
@@ -319,29 +666,139 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
   // close the table file and return
   exit_select:
+  scan.close();
+  vscan.close();
+  delete by_page;
   if (!index_error) {
     index.close();
   }
+  if (!column_error) {
+    kc.close();
+  }
+  if (!value_error) {
+    vindex.close();
+  }
   rf.close();
+
+  // remember what the select did to each file
+  fs.name = table + ".tbl";
+  fs.stats = rf.getStats();
+  lastSelect.push_back(fs);
+  if (!index_error) {
+    fs.name = index_file;
+    fs.stats = index.getStats();
+    lastSelect.push_back(fs);
+  }
+  if (!column_error) {
+    fs.name = column_file;
+    fs.stats = kc.getStats();
+    lastSelect.push_back(fs);
+  }
+  if (!value_error) {
+    fs.name = value_index_file;
+    fs.stats = vindex.getStats();
+    lastSelect.push_back(fs);
+  }
+  if (zone_map) {
+    fs.name = table + ".zone";
+    fs.stats = rf.getZoneStats();
+    lastSelect.push_back(fs);
+  }
+  if (filtered) {
+    fs.name = table + ".bloom";
+    fs.stats = rf.getFilterStats();
+    lastSelect.push_back(fs);
+  }
+  for (unsigned i = 0; i < lastSelect.size(); i++) {
+    recordStats(lastSelect[i].name, lastSelect[i].stats);
+  }
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+RC SqlEngine::load(const string& table, const string& loadfile, bool index, bool columns,
+                   bool valueIndex)
 {
   string tablename = table + ".tbl";
+  string indexname = table + ".idx";
+  string columnname = table + ".key";
+  string valuename = table + ".vidx";
   RecordFile rf;
   RecordId   rid;  
   RC     rc;
   BTreeIndex b;
+  KeyColumnFile kc;
+  ExternalSort entries(sizeof(IndexEntry), BTreeIndex::entryLess);
+  ValueIndex vi;
+  ValueIndex::Entry ventry;
+  ExternalSort values(sizeof(ValueIndex::Entry), ValueIndex::entryLess);
+
+  // a table that has a key column keeps it up to date
+  if (!columns && kc.open(columnname, 'r') == 0) {
+    columns = true;
+    kc.close();
+  }
+
+  // and so does a table that has a value index
+  if (!valueIndex && vi.open(valuename, 'r') == 0) {
+    valueIndex = true;
+    vi.close();
+  }
    
   // create index if necessary 
   if (index)
   {
-    string indexname = table + ".idx";
     b.open(indexname, 'w'); 
   }
   
-  rc = rf.open(tablename, 'w');
+  if ((rc = rf.open(tablename, 'w')) < 0) {
+    fprintf(stderr, "Error: cannot open table %s\n", table.c_str());
+    if (index) {
+      b.close();
+      recordStats(indexname, b.getStats());
+    }
+    return rc;
+  }
+
+  if (columns) {
+    if ((rc = kc.open(columnname, 'w')) < 0) {
+      fprintf(stderr, "Error: cannot open the key column of table %s\n", table.c_str());
+      columns = false;
+    } else if (kc.getKeyCount() == 0) {
+      // a new key column of a table with records starts with their keys
+      int    key;
+      string value;
+      bool   complete;
+      for (rid.pid = rid.sid = 0; rid < rf.endRid(); ) {
+        if ((rc = rf.readInline(rid, key, value, complete)) < 0 ||
+            (rc = kc.append(key)) < 0 || (rc = rf.next(rid)) < 0) {
+          fprintf(stderr, "Error: while building the key column of table %s\n", table.c_str());
+          break;
+        }
+      }
+    }
+  }
+
+  if (valueIndex) {
+    if ((rc = vi.open(valuename, 'w')) < 0) {
+      fprintf(stderr, "Error: cannot open the value index of table %s\n", table.c_str());
+      valueIndex = false;
+    } else if (vi.getEntryCount() == 0) {
+      // a new value index of a table with records starts with their values
+      int    key;
+      string value;
+      for (rid.pid = rid.sid = 0; rid < rf.endRid(); ) {
+        if ((rc = rf.read(rid, key, value)) < 0) {
+          fprintf(stderr, "Error: while building the value index of table %s\n", table.c_str());
+          break;
+        }
+        ValueIndex::makeEntry(value, key, rid, ventry);
+        if ((rc = values.add(&ventry)) < 0 || (rc = rf.next(rid)) < 0) {
+          fprintf(stderr, "Error: while building the value index of table %s\n", table.c_str());
+          break;
+        }
+      }
+    }
+  }
   
   ifstream fin;
   fin.open(loadfile.c_str());
@@ -353,23 +810,116 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
     string value;
     parseLoadLine(line, key, value);
     rf.append(key, value, rid);
+    if (columns) kc.append(key);
     if (index)
     {
-      b.insert(key, rid);
+      // full buffers of entries are sorted while the load goes on
+      IndexEntry entry = { key, rid };
+      entries.add(&entry);
+    }
+    if (valueIndex)
+    {
+      ValueIndex::makeEntry(value, key, rid, ventry);
+      values.add(&ventry);
     }
   }
   
+  bool zone_map = rf.hasZoneMap();
+  bool filtered = rf.hasFilters();
   rf.close();
   fin.close();
-  // close index if necessary 
+  recordStats(tablename, rf.getStats());
+  if (zone_map) recordStats(table + ".zone", rf.getZoneStats());
+  if (filtered) recordStats(table + ".bloom", rf.getFilterStats());
+  if (columns) {
+    kc.close();
+    recordStats(columnname, kc.getStats());
+  }
+  // build and close index if necessary 
   if (index)
   {
+    if (entries.finish() != 0 || b.bulkLoad(entries, fillPercent) != 0) {
+      fprintf(stderr, "Error: while building the index of table %s\n", table.c_str());
+    }
     b.close();
+    recordStats(indexname, b.getStats());
+    if (entries.getRunCount() > 0) recordStats("(sort)", entries.getStats());
+  }
+  // and the value index
+  if (valueIndex)
+  {
+    if (values.finish() != 0 || vi.build(values, fillPercent) != 0) {
+      fprintf(stderr, "Error: while building the value index of table %s\n", table.c_str());
+    }
+    vi.close();
+    recordStats(valuename, vi.getStats());
+    if (values.getRunCount() > 0) recordStats("(sort)", values.getStats());
   }
   
   return rc;
 }
 
+void SqlEngine::recordStats(const string& name, const IoStats& stats)
+{
+  fileStats[name].add(stats);
+}
+
+// print one row of the statistics table
+static void printStatsRow(const char* name, const IoStats& s)
+{
+  fprintf(stdout, "%-16s %10lld %10lld %10lld %10lld %10lld %9.2f %9.2f\n",
+          name, s.reads, s.writes, s.cacheHits, s.cacheMisses, s.evictions,
+          s.bytesRead / 1048576.0, s.bytesWritten / 1048576.0);
+}
+
+// print the non-empty buckets of a latency histogram
+static void printHistogram(const char* title, const long long* buckets)
+{
+  long long total = 0;
+  for (int i = 0; i < IoStats::LATENCY_BUCKETS; i++) total += buckets[i];
+
+  fprintf(stdout, "%s latency (%lld)\n", title, total);
+  if (total == 0) return;
+
+  for (int i = 0; i < IoStats::LATENCY_BUCKETS; i++) {
+    if (buckets[i] == 0) continue;
+    if (i == 0) {
+      fprintf(stdout, "  %10s us", "< 1");
+    } else if (i == 1) {
+      fprintf(stdout, "  %10s us", "1");
+    } else if (i == IoStats::LATENCY_BUCKETS - 1) {
+      fprintf(stdout, "  >= %7lld us", 1LL << (i - 1));
+    } else {
+      fprintf(stdout, "  %4lld-%-5lld us", 1LL << (i - 1), (1LL << i) - 1);
+    }
+    fprintf(stdout, " %10lld %5.1f%%\n", buckets[i], buckets[i] * 100.0 / total);
+  }
+}
+
+void SqlEngine::showStats()
+{
+  fprintf(stdout, "%-16s %10s %10s %10s %10s %10s %9s %9s\n", "file", "reads",
+          "writes", "hits", "misses", "evictions", "MB read", "MB written");
+
+  map<string, IoStats>::const_iterator it;
+  for (it = fileStats.begin(); it != fileStats.end(); ++it) {
+    printStatsRow(it->first.c_str(), it->second);
+  }
+
+  const IoStats& total = PageFile::getTotalStats();
+  printStatsRow("(total)", total);
+
+  printHistogram("read", total.readLatency);
+  printHistogram("write", total.writeLatency);
+}
+
+
+RC SqlEngine::setFillPercent(int percent)
+{
+  if (percent < 1 || percent > 100) return RC_INVALID_ATTRIBUTE;
+  fillPercent = percent;
+  return 0;
+}
 
 RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
 {
@@ -11,6 +11,8 @@
 #define SQLENGINE_H
 
 #include <vector>
+#include <map>
+#include <string>
 #include "Bruinbase.h"
 #include "RecordFile.h"
 
@@ -23,6 +25,14 @@ struct SelCond {
   char* value;  // the value to compare
 };
 
+/**
+ * the I/O statistics of one file accessed by a command
+ */
+struct FileStats {
+  std::string name;   // the file name
+  IoStats     stats;  // what the command did to the file
+};
+
 /**
  * the class that takes, parses, and executes the user commands.
  */
@@ -55,9 +65,18 @@ class SqlEngine {
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
    * @param index[IN] true if "WITH INDEX" option was specified
+   * @param columns[IN] true if "WITH COLUMNS" option was specified. the
+   *                    keys also go to a key column file, which SELECTs
+   *                    that reference no value scan instead of the table.
+   *                    once a table has one, every load keeps it up to date
+   * @param valueIndex[IN] true if "WITH INDEX ON value" option was specified.
+   *                    the values also go to a ValueIndex, which SELECTs
+   *                    with a condition on value read instead of the table.
+   *                    once a table has one, every load keeps it up to date
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC load(const std::string& table, const std::string& loadfile, bool index, bool columns,
+                 bool valueIndex);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -67,6 +86,56 @@ class SqlEngine {
    * @return error code. 0 if no error
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
+
+  /**
+   * make SELECT read the table and index files through memory mappings
+   * instead of the page cache.
+   * @param on[IN] true to map the files
+   */
+  static void setMappedReads(bool on) { readMode = on ? 'm' : 'r'; }
+
+  /**
+   * set how full LOAD ... WITH INDEX fills the nodes of a new index.
+   * a lower fill factor leaves room for later loads into the same table.
+   * @param percent[IN] the fill factor in percent, from 1 to 100
+   * @return error code. 0 if no error
+   */
+  static RC setFillPercent(int percent);
+
+  /**
+   * set whether SELECT prints the tuples it finds through an index in
+   * key order. without key order, a range that matches many tuples has
+   * them fetched in RecordId order instead, reading each table page once.
+   * count(*) never needs the order.
+   * @param on[IN] true to keep key order (the default)
+   */
+  static void setKeyOrder(bool on) { keyOrder = on; }
+
+  /**
+   * print the I/O statistics of every file accessed so far,
+   * the totals, and the latency histograms of disk reads and writes.
+   */
+  static void showStats();
+
+  /**
+   * @return the I/O statistics of the files the last SELECT accessed
+   */
+  static const std::vector<FileStats>& getLastSelectStats() { return lastSelect; }
+
+ private:
+  /**
+   * add the statistics of a closed file to the cumulative ones.
+   * @param name[IN] the file name
+   * @param stats[IN] the statistics of the file since it was opened
+   */
+  static void recordStats(const std::string& name, const IoStats& stats);
+
+  static char readMode;  // the mode SELECT opens its files in
+  static int fillPercent;  // the node fill factor of LOAD ... WITH INDEX
+  static bool keyOrder;    // whether index matches are printed in key order
+
+  static std::map<std::string, IoStats> fileStats;  // cumulative, per file
+  static std::vector<FileStats> lastSelect;         // files of the last SELECT
 };
 
 #endif /* SQLENGINE_H */
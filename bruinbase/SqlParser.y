@@ -17,15 +17,19 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 {
   struct tms tmsbuf;
   clock_t btime, etime;
-  int     bpagecnt, epagecnt;
 
   btime = times(&tmsbuf);
-  bpagecnt = PageFile::getPageReadCount();
   SqlEngine::select(attr, table, conds);
   etime = times(&tmsbuf);
-  epagecnt = PageFile::getPageReadCount();
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+  fprintf(stderr, "  -- %.3f seconds to run the select command.", ((float)(etime - btime))/sysconf(_SC_CLK_TCK));
+
+  const std::vector<FileStats>& files = SqlEngine::getLastSelectStats();
+  for (unsigned i = 0; i < files.size(); i++) {
+    fprintf(stderr, " %s: read %lld pages, %lld cache hits.", files[i].name.c_str(),
+            files[i].stats.reads, files[i].stats.cacheHits);
+  }
+  fprintf(stderr, "\n");
 }
 
 %}
@@ -37,12 +41,12 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   std::vector<SelCond>* conds;
 }
 
-%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
+%token SELECT FROM WHERE LOAD WITH INDEX ON COLUMNS QUIT COUNT AND OR SHOW STATS
 %token COMMA STAR LF
 %token <string> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
 
-%type <integer> attributes attribute comparator
+%type <integer> attributes attribute comparator load_options load_option
 %type <string> table value
 %type <cond> condition
 %type <conds> conditions
@@ -56,6 +60,7 @@ commands:
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
+	| show_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
@@ -65,19 +70,34 @@ quit_command:
 	QUIT { return 0; }
 	;
 
+show_command:
+	SHOW STATS LF { SqlEngine::showStats(); }
+	;
+
 load_command:
 	LOAD table FROM STRING LF { 
-	  SqlEngine::load(std::string($2), std::string($4), false); 
+	  SqlEngine::load(std::string($2), std::string($4), false, false, false); 
 	  free($2);
 	  free($4);
 	}
-	| LOAD table FROM STRING WITH INDEX LF { 
-	  SqlEngine::load(std::string($2), std::string($4), true); 
+	| LOAD table FROM STRING WITH load_options LF { 
+	  SqlEngine::load(std::string($2), std::string($4), ($6 & 1) != 0, ($6 & 2) != 0, ($6 & 4) != 0); 
 	  free($2);
 	  free($4);
 	}
 	;
 
+load_options:
+	load_option { $$ = $1; }
+	| load_options COMMA load_option { $$ = $1 | $3; }
+	;
+
+load_option:
+	INDEX { $$ = 1; }
+	| INDEX ON attribute { $$ = ($3 == 2) ? 4 : 1; }
+	| COLUMNS { $$ = 2; }
+	;
+
 select_command:
 	SELECT attributes FROM table LF {
    	        std::vector<SelCond> conds;
@@ -0,0 +1,554 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "Bruinbase.h"
+#include "ValueIndex.h"
+
+using std::string;
+using std::vector;
+
+// page 0 of a value index: its FileHeader and the shape of the tree
+struct ValueIndexHeader {
+  FileHeader header;
+  PageId     rootPid;
+  int        treeHeight;
+  long long  entryCount;
+};
+
+//
+// a node is a slotted page: [int count][int level][PageId link], the
+// offsets of its entries in order, and the entries packed from the back.
+// level 0 is a leaf, whose link is its right sibling, or 0 if it is the
+// last one. the link of an internal node is its leftmost child.
+//
+// a leaf entry is [int length][value characters][int key][RecordId rid],
+// with min(length, MAX_KEY_LENGTH) characters. an internal entry is
+// [int length][separator characters][PageId child], and the subtree of
+// child holds the keys from the separator on.
+//
+static const int NODE_HEADER = 2 * sizeof(int) + sizeof(PageId);
+
+static int nodeCount(const char* page)
+{
+  int count;
+  memcpy(&count, page, sizeof(int));
+  return count;
+}
+
+static int nodeLevel(const char* page)
+{
+  int level;
+  memcpy(&level, page + sizeof(int), sizeof(int));
+  return level;
+}
+
+static PageId nodeLink(const char* page)
+{
+  PageId link;
+  memcpy(&link, page + 2 * sizeof(int), sizeof(PageId));
+  return link;
+}
+
+static const char* nodeEntry(const char* page, int n)
+{
+  int offset;
+  memcpy(&offset, page + NODE_HEADER + n * sizeof(int), sizeof(int));
+  return page + offset;
+}
+
+// the key of the n'th entry of a node, and its length
+static const char* nodeKey(const char* page, int n, int& length)
+{
+  const char* entry = nodeEntry(page, n);
+
+  memcpy(&length, entry, sizeof(int));
+  if (length > ValueIndex::MAX_KEY_LENGTH) length = ValueIndex::MAX_KEY_LENGTH;
+  return entry + sizeof(int);
+}
+
+// the child of the n'th entry of an internal node
+static PageId nodeChild(const char* page, int n)
+{
+  int    length;
+  PageId child;
+  const char* key = nodeKey(page, n, length);
+
+  memcpy(&child, key + length, sizeof(PageId));
+  return child;
+}
+
+static void readLeafEntry(const char* page, int n, ValueIndex::Entry& entry)
+{
+  const char* ptr = nodeEntry(page, n);
+
+  memcpy(&entry.length, ptr, sizeof(int));
+  ptr += sizeof(int);
+  memcpy(entry.value, ptr, entry.size());
+  ptr += entry.size();
+  memcpy(&entry.key, ptr, sizeof(int));
+  memcpy(&entry.rid, ptr + sizeof(int), sizeof(RecordId));
+}
+
+// compare two strings of the given lengths like strcmp()
+static int compareKeys(const char* a, int alen, const char* b, int blen)
+{
+  int diff = memcmp(a, b, (alen < blen) ? alen : blen);
+  if (diff != 0) return diff;
+  return alen - blen;
+}
+
+// the # of keys of a node that are smaller than key
+static int countSmaller(const char* page, const char* key, int keylen)
+{
+  int low = 0;
+  int high = nodeCount(page);
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    int length;
+    const char* k = nodeKey(page, mid, length);
+    if (compareKeys(k, length, key, keylen) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// the shortest prefix of right that is still larger than left.
+// right itself if they are equal
+static string separator(const string& left, const char* right, int rlen)
+{
+  int n = ((int) left.size() < rlen) ? left.size() : rlen;
+  int i = 0;
+
+  while (i < n && left[i] == right[i]) i++;
+  if (i < rlen && (i == (int) left.size() || (unsigned char) right[i] > (unsigned char) left[i])) {
+    return string(right, i + 1);
+  }
+  return string(right, rlen);
+}
+
+//
+// builds a tree bottom-up from entries in sorted order. every level has
+// one open node, which is written when it is full and replaced by its
+// right sibling. the separator in front of the sibling goes up a level.
+//
+class TreeBuilder {
+ public:
+  TreeBuilder(PageFile& pf, int fillPercent);
+
+  RC add(const ValueIndex::Entry& entry);
+  RC finish(PageId& root, int& height);
+
+  long long count;   // # of entries added
+
+ private:
+  void startNode(int level, PageId link);
+  bool fits(int level, int size) const;
+  void append(int level, const char* data, int size);
+  RC   push(int level, const string& sep, PageId left, PageId right);
+
+  PageFile&              pf;
+  int                    limit;    // the most bytes a node is filled with
+  PageId                 nextPid;  // the next page to allocate
+  vector< vector<char> > nodes;    // the open node of each level
+  vector<PageId>         pids;     // and its page
+  string                 lastKey;  // the key of the last entry added
+};
+
+TreeBuilder::TreeBuilder(PageFile& pf, int fillPercent) : pf(pf)
+{
+  count = 0;
+  limit = PageFile::PAGE_SIZE * fillPercent / 100;
+  nextPid = 1;
+}
+
+void TreeBuilder::startNode(int level, PageId link)
+{
+  if ((int) nodes.size() <= level) {
+    nodes.resize(level + 1, vector<char>(PageFile::PAGE_SIZE));
+    pids.resize(level + 1);
+  }
+
+  char* page = &nodes[level][0];
+  int   count = 0;
+  memset(page, 0, PageFile::PAGE_SIZE);
+  memcpy(page, &count, sizeof(int));
+  memcpy(page + sizeof(int), &level, sizeof(int));
+  memcpy(page + 2 * sizeof(int), &link, sizeof(PageId));
+  pids[level] = nextPid++;
+}
+
+bool TreeBuilder::fits(int level, int size) const
+{
+  const char* page = &nodes[level][0];
+  int count = nodeCount(page);
+  int end = (count == 0) ? PageFile::PAGE_SIZE : nodeEntry(page, count - 1) - page;
+  int free = end - (NODE_HEADER + (count + 1) * (int) sizeof(int));
+
+  // a node takes at least two entries, whatever the fill factor
+  if (free < size) return false;
+  return count < 2 || PageFile::PAGE_SIZE - free + size <= limit;
+}
+
+void TreeBuilder::append(int level, const char* data, int size)
+{
+  char* page = &nodes[level][0];
+  int   count = nodeCount(page);
+  int   end = (count == 0) ? PageFile::PAGE_SIZE : nodeEntry(page, count - 1) - page;
+  int   offset = end - size;
+
+  memcpy(page + offset, data, size);
+  memcpy(page + NODE_HEADER + count * sizeof(int), &offset, sizeof(int));
+  count++;
+  memcpy(page, &count, sizeof(int));
+}
+
+RC TreeBuilder::push(int level, const string& sep, PageId left, PageId right)
+{
+  RC     rc;
+  char   data[sizeof(int) + ValueIndex::MAX_KEY_LENGTH + sizeof(PageId)];
+  int    length = sep.size();
+  int    size = sizeof(int) + length + sizeof(PageId);
+
+  // the first node of a new level starts with the node on the left
+  if ((int) nodes.size() == level) startNode(level, left);
+
+  if (!fits(level, size)) {
+    // the separator goes up, in front of the new node
+    PageId full = pids[level];
+    if ((rc = pf.write(full, &nodes[level][0])) < 0) return rc;
+    startNode(level, right);
+    return push(level + 1, sep, full, pids[level]);
+  }
+
+  memcpy(data, &length, sizeof(int));
+  memcpy(data + sizeof(int), sep.data(), length);
+  memcpy(data + sizeof(int) + length, &right, sizeof(PageId));
+  append(level, data, size);
+  return 0;
+}
+
+RC TreeBuilder::add(const ValueIndex::Entry& entry)
+{
+  RC   rc;
+  char data[sizeof(ValueIndex::Entry) + sizeof(int)];
+  int  n = entry.size();
+  int  size = sizeof(int) + n + sizeof(int) + sizeof(RecordId);
+
+  if (nodes.empty()) startNode(0, 0);
+
+  if (!fits(0, size)) {
+    // link the full leaf to its sibling, and start the sibling
+    PageId full = pids[0];
+    PageId next = nextPid;
+    memcpy(&nodes[0][0] + 2 * sizeof(int), &next, sizeof(PageId));
+    if ((rc = pf.write(full, &nodes[0][0])) < 0) return rc;
+    startNode(0, 0);
+    if ((rc = push(1, separator(lastKey, entry.value, n), full, next)) < 0) return rc;
+  }
+
+  memcpy(data, &entry.length, sizeof(int));
+  memcpy(data + sizeof(int), entry.value, n);
+  memcpy(data + sizeof(int) + n, &entry.key, sizeof(int));
+  memcpy(data + 2 * sizeof(int) + n, &entry.rid, sizeof(RecordId));
+  append(0, data, size);
+
+  lastKey.assign(entry.value, n);
+  count++;
+  return 0;
+}
+
+RC TreeBuilder::finish(PageId& root, int& height)
+{
+  RC rc;
+
+  root = 0;
+  height = nodes.size();
+  for (int level = 0; level < height; level++) {
+    if ((rc = pf.write(pids[level], &nodes[level][0])) < 0) return rc;
+  }
+  if (height > 0) root = pids[height - 1];
+  return 0;
+}
+
+
+ValueIndex::ValueIndex()
+{
+  mode = 'r';
+  rootPid = 0;
+  treeHeight = 0;
+  entryCount = 0;
+}
+
+RC ValueIndex::open(const string& indexname, char mode)
+{
+  RC rc;
+
+  name = indexname;
+  this->mode = mode;
+  rootPid = 0;
+  treeHeight = 0;
+  entryCount = 0;
+  replaced.clear();
+
+  if ((rc = pf.open(indexname, mode)) < 0) return rc;
+
+  if (pf.endPid() == 0) {
+    // a new index
+    if (mode == 'w' || mode == 'W') rc = writeHeader();
+  } else {
+    rc = readHeader();
+  }
+  if (rc < 0) pf.close();
+  return rc;
+}
+
+RC ValueIndex::close()
+{
+  RC rc = 0;
+
+  if (mode == 'w' || mode == 'W') rc = writeHeader();
+  if (pf.close() < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  return rc;
+}
+
+RC ValueIndex::readHeader()
+{
+  RC               rc;
+  PageHandle       page;
+  ValueIndexHeader header;
+
+  if ((rc = pf.pin(0, page)) < 0) return rc;
+  memcpy(&header, page.data(), sizeof(header));
+
+  if (header.header.magic != FILE_MAGIC || header.header.version > FILE_VERSION ||
+      header.header.pageSize != PageFile::PAGE_SIZE) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+  rootPid = header.rootPid;
+  treeHeight = header.treeHeight;
+  entryCount = header.entryCount;
+
+  return 0;
+}
+
+RC ValueIndex::writeHeader()
+{
+  RC               rc;
+  PageHandle       page;
+  ValueIndexHeader header;
+
+  header.header.magic = FILE_MAGIC;
+  header.header.version = FILE_VERSION;
+  header.header.pageSize = PageFile::PAGE_SIZE;
+  header.rootPid = rootPid;
+  header.treeHeight = treeHeight;
+  header.entryCount = entryCount;
+
+  if ((rc = PageFile::newPage(page)) < 0) return rc;
+  memcpy(page.data(), &header, sizeof(header));
+  return pf.write(0, page);
+}
+
+RC ValueIndex::build(ExternalSort& entries, int fillPercent)
+{
+  RC    rc;
+  Entry entry;
+
+  // an empty index is built in place
+  if (entryCount == 0) {
+    TreeBuilder builder(pf, fillPercent);
+    while ((rc = entries.next(&entry)) == 0) {
+      if ((rc = builder.add(entry)) < 0) return rc;
+    }
+    if (rc != RC_END_OF_STREAM) return rc;
+    if ((rc = builder.finish(rootPid, treeHeight)) < 0) return rc;
+    entryCount = builder.count;
+    return writeHeader();
+  }
+
+  // otherwise the entries of the index are merged with the new ones
+  // into a new file, which replaces the index file at the end
+  PageFile       out;
+  string         outname = name + ".new";
+  ValueIndexScan scan;
+  Entry          old;
+  int            n;      // # of old entries read
+  RC             more;   // whether a new entry was read
+
+  remove(outname.c_str());
+  if ((rc = out.open(outname, 'w')) < 0) return rc;
+  TreeBuilder builder(out, fillPercent);
+
+  if ((rc = scan.open(*this, NULL, NULL)) < 0) goto fail;
+  n = scan.next(&old, 1);
+  more = entries.next(&entry);
+  while (n > 0 || more == 0) {
+    if (n > 0 && (more != 0 || !entryLess(&entry, &old))) {
+      if ((rc = builder.add(old)) < 0) goto fail;
+      n = scan.next(&old, 1);
+    } else {
+      if ((rc = builder.add(entry)) < 0) goto fail;
+      more = entries.next(&entry);
+    }
+  }
+  if (n < 0) { rc = n; goto fail; }
+  if (more != RC_END_OF_STREAM) { rc = more; goto fail; }
+  if ((rc = builder.finish(rootPid, treeHeight)) < 0) goto fail;
+  scan.close();
+  if ((rc = out.close()) < 0) goto fail;
+
+  // switch over to the new file
+  replaced.add(pf.getStats());
+  replaced.add(out.getStats());
+  pf.close();
+  if (rename(outname.c_str(), name.c_str()) != 0) return RC_FILE_WRITE_FAILED;
+  if ((rc = pf.open(name, mode)) < 0) return rc;
+  entryCount = builder.count;
+  return writeHeader();
+
+ fail:
+  // the old index stays as it was
+  scan.close();
+  out.close();
+  remove(outname.c_str());
+  readHeader();
+  return rc;
+}
+
+void ValueIndex::makeEntry(const string& value, int key, const RecordId& rid, Entry& entry)
+{
+  entry.length = value.size();
+  entry.key = key;
+  entry.rid = rid;
+  memset(entry.value, 0, MAX_KEY_LENGTH);
+  memcpy(entry.value, value.data(), entry.size());
+}
+
+bool ValueIndex::entryLess(const void* e1, const void* e2)
+{
+  const Entry* a = (const Entry*) e1;
+  const Entry* b = (const Entry*) e2;
+  int diff = compareKeys(a->value, a->size(), b->value, b->size());
+
+  if (diff != 0) return diff < 0;
+  if (a->rid.pid != b->rid.pid) return a->rid.pid < b->rid.pid;
+  return a->rid.sid < b->rid.sid;
+}
+
+IoStats ValueIndex::getStats() const
+{
+  IoStats stats = replaced;
+  stats.add(pf.getStats());
+  return stats;
+}
+
+
+ValueIndexScan::ValueIndexScan()
+{
+  pf = NULL;
+  eid = 0;
+  bounded = false;
+  done = true;
+}
+
+ValueIndexScan::~ValueIndexScan()
+{
+  close();
+}
+
+RC ValueIndexScan::open(const ValueIndex& index, const char* low, const char* high)
+{
+  RC     rc;
+  PageId pid = index.rootPid;
+  int    lowlen;
+
+  close();
+  pf = &index.pf;
+  bounded = (high != NULL);
+  if (bounded) this->high = high;
+  if (low == NULL) low = "";
+  lowlen = strlen(low);
+
+  // an empty index has nothing to scan. longer values are indexed by
+  // their prefix, which is where a range starting at them begins
+  if (index.treeHeight == 0) return 0;
+  if (lowlen > ValueIndex::MAX_KEY_LENGTH) lowlen = ValueIndex::MAX_KEY_LENGTH;
+
+  // go down to the leftmost leaf that may hold low. a separator equal
+  // to low may have equal keys on its left as well
+  for (int level = index.treeHeight - 1; level > 0; level--) {
+    if ((rc = pf->pin(pid, leaf)) < 0) return rc;
+    if (nodeLevel(leaf.data()) != level) return RC_INVALID_FILE_FORMAT;
+    int n = countSmaller(leaf.data(), low, lowlen);
+    pid = (n == 0) ? nodeLink(leaf.data()) : nodeChild(leaf.data(), n - 1);
+  }
+
+  leaf.release();
+  if ((rc = pf->pin(pid, leaf)) < 0) return rc;
+  if (nodeLevel(leaf.data()) != 0) return RC_INVALID_FILE_FORMAT;
+  eid = countSmaller(leaf.data(), low, lowlen);
+  done = false;
+
+  return 0;
+}
+
+int ValueIndexScan::next(ValueIndex::Entry entries[], int max)
+{
+  RC  rc;
+  int n = 0;
+
+  while (!done && n < max) {
+    // move on to the right sibling once the leaf is used up
+    if (eid >= nodeCount(leaf.data())) {
+      PageId pid = nodeLink(leaf.data());
+      leaf.release();
+      if (pid == 0) {
+        done = true;
+        break;
+      }
+      if ((rc = pf->pin(pid, leaf)) < 0) {
+        done = true;
+        return rc;
+      }
+      eid = 0;
+
+      // read its sibling in the background, if the range may go on there
+      int count = nodeCount(leaf.data());
+      int length;
+      const char* last = (count > 0) ? nodeKey(leaf.data(), count - 1, length) : NULL;
+      PageId sibling = nodeLink(leaf.data());
+      if (sibling != 0 && last != NULL &&
+          (!bounded || compareKeys(last, length, high.data(), high.size()) <= 0)) {
+        pf->willNeed(&sibling, 1);
+      }
+      continue;
+    }
+
+    readLeafEntry(leaf.data(), eid, entries[n]);
+    if (bounded && compareKeys(entries[n].value, entries[n].size(), high.data(), high.size()) > 0) {
+      done = true;
+      break;
+    }
+    eid++;
+    n++;
+  }
+
+  return n;
+}
+
+void ValueIndexScan::close()
+{
+  leaf.release();
+  eid = 0;
+  done = true;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef VALUEINDEX_H
+#define VALUEINDEX_H
+
+#include <string>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "ExternalSort.h"
+
+/**
+ * a B+tree index on the value column of a table, built by
+ * LOAD ... WITH INDEX ON value.
+ *
+ * the keys are strings of any length up to MAX_KEY_LENGTH, ordered like
+ * strcmp(). a longer value is indexed by its first MAX_KEY_LENGTH
+ * characters, and a condition on it has to be checked on the tuple.
+ * a value may appear any number of times; equal values are ordered by
+ * RecordId. every entry also holds the key of its tuple, so a query that
+ * needs nothing else of the tuple does not read the table.
+ *
+ * nodes are slotted pages of variable-length entries. an internal node
+ * holds separators that are cut down to the shortest prefix of the first
+ * key on their right that is still larger than the last key on their
+ * left, which keeps the fan-out high when values share long prefixes.
+ *
+ * the tree is built bottom-up from sorted entries. a load into a table
+ * whose index already has entries merges them with the new ones into a
+ * new tree, which then replaces the old one.
+ */
+class ValueIndex {
+ public:
+  // the longest value stored whole. values shorter than
+  // RecordFile::MAX_VALUE_LENGTH stay in their table page too
+  static const int MAX_KEY_LENGTH = RecordFile::MAX_VALUE_LENGTH - 1;
+
+  // identifies a value index file in its FileHeader on page 0
+  static const int FILE_MAGIC = 0x58494242;   // "BBIX"
+
+  // the current format version of value index files
+  static const int FILE_VERSION = 1;
+
+  /**
+   * an index entry, and the record build() sorts
+   */
+  struct Entry {
+    int      length;   // the length of the whole value
+    int      key;      // the key of the tuple
+    RecordId rid;      // the tuple
+    char     value[MAX_KEY_LENGTH];   // the value, up to MAX_KEY_LENGTH
+
+    // whether value holds the whole value
+    bool complete() const { return length <= MAX_KEY_LENGTH; }
+
+    // the # of characters in value
+    int size() const { return complete() ? length : MAX_KEY_LENGTH; }
+  };
+
+  ValueIndex();
+
+  /**
+   * open the index in read or write mode.
+   * under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the file name of the index
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * close the index.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * add the sorted entries to the index, which is rebuilt bottom-up.
+   * @param entries[IN] the finished sort of the new entries, in the
+   *                    order of entryLess()
+   * @param fillPercent[IN] how full to fill each node, from 1 to 100
+   * @return error code. 0 if no error
+   */
+  RC build(ExternalSort& entries, int fillPercent);
+
+  /**
+   * fill in the entry of a tuple.
+   * @param value[IN] the value of the tuple
+   * @param key[IN] the key of the tuple
+   * @param rid[IN] the RecordId of the tuple
+   * @param entry[OUT] the entry
+   */
+  static void makeEntry(const std::string& value, int key, const RecordId& rid, Entry& entry);
+
+  /**
+   * order two entries by value, then by RecordId. an ExternalSort::LessFunction
+   */
+  static bool entryLess(const void* e1, const void* e2);
+
+  /**
+   * @return the number of entries in the index
+   */
+  long long getEntryCount() const { return entryCount; }
+
+  /**
+   * @return the I/O statistics of the index since it was opened
+   */
+  IoStats getStats() const;
+
+ private:
+  RC readHeader();
+  RC writeHeader();
+
+  PageFile    pf;           // the PageFile used to store the nodes
+  std::string name;         // the file name, to replace the file
+  char        mode;         // the mode the file is open in
+  PageId      rootPid;      // the root node. 0 if the index is empty
+  int         treeHeight;   // # of levels. 0 if the index is empty
+  long long   entryCount;   // # of entries
+  IoStats     replaced;     // the I/O of the files build() replaced
+
+  friend class ValueIndexScan;
+};
+
+/**
+ * scans the entries of a ValueIndex in a range of values, in value
+ * order, a leaf at a time. the current leaf stays pinned between calls.
+ */
+class ValueIndexScan {
+ public:
+  ValueIndexScan();
+  ~ValueIndexScan();
+
+  /**
+   * start scanning the entries that may hold a value in [low, high].
+   * an entry of a long value is returned if its prefix is in the range,
+   * so the value has to be checked when the entry is not complete.
+   * @param index[IN] the open index. it must stay open during the scan
+   * @param low[IN] the lowest value of the range. NULL for no limit
+   * @param high[IN] the highest value of the range. NULL for no limit
+   * @return error code. 0 if no error
+   */
+  RC open(const ValueIndex& index, const char* low, const char* high);
+
+  /**
+   * read the next entries of the range.
+   * @param entries[OUT] the entries, room for max of them
+   * @param max[IN] the most entries to read
+   * @return the number of entries read, 0 at the end of the range, or
+   *         an error code
+   */
+  int next(ValueIndex::Entry entries[], int max);
+
+  /**
+   * end the scan and unpin its leaf.
+   */
+  void close();
+
+ private:
+  ValueIndexScan(const ValueIndexScan&);
+  ValueIndexScan& operator=(const ValueIndexScan&);
+
+  const PageFile* pf;     // the file of the index being scanned
+  PageHandle  leaf;       // the current leaf
+  int         eid;        // the next entry of the leaf to read
+  bool        bounded;    // whether the range has an upper end
+  std::string high;       // the upper end of the range
+  bool        done;       // whether the range has ended
+};
+
+#endif // VALUEINDEX_H
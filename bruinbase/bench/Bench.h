@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+
+/**
+ * helpers shared by the benchmark drivers in this directory.
+ * every driver takes its sizes as optional command-line arguments,
+ * prints one line per measurement and cleans up the files it made.
+ */
+
+/**
+ * @return the wall clock time in seconds
+ */
+inline double benchNow()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * print one measurement.
+ * @param name[IN] what was measured
+ * @param ops[IN] the number of operations done
+ * @param secs[IN] the time they took
+ */
+inline void benchReport(const char* name, long long ops, double secs)
+{
+  printf("%-32s %12lld ops %9.3f s %14.0f ops/s\n", name, ops, secs, secs > 0 ? ops / secs : 0.0);
+}
+
+/**
+ * @param argc[IN] the argument count of main()
+ * @param argv[IN] the arguments of main()
+ * @param i[IN] the position of the argument
+ * @param def[IN] the value used when the argument is missing
+ * @return the integer value of argument i
+ */
+inline long benchArg(int argc, char** argv, int i, long def)
+{
+  return (i < argc) ? atol(argv[i]) : def;
+}
+
+/**
+ * a fixed pseudo-random sequence (xorshift), so that runs compare.
+ */
+class BenchRandom {
+ public:
+  BenchRandom(unsigned seed = 2463534242u) : x(seed) { }
+
+  /**
+   * @param n[IN] the bound
+   * @return the next number in [0, n)
+   */
+  unsigned next(unsigned n)
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x % n;
+  }
+
+ private:
+  unsigned x;
+};
+
+#endif // BENCH_H
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * compares buffered and direct (O_DIRECT) PageFile I/O.
+ * a file of the given number of pages is written in order, then read
+ * in order and at random, with a page cache much smaller than the file.
+ *
+ *   usage: DirectIoBench [pages] [cacheMB] [randomReads]
+ *
+ * buffered reads may be served by the OS page cache, which is exactly
+ * what direct I/O gives up. to see cold-disk numbers, drop the OS cache
+ * between the runs (echo 3 > /proc/sys/vm/drop_caches as root).
+ */
+
+#include "Bench.h"
+#include "PageFile.h"
+#include <cstring>
+#include <unistd.h>
+
+static const char* FILE_NAME = "bench-directio.pf";
+
+static int run(bool direct, PageId pages, int cacheMB, long randomReads)
+{
+  const char* mode = direct ? "direct" : "buffered";
+  char name[64];
+  void* buffer;
+  PageFile pf;
+  RC rc;
+  double start;
+
+  PageFile::setDirectIO(direct);
+  PageFile::setCacheSize(cacheMB);
+  ::unlink(FILE_NAME);
+
+  if (posix_memalign(&buffer, PageFile::IO_ALIGN, PageFile::PAGE_SIZE) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return RC_OUT_OF_MEMORY;
+  }
+  memset(buffer, 'x', PageFile::PAGE_SIZE);
+
+  if ((rc = pf.open(FILE_NAME, 'w')) < 0) {
+    fprintf(stderr, "cannot open %s\n", FILE_NAME);
+    free(buffer);
+    return rc;
+  }
+  if (direct && !pf.isDirect()) {
+    printf("%s: the file system cannot do direct I/O here, skipped\n", mode);
+    pf.close();
+    ::unlink(FILE_NAME);
+    free(buffer);
+    return 0;
+  }
+
+  // sequential write. close() flushes what is still cached
+  start = benchNow();
+  for (PageId pid = 0; pid < pages && rc == 0; pid++) {
+    *(PageId*) buffer = pid;
+    rc = pf.write(pid, buffer);
+  }
+  if (pf.close() < 0 || rc < 0) {
+    fprintf(stderr, "%s: write failed\n", mode);
+    free(buffer);
+    return RC_FILE_WRITE_FAILED;
+  }
+  sprintf(name, "%s sequential write", mode);
+  benchReport(name, pages, benchNow() - start);
+
+  // start the reads with an empty page cache
+  PageFile::setCacheSize(cacheMB);
+  pf.open(FILE_NAME, 'r');
+
+  start = benchNow();
+  for (PageId pid = 0; pid < pages && rc == 0; pid++) rc = pf.read(pid, buffer);
+  sprintf(name, "%s sequential read", mode);
+  benchReport(name, pages, benchNow() - start);
+
+  BenchRandom random;
+  start = benchNow();
+  for (long i = 0; i < randomReads && rc == 0; i++) rc = pf.read(random.next(pages), buffer);
+  sprintf(name, "%s random read", mode);
+  benchReport(name, randomReads, benchNow() - start);
+
+  if (rc < 0) fprintf(stderr, "%s: read failed\n", mode);
+
+  pf.close();
+  ::unlink(FILE_NAME);
+  free(buffer);
+  return rc;
+}
+
+int main(int argc, char** argv)
+{
+  PageId pages = benchArg(argc, argv, 1, (64 << 20) / PageFile::PAGE_SIZE);
+  int cacheMB = benchArg(argc, argv, 2, 4);
+  long randomReads = benchArg(argc, argv, 3, pages / 4);
+
+  printf("%d pages of %d bytes, %d MB page cache\n", pages, PageFile::PAGE_SIZE, cacheMB);
+  if (run(false, pages, cacheMB, randomReads) < 0) return 1;
+  if (run(true, pages, cacheMB, randomReads) < 0) return 1;
+  return 0;
+}
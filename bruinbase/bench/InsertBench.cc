@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * measures the insert paths of the B+tree nodes.
+ * leaf and nonleaf nodes are filled with random keys by insert(), full
+ * nodes are split by insertAndSplit(), and finally whole indexes are
+ * built by BTreeIndex::insert() from random and from ascending keys.
+ *
+ *   usage: InsertBench [nodeInserts] [indexKeys]
+ */
+
+#include "Bench.h"
+#include "BTreeIndex.h"
+#include "BTreeNode.h"
+#include <unistd.h>
+#include <vector>
+
+static const char* INDEX_NAME = "bench-insert.idx";
+
+static void leafInserts(long total, const std::vector<int>& keys)
+{
+  RecordId rid = { 0, 0 };
+  long done = 0;
+  double start = benchNow();
+
+  while (done < total) {
+    BTLeafNode leaf;
+    for (int i = 0; i < BTLeafNode::MAX_LEAF_KEYS && done < total; i++, done++) {
+      rid.sid = i;
+      leaf.insert(keys[done % keys.size()], rid);
+    }
+  }
+  benchReport("leaf insert", done, benchNow() - start);
+}
+
+static void leafSplits(long total, const std::vector<int>& keys)
+{
+  RecordId rid = { 0, 0 };
+  double spent = 0;
+  long done;
+
+  for (done = 0; done < total; done++) {
+    BTLeafNode leaf, sibling;
+    int siblingKey;
+    for (int i = 0; i < BTLeafNode::MAX_LEAF_KEYS; i++) {
+      rid.sid = i;
+      leaf.append(2 * i, rid);
+    }
+    double start = benchNow();
+    leaf.insertAndSplit(keys[done % keys.size()] % (2 * BTLeafNode::MAX_LEAF_KEYS), rid, sibling, siblingKey);
+    spent += benchNow() - start;
+  }
+  benchReport("leaf insertAndSplit", done, spent);
+}
+
+static void nonLeafInserts(long total, const std::vector<int>& keys)
+{
+  long done = 0;
+  double start = benchNow();
+
+  while (done < total) {
+    BTNonLeafNode node;
+    node.initializeRoot(0, keys[done % keys.size()], 1);
+    done++;
+    for (int i = 1; i < BTNonLeafNode::MAX_NON_KEYS && done < total; i++, done++) {
+      node.insert(keys[done % keys.size()], i + 1);
+    }
+  }
+  benchReport("nonleaf insert", done, benchNow() - start);
+}
+
+static void nonLeafSplits(long total, const std::vector<int>& keys)
+{
+  double spent = 0;
+  long done;
+
+  for (done = 0; done < total; done++) {
+    BTNonLeafNode node, sibling;
+    int midKey;
+    node.initializeRoot(0, 0, 1);
+    for (int i = 1; i < BTNonLeafNode::MAX_NON_KEYS; i++) node.append(2 * i, i + 1);
+    double start = benchNow();
+    node.insertAndSplit((keys[done % keys.size()] % (2 * BTNonLeafNode::MAX_NON_KEYS)) | 1, 0, sibling, midKey);
+    spent += benchNow() - start;
+  }
+  benchReport("nonleaf insertAndSplit", done, spent);
+}
+
+static int indexInserts(const char* name, const std::vector<int>& keys)
+{
+  BTreeIndex index;
+  RecordId rid;
+  RC rc;
+
+  ::unlink(INDEX_NAME);
+  if ((rc = index.open(INDEX_NAME, 'w')) < 0) {
+    fprintf(stderr, "cannot create %s\n", INDEX_NAME);
+    return rc;
+  }
+
+  double start = benchNow();
+  for (unsigned i = 0; i < keys.size() && rc >= 0; i++) {
+    rid.pid = i / 64;
+    rid.sid = i % 64;
+    rc = index.insert(keys[i], rid);
+  }
+  index.close();
+  benchReport(name, keys.size(), benchNow() - start);
+
+  ::unlink(INDEX_NAME);
+  if (rc < 0) fprintf(stderr, "insert failed: %d\n", rc);
+  return rc;
+}
+
+int main(int argc, char** argv)
+{
+  long nodeInserts = benchArg(argc, argv, 1, 10000000);
+  int indexKeys = benchArg(argc, argv, 2, 1000000);
+  BenchRandom random;
+
+  std::vector<int> keys(indexKeys > 65536 ? indexKeys : 65536);
+  for (unsigned i = 0; i < keys.size(); i++) keys[i] = random.next(1 << 30);
+
+  leafInserts(nodeInserts, keys);
+  leafSplits(nodeInserts / BTLeafNode::MAX_LEAF_KEYS, keys);
+  nonLeafInserts(nodeInserts, keys);
+  nonLeafSplits(nodeInserts / BTNonLeafNode::MAX_NON_KEYS, keys);
+
+  keys.resize(indexKeys);
+  if (indexInserts("index insert, random keys", keys) < 0) return 1;
+  for (int i = 0; i < indexKeys; i++) keys[i] = i;
+  if (indexInserts("index insert, ascending keys", keys) < 0) return 1;
+  return 0;
+}
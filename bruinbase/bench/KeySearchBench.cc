@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * compares the KeySearch strategies.
+ * an index of the given number of keys is bulk loaded with plain leaves,
+ * whose keys are searched with KeySearch, and the same random point
+ * lookups are run with every strategy. the search of a single node is
+ * timed too, to show the strategies apart from the rest of a lookup.
+ *
+ *   usage: KeySearchBench [keys] [lookups] [fillPercent]
+ */
+
+#include "Bench.h"
+#include "BTreeIndex.h"
+#include "BTreeNode.h"
+#include "KeySearch.h"
+#include <unistd.h>
+#include <vector>
+
+static const char* INDEX_NAME = "bench-keysearch.idx";
+static const char* STRATEGIES[] = { "linear", "binary", "sse", "avx2" };
+
+int main(int argc, char** argv)
+{
+  int keys = benchArg(argc, argv, 1, 1000000);
+  long lookups = benchArg(argc, argv, 2, 1000000);
+  int fillPercent = benchArg(argc, argv, 3, 100);
+  KeySearch::Strategy initial = KeySearch::getStrategy();
+  BTreeIndex index;
+  RecordId rid;
+  RC rc;
+
+  // keys are even, so half of the lookups below miss
+  ::unlink(INDEX_NAME);
+  BTreeIndex::setPackedLeaves(false);
+  if ((rc = index.open(INDEX_NAME, 'w')) < 0 || (rc = index.beginBulkLoad(fillPercent)) < 0) {
+    fprintf(stderr, "cannot create %s\n", INDEX_NAME);
+    return 1;
+  }
+  for (int i = 0; i < keys && rc == 0; i++) {
+    rid.pid = i / 64;
+    rid.sid = i % 64;
+    rc = index.bulkInsert(2 * i, rid);
+  }
+  if (rc < 0 || (rc = index.endBulkLoad()) < 0) {
+    fprintf(stderr, "bulk load failed: %d\n", rc);
+    return 1;
+  }
+
+  std::vector<int> probes(lookups);
+  BenchRandom random;
+  for (long i = 0; i < lookups; i++) probes[i] = random.next(2 * keys);
+
+  // a node-sized array of keys for the search alone
+  std::vector<int> node(BTLeafNode::MAX_LEAF_KEYS);
+  for (unsigned i = 0; i < node.size(); i++) node[i] = 2 * i;
+
+  printf("%d keys, %ld lookups, %d%% full nodes, %d keys per leaf\n",
+         keys, lookups, fillPercent, BTLeafNode::MAX_LEAF_KEYS);
+
+  for (int s = 0; s < 4; s++) {
+    KeySearch::Strategy strategy;
+    IndexCursor cursor;
+    char name[64];
+    double start;
+    long found = 0;
+
+    KeySearch::parse(STRATEGIES[s], strategy);
+    if (!KeySearch::setStrategy(strategy)) {
+      printf("%s: not available on this CPU or build, skipped\n", STRATEGIES[s]);
+      continue;
+    }
+
+    start = benchNow();
+    for (long i = 0; i < lookups; i++) {
+      if (index.locate(probes[i], cursor) == 0) found++;
+    }
+    sprintf(name, "%s index lookup", STRATEGIES[s]);
+    benchReport(name, lookups, benchNow() - start);
+
+    start = benchNow();
+    for (long i = 0; i < lookups; i++) {
+      found += KeySearch::countLess(&node[0], 1, node.size(), probes[i] % (2 * node.size()));
+    }
+    sprintf(name, "%s node search", STRATEGIES[s]);
+    benchReport(name, lookups, benchNow() - start);
+
+    // keeps the searches from being optimized away
+    if (found < 0) printf("%ld\n", found);
+  }
+
+  KeySearch::setStrategy(initial);
+  index.close();
+  ::unlink(INDEX_NAME);
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * compares packed and plain B+tree leaves.
+ * the same index is bulk loaded once with each leaf format, with keys and
+ * RecordIds shaped like those of a table loaded in key order. the size of
+ * the index is printed, then random point lookups and random inserts
+ * into the loaded leaves are timed.
+ *
+ *   usage: PackedLeafBench [keys] [lookups] [inserts] [cacheMB]
+ *
+ * with a page cache smaller than the index, the lookups show how much
+ * the smaller packed index saves on reads.
+ */
+
+#include "Bench.h"
+#include "BTreeIndex.h"
+#include "BufferPool.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static const char* INDEX_NAME = "bench-packed.idx";
+static const int ROWS_PER_PAGE = 50;   // RecordIds of a table of short tuples
+
+static int run(bool packed, int keys, const std::vector<int>& probes, long inserts, int cacheMB)
+{
+  const char* format = packed ? "packed" : "plain";
+  BTreeIndex index;
+  IndexCursor cursor;
+  RecordId rid;
+  struct stat st;
+  char name[64];
+  double start;
+  long found = 0;
+  RC rc;
+
+  BTreeIndex::setPackedLeaves(packed);
+  ::unlink(INDEX_NAME);
+  if ((rc = index.open(INDEX_NAME, 'w')) < 0 || (rc = index.beginBulkLoad(100)) < 0) {
+    fprintf(stderr, "cannot create %s\n", INDEX_NAME);
+    return rc;
+  }
+
+  // even keys, so that the inserts below go between them
+  start = benchNow();
+  for (int i = 0; i < keys && rc == 0; i++) {
+    rid.pid = i / ROWS_PER_PAGE;
+    rid.sid = i % ROWS_PER_PAGE;
+    rc = index.bulkInsert(2 * i, rid);
+  }
+  if (rc < 0 || (rc = index.endBulkLoad()) < 0 || (rc = index.close()) < 0) {
+    fprintf(stderr, "%s: bulk load failed: %d\n", format, rc);
+    return rc;
+  }
+  sprintf(name, "%s bulk load", format);
+  benchReport(name, keys, benchNow() - start);
+
+  ::stat(INDEX_NAME, &st);
+  printf("%-32s %12lld bytes %9lld pages\n", format, (long long) st.st_size,
+         (long long) st.st_size / PageFile::PAGE_SIZE);
+
+  // start the lookups with an empty page cache
+  PageFile::setCacheSize(cacheMB);
+  if ((rc = index.open(INDEX_NAME, 'r')) < 0) {
+    fprintf(stderr, "%s: cannot open %s\n", format, INDEX_NAME);
+    return rc;
+  }
+
+  start = benchNow();
+  for (unsigned i = 0; i < probes.size(); i++) {
+    int key;
+    if (index.locate(probes[i], cursor) == 0 && index.readForward(cursor, key, rid) == 0) found++;
+  }
+  sprintf(name, "%s point lookup", format);
+  benchReport(name, probes.size(), benchNow() - start);
+  index.close();
+
+  // every probe is a loaded key
+  if (found != (long) probes.size()) {
+    fprintf(stderr, "%s: found %ld of %ld keys\n", format, found, (long) probes.size());
+    ::unlink(INDEX_NAME);
+    return RC_NO_SUCH_RECORD;
+  }
+
+  // odd keys land between the loaded ones
+  if ((rc = index.open(INDEX_NAME, 'w')) < 0) {
+    fprintf(stderr, "%s: cannot open %s\n", format, INDEX_NAME);
+    return rc;
+  }
+  start = benchNow();
+  for (long i = 0; i < inserts && rc >= 0; i++) {
+    rid.pid = keys / ROWS_PER_PAGE + i / ROWS_PER_PAGE;
+    rid.sid = i % ROWS_PER_PAGE;
+    rc = index.insert(2 * (probes[i % probes.size()] / 2) + 1, rid);
+  }
+  index.close();
+  sprintf(name, "%s insert", format);
+  benchReport(name, inserts, benchNow() - start);
+
+  ::stat(INDEX_NAME, &st);
+  printf("%-32s %12lld bytes %9lld pages\n", "  after the inserts", (long long) st.st_size,
+         (long long) st.st_size / PageFile::PAGE_SIZE);
+
+  ::unlink(INDEX_NAME);
+  if (rc < 0) fprintf(stderr, "%s: insert failed: %d\n", format, rc);
+  return rc;
+}
+
+int main(int argc, char** argv)
+{
+  int keys = benchArg(argc, argv, 1, 4000000);
+  long lookups = benchArg(argc, argv, 2, 1000000);
+  long inserts = benchArg(argc, argv, 3, 200000);
+  int cacheMB = benchArg(argc, argv, 4, BufferPool::DEFAULT_SIZE_MB);
+  BenchRandom random;
+
+  std::vector<int> probes(lookups > 0 ? lookups : 1);
+  for (unsigned i = 0; i < probes.size(); i++) probes[i] = 2 * random.next(keys);
+
+  printf("%d keys, %ld lookups, %ld inserts, %d MB page cache\n", keys, lookups, inserts, cacheMB);
+  if (run(false, keys, probes, inserts, cacheMB) < 0) return 1;
+  if (run(true, keys, probes, inserts, cacheMB) < 0) return 1;
+  return 0;
+}
@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# measure the Bloom filters on values against plain scans for
+# value = 'x' selections on movie.del-shaped data.
+# the table is loaded once without filters (-e 0) and once for every
+# given false positive rate, each time without and with a B+tree index
+# on key, and each load runs the same selections of values that occur
+# once and of values that do not occur at all.
+# bruinbase prints the time and the pages read by every selection.
+#
+#   usage: bloom.sh [rows] [rates]
+#
+# rows defaults to 100000000, which makes a load file of about 3 GB and
+# takes a long while to load; try 1000000 first. rates defaults to "1".
+# the load file is kept as bench-movies-<rows>.del for the next run.
+# set BRUINBASE to the binary to run, and BRUINBASE_OPTS to add options.
+#
+
+rows=${1:-100000000}
+rates=${2:-1}
+dir=`dirname $0`
+bruinbase=${BRUINBASE:-$dir/../bruinbase}
+data=bench-movies-$rows.del
+
+if [ ! -f "$data" ]; then
+  echo "generating $data"
+  $dir/genmovies.sh $rows > "$data" || exit 1
+fi
+
+# values of rows at the start, middle and end of the table.
+# titles with a quote in them cannot be written in a query, so the
+# first title without one at or after each row is taken
+present=`awk -v rows="$rows" '
+  BEGIN { want[0] = 0; want[1] = int(rows / 2); want[2] = rows - 100; w = 0 }
+  w < 3 && NR > want[w] && index($0, "\047") == 0 {
+    print substr($0, index($0, ",") + 2, length($0) - index($0, ",") - 2)
+    w++
+  }' "$data"`
+
+queries() {
+  echo "$present" | while read value; do
+    echo "SELECT COUNT(*) FROM bench WHERE value = '$value'"
+  done
+  echo "SELECT COUNT(*) FROM bench WHERE value = 'No Such Movie'"
+  echo "SELECT COUNT(*) FROM bench WHERE value = 'Baby Take a Bow (0)'"
+  echo "SELECT COUNT(*) FROM bench WHERE value = 'zzz'"
+}
+
+for rate in 0 $rates; do
+  for index in "" " WITH INDEX"; do
+    rm -f bench.tbl bench.zone bench.bloom bench.idx
+    if [ "$rate" = 0 ]; then
+      echo "== no filters$index"
+    else
+      echo "== filters with a $rate% false positive rate$index"
+    fi
+    { echo "LOAD bench FROM '$data'$index"; queries; echo "QUIT"; } |
+      $bruinbase $BRUINBASE_OPTS -e $rate 2>&1 | grep -- "--"
+  done
+done
+
+rm -f bench.tbl bench.zone bench.bloom bench.idx
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# write a movie.del-shaped load file of the given number of rows.
+# row i gets key i and a title of movie.del, and every copy of a title
+# after the first gets a " (n)" suffix, so that values stay about as
+# long and as rare as in movie.del.
+#
+#   usage: genmovies.sh rows [movie.del] > file.del
+#
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 rows [movie.del] > file.del" >&2
+  exit 1
+fi
+
+rows=$1
+movies=${2:-`dirname $0`/../movie.del}
+
+awk -v rows="$rows" '
+  # the title is everything after the first comma, without its quotes
+  { title[n++] = substr($0, index($0, ",") + 2, length($0) - index($0, ",") - 2) }
+  END {
+    for (i = 0; i < rows; i++) {
+      copy = int(i / n)
+      if (copy == 0) printf "%d,\"%s\"\n", i, title[i % n]
+      else printf "%d,\"%s (%d)\"\n", i, title[i % n], copy
+    }
+  }' "$movies"
@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# compare page sizes on the same load and queries.
+# bruinbase is built once for every given page size (make bruinbase-<size>),
+# then each build loads the same movie.del-shaped table WITH INDEX and runs
+# the same selections: point lookups, a short and a long key range, and a
+# value selection. the load is timed here. the queries run in a fresh
+# process with an empty page cache, and bruinbase prints the time and the
+# pages read by each of them.
+#
+#   usage: pagesize.sh [rows] [sizes]
+#
+# rows defaults to 1000000, sizes to "4096 16384". the load file is kept
+# as bench-movies-<rows>.del for the next run. set BRUINBASE_OPTS to add
+# options, e.g. a page cache smaller than the table with -c.
+#
+
+rows=${1:-1000000}
+sizes=${2:-4096 16384}
+dir=`dirname $0`
+top=$dir/..
+data=bench-movies-$rows.del
+
+if [ ! -f "$data" ]; then
+  echo "generating $data"
+  $dir/genmovies.sh $rows > "$data" || exit 1
+fi
+
+# keys at the start, middle and end of the table, and a value of the middle
+mid=`expr $rows / 2`
+value=`awk -v want="$mid" '
+  NR > want && index($0, "\047") == 0 {
+    print substr($0, index($0, ",") + 2, length($0) - index($0, ",") - 2)
+    exit
+  }' "$data"`
+
+queries() {
+  for key in 1 $mid `expr $rows - 1`; do
+    echo "SELECT * FROM bench WHERE key = $key"
+  done
+  echo "SELECT COUNT(*) FROM bench WHERE key >= $mid AND key < `expr $mid + 1000`"
+  echo "SELECT COUNT(*) FROM bench WHERE key >= `expr $rows / 4` AND key < `expr $rows / 4 \* 3`"
+  echo "SELECT COUNT(*) FROM bench WHERE value = '$value'"
+}
+
+for size in $sizes; do
+  make -s -C $top bruinbase-$size || exit 1
+  echo "== $size-byte pages"
+
+  rm -f bench.tbl bench.idx bench.zone bench.bloom
+  start=`date +%s%N`
+  { echo "LOAD bench FROM '$data' WITH INDEX"; echo "QUIT"; } |
+    $top/bruinbase-$size $BRUINBASE_OPTS > /dev/null 2>&1
+  end=`date +%s%N`
+  awk -v s="$start" -v e="$end" 'BEGIN { printf "  -- %.3f seconds to load the table.", (e - s) / 1e9 }'
+  ls -l bench.tbl bench.idx | awk '{ printf " %s: %d bytes.", $NF, $5 } END { print "" }'
+
+  { queries; echo "QUIT"; } |
+    $top/bruinbase-$size $BRUINBASE_OPTS 2>&1 | grep -- "--"
+done
+
+rm -f bench.tbl bench.idx bench.zone bench.bloom
@@ -9,12 +9,99 @@
  
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "KeySearch.h"
+#include "ExternalSort.h"
+#include "BTreeIndex.h"
 #include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 
-int main()
+static void usage(const char* prog)
 {
+  fprintf(stderr, "usage: %s [-c cache_size_in_MB] [-p policy] [-k search] [-f fill_percent] [-b sort_memory_in_MB] [-e filter_rate_in_percent] [-l] [-u] [-s] [-m] [-d]\n", prog);
+  fprintf(stderr, "  -p  page cache replacement policy: lru, clock, 2q or arc (default)\n");
+  fprintf(stderr, "  -k  B+tree node search: linear, binary, sse or avx2 (default: avx2 if supported, else binary)\n");
+  fprintf(stderr, "  -f  how full LOAD ... WITH INDEX fills new index nodes, 1-100 (default: 90)\n");
+  fprintf(stderr, "  -b  memory budget of the sort that builds an index on LOAD (default: 64)\n");
+  fprintf(stderr, "  -e  false positive rate of the Bloom filters on values of new tables, 0 for none (default: 1)\n");
+  fprintf(stderr, "  -l  store the entries of new index leaves unpacked\n");
+  fprintf(stderr, "  -u  let SELECT print the tuples of large index ranges in table order\n");
+  fprintf(stderr, "  -s  write pages through to the disk instead of caching them\n");
+  fprintf(stderr, "  -m  memory-map table and index files for SELECT\n");
+  fprintf(stderr, "  -d  bypass the kernel page cache with direct I/O\n");
+}
+
+int main(int argc, char* argv[])
+{
+  int opt;
+  ReplacementPolicy::Kind policy;
+  KeySearch::Strategy search;
+
+  // parse the startup options
+  while ((opt = getopt(argc, argv, "c:p:k:f:b:e:lusmd")) != -1) {
+    switch (opt) {
+    case 'c':
+      if (PageFile::setCacheSize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid cache size %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'p':
+      if (!ReplacementPolicy::parse(optarg, policy)) {
+        fprintf(stderr, "Error: unknown replacement policy %s\n", optarg);
+        return 1;
+      }
+      PageFile::setCachePolicy(policy);
+      break;
+    case 'k':
+      if (!KeySearch::parse(optarg, search) || !KeySearch::setStrategy(search)) {
+        fprintf(stderr, "Error: node search %s is not supported\n", optarg);
+        return 1;
+      }
+      break;
+    case 'f':
+      if (SqlEngine::setFillPercent(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid fill factor %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'b':
+      if (ExternalSort::setMemoryLimit(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid sort memory %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'e':
+      if (RecordFile::setFilterRate(atof(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid false positive rate %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'l':
+      BTreeIndex::setPackedLeaves(false);
+      break;
+    case 'u':
+      SqlEngine::setKeyOrder(false);
+      break;
+    case 's':
+      PageFile::setWriteBack(false);
+      break;
+    case 'm':
+      SqlEngine::setMappedReads(true);
+      break;
+    case 'd':
+      PageFile::setDirectIO(true);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 
   return 0;
-}
\ No newline at end of file
+}